@@ -0,0 +1,116 @@
+#include "AesContext.h"
+#include <iostream>
+#include <cstring>
+
+namespace {
+    // Every message starts from a zero IV (as specified)
+    const uint8_t ZERO_IV[AesContext::BLOCK_SIZE] = {0};
+    
+    // Each GCM message brings its own nonce; this one only completes the initial keying
+    const uint8_t SETUP_NONCE[AesContext::GCM_NONCE_SIZE] = {0};
+}
+
+AesContext::AesContext() : keyed_(false) {
+}
+
+bool AesContext::setKey(const uint8_t* key, size_t size) {
+    keyed_ = false;
+    if (size != KEY_SIZE) {
+        std::cerr << "Invalid AES key size: " << size << " bytes" << std::endl;
+        return false;
+    }
+    
+    try {
+        encryption_.SetKeyWithIV(key, size, ZERO_IV);
+        decryption_.SetKeyWithIV(key, size, ZERO_IV);
+        gcm_encryption_.SetKeyWithIV(key, size, SETUP_NONCE, GCM_NONCE_SIZE);
+        gcm_decryption_.SetKeyWithIV(key, size, SETUP_NONCE, GCM_NONCE_SIZE);
+        keyed_ = true;
+        return true;
+    } catch (const CryptoPP::Exception& e) {
+        std::cerr << "Error setting AES key: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+size_t AesContext::encrypt(const uint8_t* data, size_t size, uint8_t* out) {
+    if (!keyed_) return 0;
+    
+    try {
+        encryption_.Resynchronize(ZERO_IV);
+        
+        // Whole blocks straight from the input, then the tail with its PKCS#7 padding
+        size_t whole = size - size % BLOCK_SIZE;
+        if (whole > 0) {
+            encryption_.ProcessData(out, data, whole);
+        }
+        
+        uint8_t last[BLOCK_SIZE];
+        size_t tail = size - whole;
+        std::memcpy(last, data + whole, tail);
+        std::memset(last + tail, static_cast<int>(BLOCK_SIZE - tail), BLOCK_SIZE - tail);
+        encryption_.ProcessData(out + whole, last, BLOCK_SIZE);
+        return whole + BLOCK_SIZE;
+    } catch (const CryptoPP::Exception& e) {
+        std::cerr << "Error encrypting with AES: " << e.what() << std::endl;
+        return 0;
+    }
+}
+
+bool AesContext::decrypt(const uint8_t* data, size_t size, uint8_t* out, size_t& plaintext_size) {
+    if (!keyed_ || size == 0 || size % BLOCK_SIZE != 0) return false;
+    
+    try {
+        decryption_.Resynchronize(ZERO_IV);
+        decryption_.ProcessData(out, data, size);
+    } catch (const CryptoPP::Exception& e) {
+        std::cerr << "Error decrypting with AES: " << e.what() << std::endl;
+        return false;
+    }
+    
+    // Same padding check StreamTransformationFilter makes
+    uint8_t padding = out[size - 1];
+    if (padding == 0 || padding > BLOCK_SIZE) return false;
+    for (size_t i = size - padding; i < size; i++) {
+        if (out[i] != padding) return false;
+    }
+    
+    plaintext_size = size - padding;
+    return true;
+}
+
+size_t AesContext::encryptGcm(const uint8_t* nonce, const uint8_t* data, size_t size, uint8_t* out) {
+    if (!keyed_) return 0;
+    
+    try {
+        // Layout: marker, nonce, ciphertext, tag; the marker is the associated data
+        out[0] = GCM_MARKER;
+        std::memcpy(out + 1, nonce, GCM_NONCE_SIZE);
+        gcm_encryption_.EncryptAndAuthenticate(out + 1 + GCM_NONCE_SIZE, out + 1 + GCM_NONCE_SIZE + size,
+                                               GCM_TAG_SIZE, nonce, GCM_NONCE_SIZE, out, 1, data, size);
+        return size + GCM_OVERHEAD;
+    } catch (const CryptoPP::Exception& e) {
+        std::cerr << "Error encrypting with AES-GCM: " << e.what() << std::endl;
+        return 0;
+    }
+}
+
+bool AesContext::decryptGcm(const uint8_t* data, size_t size, uint8_t* out, size_t& plaintext_size) {
+    if (!keyed_ || !looksLikeGcm(data, size)) return false;
+    
+    size_t ciphertext_size = size - GCM_OVERHEAD;
+    const uint8_t* nonce = data + 1;
+    const uint8_t* ciphertext = nonce + GCM_NONCE_SIZE;
+    try {
+        if (!gcm_decryption_.DecryptAndVerify(out, ciphertext + ciphertext_size, GCM_TAG_SIZE, nonce, GCM_NONCE_SIZE,
+                                              data, 1, ciphertext, ciphertext_size)) {
+            return false;
+        }
+    } catch (const CryptoPP::Exception& e) {
+        std::cerr << "Error decrypting with AES-GCM: " << e.what() << std::endl;
+        return false;
+    }
+    
+    plaintext_size = ciphertext_size;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef AES_CONTEXT_H
+#define AES_CONTEXT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cryptopp/aes.h>
+#include <cryptopp/modes.h>
+#include <cryptopp/gcm.h>
+
+/**
+ * AesContext - Reusable AES-128 ciphers for one peer's symmetric key
+ *
+ * Features:
+ * - Key schedules (and GCM tables) are expanded once in setKey and reused for every message
+ * - CBC: zero IV and PKCS#7 padding, byte-compatible with ClientCrypto::encryptAES/decryptAES
+ * - GCM: marker(1) + nonce(12) + ciphertext + tag(16); the marker is authenticated too,
+ *   and Crypto++ picks AES-NI/CLMUL (or ARMv8 AES/PMULL) at run time when present
+ * - Output goes to a caller-provided buffer; no filters, sinks or allocations per message
+ *
+ * A context keeps cipher state while it works and is not thread-safe;
+ * concurrent users each need their own context.
+ */
+class AesContext {
+public:
+    static const size_t KEY_SIZE = 16;
+    static const size_t BLOCK_SIZE = CryptoPP::AES::BLOCKSIZE;
+    static const uint8_t GCM_MARKER = 0xA7;   // First byte of a GCM message
+    static const size_t GCM_NONCE_SIZE = 12;
+    static const size_t GCM_TAG_SIZE = 16;
+    static const size_t GCM_OVERHEAD = 1 + GCM_NONCE_SIZE + GCM_TAG_SIZE;
+    
+    AesContext();
+    
+    bool setKey(const uint8_t* key, size_t size);
+    bool hasKey() const { return keyed_; }
+    
+    // Ciphertext size for a plaintext: always at least one byte of padding
+    static size_t ciphertextSize(size_t plaintext_size) {
+        return (plaintext_size / BLOCK_SIZE + 1) * BLOCK_SIZE;
+    }
+    
+    // out must hold ciphertextSize(size) bytes; returns the bytes written, 0 on failure
+    size_t encrypt(const uint8_t* data, size_t size, uint8_t* out);
+    
+    // out must hold size bytes and may be data itself; plaintext_size is set on success
+    bool decrypt(const uint8_t* data, size_t size, uint8_t* out, size_t& plaintext_size);
+    
+    // nonce must never repeat under one key; out must hold size + GCM_OVERHEAD bytes
+    size_t encryptGcm(const uint8_t* nonce, const uint8_t* data, size_t size, uint8_t* out);
+    
+    // Fails unless the tag verifies, and out must then be discarded; out must hold size bytes and not overlap data
+    bool decryptGcm(const uint8_t* data, size_t size, uint8_t* out, size_t& plaintext_size);
+    
+    static bool looksLikeGcm(const uint8_t* data, size_t size) {
+        return size >= GCM_OVERHEAD && data[0] == GCM_MARKER;
+    }
+    
+private:
+    AesContext(const AesContext&);
+    AesContext& operator=(const AesContext&);
+    
+    CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption encryption_;
+    CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption decryption_;
+    CryptoPP::GCM<CryptoPP::AES>::Encryption gcm_encryption_;
+    CryptoPP::GCM<CryptoPP::AES>::Decryption gcm_decryption_;
+    bool keyed_;
+};
+
+#endif // AES_CONTEXT_H
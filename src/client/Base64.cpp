@@ -0,0 +1,297 @@
+#include "Base64.h"
+
+#if defined(__x86_64__)
+#define BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+    typedef size_t (*EncodeFunction)(const uint8_t* data, size_t size, char* out);
+    typedef size_t (*DecodeFunction)(const uint8_t* encoded, size_t size, uint8_t* out);
+    
+    struct EncodeImpl {
+        EncodeFunction function;
+        const char* name;
+    };
+    
+    struct DecodeImpl {
+        DecodeFunction function;
+        const char* name;
+    };
+    
+    const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const uint8_t INVALID = 0xFF;
+    
+    struct DecodeTable {
+        uint8_t values[256];
+        
+        DecodeTable() {
+            for (int i = 0; i < 256; i++) {
+                values[i] = INVALID;
+            }
+            for (uint8_t i = 0; i < 64; i++) {
+                values[static_cast<uint8_t>(ALPHABET[i])] = i;
+            }
+        }
+    };
+    
+    size_t encodeScalar(const uint8_t* data, size_t size, char* out) {
+        size_t i = 0;
+        char* start = out;
+        for (; i + 3 <= size; i += 3) {
+            uint32_t group = static_cast<uint32_t>(data[i]) << 16 | static_cast<uint32_t>(data[i + 1]) << 8 | data[i + 2];
+            *out++ = ALPHABET[group >> 18];
+            *out++ = ALPHABET[(group >> 12) & 0x3F];
+            *out++ = ALPHABET[(group >> 6) & 0x3F];
+            *out++ = ALPHABET[group & 0x3F];
+        }
+        
+        size_t tail = size - i;
+        if (tail > 0) {
+            uint32_t group = static_cast<uint32_t>(data[i]) << 16;
+            if (tail == 2) group |= static_cast<uint32_t>(data[i + 1]) << 8;
+            *out++ = ALPHABET[group >> 18];
+            *out++ = ALPHABET[(group >> 12) & 0x3F];
+            *out++ = tail == 2 ? ALPHABET[(group >> 6) & 0x3F] : '=';
+            *out++ = '=';
+        }
+        return static_cast<size_t>(out - start);
+    }
+    
+    size_t decodeScalar(const uint8_t* encoded, size_t size, uint8_t* out) {
+        static const DecodeTable table;
+        const uint8_t* values = table.values;
+        uint8_t* start = out;
+        uint32_t bits = 0;
+        int pending = 0;  // Bits in the accumulator not yet written out
+        
+        size_t i = 0;
+        while (i < size) {
+            // Whole quads of valid characters, whenever the accumulator is empty
+            if (pending == 0 && i + 4 <= size) {
+                uint32_t a = values[encoded[i]];
+                uint32_t b = values[encoded[i + 1]];
+                uint32_t c = values[encoded[i + 2]];
+                uint32_t d = values[encoded[i + 3]];
+                if (((a | b | c | d) & 0x80) == 0) {
+                    uint32_t group = a << 18 | b << 12 | c << 6 | d;
+                    out[0] = static_cast<uint8_t>(group >> 16);
+                    out[1] = static_cast<uint8_t>(group >> 8);
+                    out[2] = static_cast<uint8_t>(group);
+                    out += 3;
+                    i += 4;
+                    continue;
+                }
+            }
+            
+            // One character at a time around padding, whitespace or anything else outside the alphabet
+            uint8_t value = values[encoded[i++]];
+            if (value == INVALID) continue;
+            bits = bits << 6 | value;
+            pending += 6;
+            if (pending >= 8) {
+                pending -= 8;
+                *out++ = static_cast<uint8_t>(bits >> pending);
+            }
+        }
+        return static_cast<size_t>(out - start);
+    }
+
+#ifdef BASE64_X86
+    // 12 input bytes (of 16 loaded) to 16 characters, all lanes at once
+    __attribute__((target("ssse3")))
+    inline __m128i encodeBlockSsse3(__m128i input) {
+        // Spread each 3-byte group over a 32-bit lane, then cut it into four 6-bit indices
+        input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m128i high = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+        __m128i low = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(high, low);
+        
+        // Index ranges A-Z, a-z, 0-9, '+', '/' each map to one ASCII offset
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                              '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+    }
+    
+    __attribute__((target("ssse3")))
+    size_t encodeSsse3(const uint8_t* data, size_t size, char* out) {
+        size_t i = 0;
+        size_t written = 0;
+        for (; i + 16 <= size; i += 12, written += 16) {
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + written), encodeBlockSsse3(input));
+        }
+        return written + encodeScalar(data + i, size - i, out + written);
+    }
+    
+    __attribute__((target("avx2")))
+    size_t encodeAvx2(const uint8_t* data, size_t size, char* out) {
+        size_t i = 0;
+        size_t written = 0;
+        for (; i + 28 <= size; i += 24, written += 32) {
+            // Two 12-byte groups, one per 128-bit lane
+            __m256i input = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i))),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 12)), 1);
+            
+            input = _mm256_shuffle_epi8(input, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                               10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+            __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)),
+                                              _mm256_set1_epi32(0x04000040));
+            __m256i low = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)),
+                                             _mm256_set1_epi32(0x01000010));
+            __m256i indices = _mm256_or_si256(high, low);
+            
+            __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+            const __m256i offsets = _mm256_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+            __m256i encoded = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), encoded);
+        }
+        return written + encodeSsse3(data + i, size - i, out + written);
+    }
+    
+    // Stores write whole registers past the decoded bytes. Keeping this much input in reserve
+    // puts that slack inside maxDecodedSize(size).
+    const size_t SSSE3_DECODE_RESERVE = 20;
+    const size_t AVX2_DECODE_RESERVE = 40;
+    
+    __attribute__((target("ssse3")))
+    size_t decodeSsse3(const uint8_t* encoded, size_t size, uint8_t* out) {
+        // Nibble lookups: lo & hi is non-zero exactly for bytes outside the alphabet
+        const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                             0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                             0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i mask_2f = _mm_set1_epi8(0x2F);
+        const __m128i zero = _mm_setzero_si128();
+        
+        size_t i = 0;
+        size_t written = 0;
+        for (; i + SSSE3_DECODE_RESERVE <= size; i += 16, written += 12) {
+            __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(encoded + i));
+            __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(input, 4), mask_2f);
+            __m128i lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(input, mask_2f));
+            __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) != 0xFFFF) {
+                break;  // Padding or a skipped character: the scalar loop takes over
+            }
+            
+            // Characters to 6-bit values, then four values to three bytes per 32-bit lane
+            __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(input, mask_2f), hi_nibbles));
+            __m128i values = _mm_add_epi8(input, roll);
+            __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+            __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+            __m128i bytes = _mm_shuffle_epi8(groups, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + written), bytes);
+        }
+        return written + decodeScalar(encoded + i, size - i, out + written);
+    }
+    
+    __attribute__((target("avx2")))
+    size_t decodeAvx2(const uint8_t* encoded, size_t size, uint8_t* out) {
+        const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                                0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                                0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                                0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                                0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                  0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i mask_2f = _mm256_set1_epi8(0x2F);
+        
+        size_t i = 0;
+        size_t written = 0;
+        for (; i + AVX2_DECODE_RESERVE <= size; i += 32, written += 24) {
+            __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(encoded + i));
+            __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(input, 4), mask_2f);
+            __m256i lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(input, mask_2f));
+            __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+            if (!_mm256_testz_si256(lo, hi)) {
+                break;
+            }
+            
+            __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(input, mask_2f), hi_nibbles));
+            __m256i values = _mm256_add_epi8(input, roll);
+            __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            __m256i groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+            __m256i bytes = _mm256_shuffle_epi8(groups, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                                         2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+            // 12 bytes per lane; close the gap between the lanes
+            bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), bytes);
+        }
+        return written + decodeSsse3(encoded + i, size - i, out + written);
+    }
+#endif
+
+    EncodeImpl selectEncode() {
+#if defined(BASE64_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            EncodeImpl impl = { encodeAvx2, "avx2" };
+            return impl;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            EncodeImpl impl = { encodeSsse3, "ssse3" };
+            return impl;
+        }
+#endif
+        EncodeImpl impl = { encodeScalar, "scalar" };
+        return impl;
+    }
+    
+    DecodeImpl selectDecode() {
+#if defined(BASE64_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            DecodeImpl impl = { decodeAvx2, "avx2" };
+            return impl;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            DecodeImpl impl = { decodeSsse3, "ssse3" };
+            return impl;
+        }
+#endif
+        DecodeImpl impl = { decodeScalar, "scalar" };
+        return impl;
+    }
+    
+    // Selected once, on first use
+    const EncodeImpl& encodeImpl() {
+        static const EncodeImpl impl = selectEncode();
+        return impl;
+    }
+    
+    const DecodeImpl& decodeImpl() {
+        static const DecodeImpl impl = selectDecode();
+        return impl;
+    }
+}
+
+size_t Base64::encode(const uint8_t* data, size_t size, char* out) {
+    return encodeImpl().function(data, size, out);
+}
+
+size_t Base64::decode(const uint8_t* encoded, size_t size, uint8_t* out) {
+    return decodeImpl().function(encoded, size, out);
+}
+
+const char* Base64::encodeImplementation() {
+    return encodeImpl().name;
+}
+
+const char* Base64::decodeImplementation() {
+    return decodeImpl().name;
+}
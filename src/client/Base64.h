@@ -0,0 +1,35 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Base64 - Standard base64 (RFC 4648 alphabet, '=' padding) into caller-provided buffers
+ *
+ * Features:
+ * - AVX2 and SSSE3 paths on x86-64, scalar fallback elsewhere, picked once at runtime
+ * - Encoding writes one unbroken line, like Python's base64.b64encode
+ * - Decoding is as lenient as Crypto++'s Base64Decoder: characters outside the alphabet
+ *   (padding, whitespace) are skipped and a trailing partial byte is dropped
+ * - Vector loops stop at the first block containing such a character; the scalar loop finishes
+ */
+class Base64 {
+public:
+    static size_t encodedSize(size_t size) { return (size + 2) / 3 * 4; }
+    
+    // Upper bound for decode(); the exact size depends on skipped characters
+    static size_t maxDecodedSize(size_t size) { return size / 4 * 3 + 3; }
+    
+    // out must hold encodedSize(size) bytes; returns the bytes written
+    static size_t encode(const uint8_t* data, size_t size, char* out);
+    
+    // out must hold maxDecodedSize(size) bytes; returns the bytes written
+    static size_t decode(const uint8_t* encoded, size_t size, uint8_t* out);
+    
+    // Names of the selected implementations, for diagnostics
+    static const char* encodeImplementation();
+    static const char* decodeImplementation();
+};
+
+#endif // BASE64_H
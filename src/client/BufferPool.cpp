@@ -0,0 +1,94 @@
+#include "BufferPool.h"
+
+BufferPool::Lease::Lease() : pool_(nullptr), buffer_(nullptr) {
+}
+
+BufferPool::Lease::Lease(BufferPool* pool, std::vector<uint8_t>* buffer) : pool_(pool), buffer_(buffer) {
+}
+
+BufferPool::Lease::~Lease() {
+    release();
+}
+
+BufferPool::Lease::Lease(Lease&& other) : pool_(other.pool_), buffer_(other.buffer_) {
+    other.pool_ = nullptr;
+    other.buffer_ = nullptr;
+}
+
+BufferPool::Lease& BufferPool::Lease::operator=(Lease&& other) {
+    if (this != &other) {
+        release();
+        pool_ = other.pool_;
+        buffer_ = other.buffer_;
+        other.pool_ = nullptr;
+        other.buffer_ = nullptr;
+    }
+    return *this;
+}
+
+void BufferPool::Lease::resize(size_t size) {
+    if (size > buffer_->capacity() && pool_) {
+        pool_->countAllocation();
+    }
+    buffer_->resize(size);
+}
+
+void BufferPool::Lease::release() {
+    if (buffer_ && pool_) {
+        pool_->giveBack(buffer_);
+    } else {
+        delete buffer_;
+    }
+    pool_ = nullptr;
+    buffer_ = nullptr;
+}
+
+BufferPool::BufferPool(size_t max_free_buffers) : max_free_buffers_(max_free_buffers) {
+    stats_.acquisitions = 0;
+    stats_.reuses = 0;
+    stats_.allocations = 0;
+}
+
+BufferPool::~BufferPool() {
+    for (size_t i = 0; i < free_buffers_.size(); i++) {
+        delete free_buffers_[i];
+    }
+}
+
+BufferPool::Lease BufferPool::acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.acquisitions++;
+    
+    if (!free_buffers_.empty()) {
+        std::vector<uint8_t>* buffer = free_buffers_.back();
+        free_buffers_.pop_back();
+        stats_.reuses++;
+        return Lease(this, buffer);
+    }
+    
+    // The vector object itself is the only allocation until the buffer grows
+    stats_.allocations++;
+    return Lease(this, new std::vector<uint8_t>());
+}
+
+BufferPoolStats BufferPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void BufferPool::giveBack(std::vector<uint8_t>* buffer) {
+    buffer->clear();  // Keeps capacity
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Buffers whose storage was moved out are not worth keeping
+    if (buffer->capacity() == 0 || free_buffers_.size() >= max_free_buffers_) {
+        delete buffer;
+        return;
+    }
+    free_buffers_.push_back(buffer);
+}
+
+void BufferPool::countAllocation() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.allocations++;
+}
@@ -0,0 +1,73 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * BufferPool - Reusable, growable receive buffers
+ *
+ * Features:
+ * - Small free list of byte buffers that keep their capacity
+ * - Move-only leases that hand buffers back on destruction
+ * - Counters for acquisitions, reuses and heap allocations
+ * - Thread-safe (shared by the synchronous and pipelined receive paths)
+ */
+struct BufferPoolStats {
+    size_t acquisitions;  // Leases handed out
+    size_t reuses;        // Leases served from the free list
+    size_t allocations;   // Buffers created or grown on the heap
+};
+
+class BufferPool {
+public:
+    class Lease {
+    public:
+        Lease();
+        ~Lease();
+        Lease(Lease&& other);
+        Lease& operator=(Lease&& other);
+        
+        explicit operator bool() const { return buffer_ != nullptr; }
+        std::vector<uint8_t>& buffer() { return *buffer_; }
+        const uint8_t* data() const { return buffer_->data(); }
+        uint8_t* data() { return buffer_->data(); }
+        size_t size() const { return buffer_ ? buffer_->size() : 0; }
+        uint8_t operator[](size_t index) const { return (*buffer_)[index]; }
+        
+        // Resize, counting a heap allocation when capacity has to grow
+        void resize(size_t size);
+        void release();
+    
+    private:
+        friend class BufferPool;
+        Lease(BufferPool* pool, std::vector<uint8_t>* buffer);
+        Lease(const Lease&);
+        Lease& operator=(const Lease&);
+        
+        BufferPool* pool_;
+        std::vector<uint8_t>* buffer_;
+    };
+    
+    explicit BufferPool(size_t max_free_buffers = 4);
+    ~BufferPool();
+    
+    Lease acquire();
+    BufferPoolStats stats() const;
+
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+    
+    void giveBack(std::vector<uint8_t>* buffer);
+    void countAllocation();
+    
+    mutable std::mutex mutex_;
+    std::vector<std::vector<uint8_t>*> free_buffers_;
+    size_t max_free_buffers_;
+    BufferPoolStats stats_;
+};
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,212 @@
+#include "Checksum.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define CHECKSUM_NEON 1
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32)
+#define CHECKSUM_ARM_CRC 1
+#include <arm_acle.h>
+#endif
+#endif
+
+namespace {
+    typedef uint32_t (*AdditiveFunction)(const uint8_t* data, size_t size);
+    typedef uint32_t (*Crc32cFunction)(const uint8_t* data, size_t size, uint32_t crc);
+    
+    struct AdditiveImpl {
+        AdditiveFunction function;
+        const char* name;
+    };
+    
+    struct Crc32cImpl {
+        Crc32cFunction function;
+        const char* name;
+        bool hardware;
+    };
+    
+    uint32_t additiveScalar(const uint8_t* data, size_t size) {
+        uint32_t sum = 0;
+        for (size_t i = 0; i < size; i++) {
+            sum += data[i];
+        }
+        return sum;
+    }
+
+#ifdef CHECKSUM_X86
+    __attribute__((target("sse2")))
+    uint32_t additiveSse2(const uint8_t* data, size_t size) {
+        // _mm_sad_epu8 against zero sums 8 bytes into each 64-bit lane
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            acc = _mm_add_epi64(acc, _mm_sad_epu8(bytes, zero));
+        }
+        
+        uint64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        return static_cast<uint32_t>(lanes[0] + lanes[1]) + additiveScalar(data + i, size - i);
+    }
+    
+    __attribute__((target("avx2")))
+    uint32_t additiveAvx2(const uint8_t* data, size_t size) {
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i acc = _mm256_setzero_si256();
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32) {
+            __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            acc = _mm256_add_epi64(acc, _mm256_sad_epu8(bytes, zero));
+        }
+        
+        uint64_t lanes[4];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+        uint64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        return static_cast<uint32_t>(sum) + additiveSse2(data + i, size - i);
+    }
+    
+    __attribute__((target("sse4.2")))
+    uint32_t crc32cSse42(const uint8_t* data, size_t size, uint32_t crc) {
+        uint64_t state = ~crc;
+        while (size >= 8) {
+            uint64_t word;
+            std::memcpy(&word, data, 8);
+            state = _mm_crc32_u64(state, word);
+            data += 8;
+            size -= 8;
+        }
+        
+        uint32_t state32 = static_cast<uint32_t>(state);
+        while (size-- > 0) {
+            state32 = _mm_crc32_u8(state32, *data++);
+        }
+        return ~state32;
+    }
+#endif
+
+#ifdef CHECKSUM_NEON
+    uint32_t additiveNeon(const uint8_t* data, size_t size) {
+        // Pairwise widening adds; 32-bit lanes may wrap, which is fine modulo 2^32
+        uint32x4_t acc = vdupq_n_u32(0);
+        size_t i = 0;
+        for (; i + 16 <= size; i += 16) {
+            uint8x16_t bytes = vld1q_u8(data + i);
+            acc = vpadalq_u16(acc, vpaddlq_u8(bytes));
+        }
+        return vaddvq_u32(acc) + additiveScalar(data + i, size - i);
+    }
+#endif
+
+#ifdef CHECKSUM_ARM_CRC
+    uint32_t crc32cArm(const uint8_t* data, size_t size, uint32_t crc) {
+        uint32_t state = ~crc;
+        while (size >= 8) {
+            uint64_t word;
+            std::memcpy(&word, data, 8);
+            state = __crc32cd(state, word);
+            data += 8;
+            size -= 8;
+        }
+        while (size-- > 0) {
+            state = __crc32cb(state, *data++);
+        }
+        return ~state;
+    }
+#endif
+
+    // Reflected Castagnoli polynomial
+    const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+    
+    struct Crc32cTable {
+        uint32_t entries[256];
+        
+        Crc32cTable() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t crc = i;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+                }
+                entries[i] = crc;
+            }
+        }
+    };
+    
+    uint32_t crc32cTable(const uint8_t* data, size_t size, uint32_t crc) {
+        static const Crc32cTable table;
+        uint32_t state = ~crc;
+        for (size_t i = 0; i < size; i++) {
+            state = table.entries[(state ^ data[i]) & 0xFF] ^ (state >> 8);
+        }
+        return ~state;
+    }
+    
+    AdditiveImpl selectAdditive() {
+#if defined(CHECKSUM_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            AdditiveImpl impl = { additiveAvx2, "avx2" };
+            return impl;
+        }
+        AdditiveImpl impl = { additiveSse2, "sse2" };  // Baseline on x86-64
+        return impl;
+#elif defined(CHECKSUM_NEON)
+        AdditiveImpl impl = { additiveNeon, "neon" };
+        return impl;
+#else
+        AdditiveImpl impl = { additiveScalar, "scalar" };
+        return impl;
+#endif
+    }
+    
+    Crc32cImpl selectCrc32c() {
+#if defined(CHECKSUM_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            Crc32cImpl impl = { crc32cSse42, "sse4.2", true };
+            return impl;
+        }
+#elif defined(CHECKSUM_ARM_CRC)
+        Crc32cImpl impl = { crc32cArm, "armv8-crc", true };
+        return impl;
+#endif
+        Crc32cImpl fallback = { crc32cTable, "table", false };
+        return fallback;
+    }
+    
+    // Selected once, on first use
+    const AdditiveImpl& additiveImpl() {
+        static const AdditiveImpl impl = selectAdditive();
+        return impl;
+    }
+    
+    const Crc32cImpl& crc32cImpl() {
+        static const Crc32cImpl impl = selectCrc32c();
+        return impl;
+    }
+}
+
+uint32_t Checksum::additive(const uint8_t* data, size_t size, uint32_t seed) {
+    return seed + additiveImpl().function(data, size);
+}
+
+uint32_t Checksum::crc32c(const uint8_t* data, size_t size, uint32_t crc) {
+    return crc32cImpl().function(data, size, crc);
+}
+
+bool Checksum::hasHardwareCrc32c() {
+    return crc32cImpl().hardware;
+}
+
+const char* Checksum::additiveImplementation() {
+    return additiveImpl().name;
+}
+
+const char* Checksum::crc32cImplementation() {
+    return crc32cImpl().name;
+}
@@ -0,0 +1,30 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Checksum - Frame checksums for the MessageU protocol
+ *
+ * Features:
+ * - Additive byte-sum checksum (protocol v1/v2) with SSE2, AVX2 and NEON paths
+ * - CRC32C (protocol v3) using SSE4.2 or ARMv8 CRC instructions, table fallback
+ * - Implementation picked once at runtime from the CPU's capabilities
+ * - Both checksums can be continued across segments through the seed argument
+ */
+class Checksum {
+public:
+    // Sum of all bytes modulo 2^32, added to seed
+    static uint32_t additive(const uint8_t* data, size_t size, uint32_t seed = 0);
+    
+    // CRC32C (Castagnoli); crc32c(b, crc32c(a)) == crc32c(a + b)
+    static uint32_t crc32c(const uint8_t* data, size_t size, uint32_t crc = 0);
+    static bool hasHardwareCrc32c();
+    
+    // Names of the selected implementations, for diagnostics
+    static const char* additiveImplementation();
+    static const char* crc32cImplementation();
+};
+
+#endif // CHECKSUM_H
@@ -9,15 +9,29 @@
 #include <cryptopp/rsa.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/base64.h>
+#include "AesContext.h"
+#include "SymmetricKeyStore.h"
+#include "KeyStoreFile.h"
+#include "SecureArena.h"
+
+// Capabilities announced in the byte after the symmetric key of a key exchange message
+namespace KeyExchangeFlags {
+    // Sender can read AES-GCM messages. Nothing answers it, so the sender itself moves to GCM
+    // only once a GCM message from the recipient verifies (notePeerSendsGcm)
+    const uint8_t ACCEPTS_GCM = 0x01;
+}
 
 /**
  * ClientCrypto - Cryptographic operations for MessageU client
  * 
  * Features:
  * - RSA-2048 key generation and management
- * - AES-128-CBC encryption/decryption
- * - Symmetric key exchange and storage
- * - Base64 encoding/decoding for binary data
+ * - AES-128-CBC encryption/decryption, with cached per-peer cipher contexts
+ * - AES-128-GCM messages for peers that announce support, with tag verification
+ * - Symmetric key exchange, with keys held in a flat table keyed by 16-byte client ID
+ * - Peer keys optionally journaled to disk, so a restart needs no new key exchanges
+ * - Base64 encoding/decoding for binary data (SIMD codec, see Base64)
+ * - Fresh keys and decrypted plaintext handed out in SecureBuffers (locked, wiped on release)
  * - End-to-end encryption support
  */
 class ClientCrypto {
@@ -25,10 +39,17 @@ private:
     CryptoPP::AutoSeededRandomPool rng_;
     CryptoPP::RSA::PrivateKey private_key_;
     CryptoPP::RSA::PublicKey public_key_;
-    std::map<std::string, std::vector<uint8_t>> symmetric_keys_; // recipient_id -> symmetric_key
+    SymmetricKeyStore symmetric_keys_;                  // client_id -> key, context and mode flags
+    std::map<std::string, std::string> peer_aliases_;   // Nickname -> client_id, for recipients typed by name
+    KeyStoreFile keystore_;                             // Journal of symmetric_keys_ once openKeyStore succeeds
     
     // Helper methods
-    std::vector<uint8_t> generateRandomBytes(size_t length);
+    SecureBuffer generateRandomBytes(size_t length);
+    SymmetricKeyStore::Entry* findPeer(const std::string& peer_id);
+    const SymmetricKeyStore::Entry* findPeer(const std::string& peer_id) const;
+    const uint8_t* resolvePeerId(const std::string& peer_id) const;  // 16-byte client ID, or nullptr
+    SymmetricKeyStore::Entry* putKey(const std::string& peer_id, const uint8_t* key, size_t key_size, uint8_t mode_flags);
+    void setModeFlag(SymmetricKeyStore::Entry& entry, uint8_t flag);  // Journals the change if it is one
     std::string base64Encode(const std::vector<uint8_t>& data);
     
 public:
@@ -37,27 +58,48 @@ public:
     
     // Helper methods
     std::vector<uint8_t> base64Decode(const std::string& encoded);
+    static std::vector<uint8_t> base64Decode(const uint8_t* encoded, size_t size);  // Reads straight from a borrowed buffer; safe from any thread
     
     // RSA Key Management
     bool generateKeyPair();
+    void useKeyPair(const CryptoPP::RSA::PrivateKey& private_key, const CryptoPP::RSA::PublicKey& public_key);
     bool loadKeysFromFile(const std::string& filename);
     bool saveKeysToFile(const std::string& filename);
     bool loadServerPublicKey(const std::string& filename);
+    // PKCS#8 PEM, or just its base64 body as me.info keeps it; also installs the public half
     bool loadPrivateKeyFromPEM(const std::string& pem_key);
     
     // Symmetric Key Management
-    std::vector<uint8_t> generateSymmetricKey();
-    bool storeSymmetricKey(const std::string& recipient_id, const std::vector<uint8_t>& key);
-    std::vector<uint8_t> getSymmetricKey(const std::string& recipient_id);
-    bool hasSymmetricKey(const std::string& recipient_id);
+    SecureBuffer generateSymmetricKey();
+    uint64_t generateRandomId();  // Unpredictable 64-bit ID, e.g. for file transfers
+    bool storeSymmetricKey(const std::string& recipient_id, const uint8_t* key, size_t key_size);
+    const uint8_t* findSymmetricKey(const std::string& recipient_id) const;  // KEY_SIZE bytes inside the store, or nullptr; valid until keys change
+    bool hasSymmetricKey(const std::string& recipient_id) const;
+    void removeSymmetricKey(const std::string& recipient_id);
+    void addPeerAlias(const std::string& nickname, const std::string& client_id);  // Keys for the nickname are the client ID's keys
+    bool openKeyStore(const std::string& path, const std::string& owner_id);  // Loads saved keys and journals later changes
+    AesContext* getCipherContext(const std::string& recipient_id);  // nullptr without a key; valid until the key changes
     
     // RSA Encryption/Decryption
-    std::vector<uint8_t> encryptWithPublicKey(const std::vector<uint8_t>& data, const std::string& public_key_pem);
-    std::vector<uint8_t> decryptWithPrivateKey(const std::vector<uint8_t>& encrypted_data);
+    std::vector<uint8_t> encryptWithPublicKey(const uint8_t* data, size_t size, const CryptoPP::RSA::PublicKey& public_key);
+    SecureBuffer decryptWithPrivateKey(const std::vector<uint8_t>& encrypted_data);
     
     // AES Encryption/Decryption
     std::vector<uint8_t> encryptAES(const std::vector<uint8_t>& data, const std::vector<uint8_t>& key);
-    std::vector<uint8_t> decryptAES(const std::vector<uint8_t>& encrypted_data, const std::vector<uint8_t>& key);
+    SecureBuffer decryptAES(const std::vector<uint8_t>& encrypted_data, const std::vector<uint8_t>& key);
+    
+    // Per-peer AES with the cached context; out is resized in place so its capacity is reused
+    bool encryptForPeer(const std::string& recipient_id, const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+    bool decryptFromPeer(const std::string& sender_id, const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+    
+    // Message mode per peer: GCM once the peer has announced it in a key exchange or sent a
+    // verified GCM message (the only way the exchange's initiator learns it), CBC otherwise
+    bool peerUsesGcm(const std::string& peer_id) const;
+    bool peerSendsGcm(const std::string& peer_id) const;
+    void notePeerSendsGcm(const std::string& peer_id);
+    
+    // Which hardware AES and carry-less multiply paths Crypto++ can use on this CPU
+    static std::string accelerationReport();
     
     // Message Encryption/Decryption
     std::vector<uint8_t> encryptMessage(const std::vector<uint8_t>& message);
@@ -74,7 +116,8 @@ public:
     std::vector<uint8_t> encryptSessionKey(const std::vector<uint8_t>& session_key);
     
     // Key Exchange
-    std::vector<uint8_t> createKeyExchangeMessage(const std::string& recipient_id, const std::string& recipient_public_key);
+    // Takes the recipient's decoded key (PublicKeyCache::rsaKey), so the PEM is not parsed per exchange
+    std::vector<uint8_t> createKeyExchangeMessage(const std::string& recipient_id, const CryptoPP::RSA::PublicKey& recipient_public_key);
     bool processKeyExchangeMessage(const std::string& sender_id, const std::vector<uint8_t>& encrypted_key);
     
     // Utility methods
@@ -1,31 +1,81 @@
 #include "ClientNetwork.h"
 #include <iostream>
+#include <cstring>
+#include <stdexcept>
+#include <array>
+#include <algorithm>
 #include <boost/asio.hpp>
 
-ClientNetwork::ClientNetwork() : io_context_(), socket_(io_context_) {
+namespace {
+    // Sessions idle for longer than this are dropped and re-established
+    const std::chrono::seconds DEFAULT_IDLE_TIMEOUT(60);
+    
+    // Requests written ahead of their responses in pipelined mode
+    const size_t DEFAULT_MAX_IN_FLIGHT = 32;
+    
+    // Largest single socket read when streaming a response into the decoder
+    const size_t STREAM_CHUNK_SIZE = 64 * 1024;
+}
+
+ClientNetwork::ClientNetwork()
+    : io_context_(), socket_(io_context_), server_port_(0), last_activity_(0), idle_timeout_(DEFAULT_IDLE_TIMEOUT),
+      write_in_progress_(false), max_in_flight_(DEFAULT_MAX_IN_FLIGHT), session_id_(0), pending_count_(0) {
     // Constructor implementation
 }
 
 ClientNetwork::~ClientNetwork() {
     disconnect();
+    stopAsyncEngine();
 }
 
 bool ClientNetwork::connect(const std::string& host, unsigned short port) {
     try {
-        boost::asio::ip::tcp::resolver resolver(io_context_);
-        boost::asio::ip::tcp::resolver::results_type endpoints = 
-            resolver.resolve(host, std::to_string(port));
+        // Drop any previous session before opening a new one
+        disconnect();
+        
+        // Resolve only when the target changed, DNS lookups are not free
+        if (endpoints_.empty() || host != server_host_ || port != server_port_) {
+            boost::asio::ip::tcp::resolver resolver(io_context_);
+            endpoints_ = resolver.resolve(host, std::to_string(port));
+            server_host_ = host;
+            server_port_ = port;
+        }
         
-        boost::asio::connect(socket_, endpoints);
+        boost::system::error_code ec;
+        boost::asio::connect(socket_, endpoints_, ec);
+        if (ec) {
+            // Cached addresses may be stale, resolve again once
+            socket_.close();
+            boost::asio::ip::tcp::resolver resolver(io_context_);
+            endpoints_ = resolver.resolve(host, std::to_string(port));
+            boost::asio::connect(socket_, endpoints_);
+        }
+        
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+        ++session_id_;
+        touch();
         std::cout << "Connected to " << host << ":" << port << std::endl;
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Connection failed: " << e.what() << std::endl;
+        endpoints_ = boost::asio::ip::tcp::resolver::results_type();
         return false;
     }
 }
 
 void ClientNetwork::disconnect() {
+    // Outstanding pipelined requests are failed on the network thread first
+    if (io_thread_.joinable() && pendingRequests() > 0) {
+        unsigned session = session_id_;
+        boost::asio::post(io_context_, [this, session]() {
+            failAllPending(boost::asio::error::operation_aborted, session);
+        });
+        waitForPending();
+    }
+    closeSocket();
+}
+
+void ClientNetwork::closeSocket() {
     try {
         if (socket_.is_open()) {
             socket_.close();
@@ -39,9 +89,62 @@ bool ClientNetwork::isConnected() const {
     return socket_.is_open();
 }
 
+bool ClientNetwork::ensureConnected() {
+    // Synchronous use of the session must not interleave with pipelined requests
+    waitForPending();
+    
+    if (socket_.is_open()) {
+        std::chrono::steady_clock::time_point last_activity(std::chrono::steady_clock::duration(last_activity_.load()));
+        if (std::chrono::steady_clock::now() - last_activity > idle_timeout_) {
+            // Middleboxes and the server may have forgotten an idle session
+            disconnect();
+        } else if (isSessionHealthy()) {
+            return true;
+        } else {
+            disconnect();
+        }
+    }
+    
+    if (server_host_.empty() || server_port_ == 0) {
+        std::cerr << "Server info not set" << std::endl;
+        return false;
+    }
+    
+    return connect(server_host_, server_port_);
+}
+
+bool ClientNetwork::isSessionHealthy() {
+    // Peek without blocking: an idle, healthy session has nothing to read.
+    // EOF means the server closed it, unsolicited data means we are out of sync.
+    boost::system::error_code ec;
+    socket_.non_blocking(true, ec);
+    if (ec) return false;
+    
+    uint8_t probe = 0;
+    size_t bytes = socket_.receive(boost::asio::buffer(&probe, 1),
+                                   boost::asio::socket_base::message_peek, ec);
+    
+    boost::system::error_code restore_ec;
+    socket_.non_blocking(false, restore_ec);
+    if (restore_ec) return false;
+    
+    if (ec == boost::asio::error::would_block) {
+        return true;
+    }
+    if (!ec && bytes > 0) {
+        std::cerr << "Discarding session with unexpected pending data" << std::endl;
+    }
+    return false;
+}
+
+void ClientNetwork::touch() {
+    last_activity_ = std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
 bool ClientNetwork::sendData(const std::vector<uint8_t>& data) {
     try {
         boost::asio::write(socket_, boost::asio::buffer(data));
+        touch();
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Send failed: " << e.what() << std::endl;
@@ -49,23 +152,70 @@ bool ClientNetwork::sendData(const std::vector<uint8_t>& data) {
     }
 }
 
-bool ClientNetwork::receiveData(std::vector<uint8_t>& data) {
+bool ClientNetwork::sendFrame(const OutgoingFrame& frame) {
     try {
-        // First read the header (9 bytes)
-        std::vector<uint8_t> header(9);
-        boost::asio::read(socket_, boost::asio::buffer(header));
+        // Unused slots stay empty buffers, which the write skips
+        std::array<boost::asio::const_buffer, OutgoingFrame::MAX_SEGMENTS> buffers;
+        for (size_t i = 0; i < frame.segmentCount(); i++) {
+            const OutgoingFrame::Segment& segment = frame.segment(i);
+            buffers[i] = boost::asio::buffer(segment.data, segment.size);
+        }
         
-        // Parse header to get payload size
-        uint16_t payload_size = static_cast<uint16_t>(header[3]) | (static_cast<uint16_t>(header[4]) << 8);
+        boost::asio::write(socket_, buffers);
+        touch();
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Send failed: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool ClientNetwork::receiveData(std::vector<uint8_t>& data) {
+    try {
+        readMessage(data);
+        touch();
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Receive failed: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool ClientNetwork::receiveData(BufferPool::Lease& data) {
+    try {
+        if (!data) {
+            data = buffer_pool_.acquire();
+        }
         
-        // Read the payload
-        data.resize(9 + payload_size);
-        std::copy(header.begin(), header.end(), data.begin());
+        // Grows only when this response is larger than any seen before
+        readMessage(data);
+        touch();
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Receive failed: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool ClientNetwork::receiveStream(ProtocolHandler& protocol, const ProtocolHandler::RecordHandler& on_record) {
+    try {
+        BufferPool::Lease chunk = buffer_pool_.acquire();
+        chunk.resize(STREAM_CHUNK_SIZE);
+        protocol.beginStream();
         
-        if (payload_size > 0) {
-            boost::asio::read(socket_, boost::asio::buffer(&data[9], payload_size));
+        while (true) {
+            // Reads stop at the end of the current frame, so the next response is never touched
+            size_t wanted = std::min(chunk.size(), protocol.streamBytesWanted());
+            size_t received = socket_.read_some(boost::asio::buffer(chunk.data(), wanted));
+            
+            ProtocolHandler::StreamStatus status = protocol.feedStream(chunk.data(), received, on_record);
+            if (status == ProtocolHandler::STREAM_COMPLETE) break;
+            if (status == ProtocolHandler::STREAM_FAILED) {
+                throw std::runtime_error("Malformed response stream");
+            }
         }
         
+        touch();
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Receive failed: " << e.what() << std::endl;
@@ -73,7 +223,344 @@ bool ClientNetwork::receiveData(std::vector<uint8_t>& data) {
     }
 }
 
+template <typename Buffer>
+void ClientNetwork::readMessage(Buffer& data) {
+    // The minimum header tells the version; longer headers are completed afterwards
+    data.resize(ProtocolSizes::MIN_HEADER_SIZE);
+    boost::asio::read(socket_, boost::asio::buffer(data.data(), ProtocolSizes::MIN_HEADER_SIZE));
+    
+    size_t header_size = ProtocolHandler::headerSizeForVersion(data[0]);
+    if (header_size == 0) {
+        throw std::runtime_error("Unsupported protocol version " + std::to_string(data[0]));
+    }
+    if (header_size > ProtocolSizes::MIN_HEADER_SIZE) {
+        data.resize(header_size);
+        boost::asio::read(socket_, boost::asio::buffer(data.data() + ProtocolSizes::MIN_HEADER_SIZE,
+                                                       header_size - ProtocolSizes::MIN_HEADER_SIZE));
+    }
+    
+    FrameHeader first;
+    ProtocolHandler::decodeHeader(data.data(), header_size, first);
+    if (first.payload_size > ProtocolSizes::MAX_MESSAGE_SIZE) {
+        throw std::runtime_error("Response exceeds maximum message size");
+    }
+    
+    // The payload is read straight into the caller's buffer
+    data.resize(header_size + first.payload_size);
+    if (first.payload_size > 0) {
+        boost::asio::read(socket_, boost::asio::buffer(data.data() + header_size, first.payload_size));
+    }
+    if (!(first.flags & ProtocolFlags::CONTINUATION)) return;
+    
+    // Continuation frames: append each payload behind the first one
+    size_t total_size = first.payload_size;
+    uint32_t checksum = first.checksum;
+    uint8_t frame_header[ProtocolSizes::MAX_HEADER_SIZE];
+    FrameHeader frame = first;
+    
+    while (frame.flags & ProtocolFlags::CONTINUATION) {
+        boost::asio::read(socket_, boost::asio::buffer(frame_header, header_size));
+        if (!ProtocolHandler::decodeHeader(frame_header, header_size, frame) || frame.version != first.version) {
+            throw std::runtime_error("Malformed continuation frame");
+        }
+        if (total_size + frame.payload_size > ProtocolSizes::MAX_MESSAGE_SIZE) {
+            throw std::runtime_error("Response exceeds maximum message size");
+        }
+        
+        data.resize(header_size + total_size + frame.payload_size);
+        if (frame.payload_size > 0) {
+            boost::asio::read(socket_, boost::asio::buffer(data.data() + header_size + total_size, frame.payload_size));
+        }
+        total_size += frame.payload_size;
+        checksum = ProtocolHandler::joinFrameChecksum(first.version, checksum, frame.checksum);
+    }
+    
+    // Present the reassembled message to the parser as a single frame
+    first.flags = 0;
+    first.payload_size = static_cast<uint32_t>(total_size);
+    first.checksum = checksum;
+    ProtocolHandler::encodeHeader(first, data.data());
+}
+
+BufferPoolStats ClientNetwork::receiveBufferStats() const {
+    return buffer_pool_.stats();
+}
+
+bool ClientNetwork::sendRequestAsync(std::vector<uint8_t> request, ResponseHandler handler) {
+    // The session is (re)established only while the pipeline is idle
+    if (pendingRequests() == 0 && !ensureConnected()) {
+        return false;
+    }
+    
+    startAsyncEngine();
+    
+    std::shared_ptr<PendingRequest> pending = std::make_shared<PendingRequest>();
+    pending->request = std::move(request);
+    pending->handler = std::move(handler);
+    
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        ++pending_count_;
+    }
+    
+    boost::asio::post(io_context_, [this, pending]() {
+        write_queue_.push_back(pending);
+        startWrite();
+    });
+    return true;
+}
+
+std::future<std::vector<uint8_t>> ClientNetwork::sendRequestAsync(std::vector<uint8_t> request) {
+    std::shared_ptr<std::promise<std::vector<uint8_t>>> promise =
+        std::make_shared<std::promise<std::vector<uint8_t>>>();
+    std::future<std::vector<uint8_t>> future = promise->get_future();
+    
+    bool queued = sendRequestAsync(std::move(request), [promise](bool success, std::vector<uint8_t>& response) {
+        if (success) {
+            promise->set_value(std::move(response));
+        } else {
+            promise->set_exception(std::make_exception_ptr(std::runtime_error("Asynchronous request failed")));
+        }
+    });
+    
+    if (!queued) {
+        promise->set_exception(std::make_exception_ptr(std::runtime_error("Failed to connect to server")));
+    }
+    return future;
+}
+
+void ClientNetwork::waitForPending(size_t limit) {
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    pending_cv_.wait(lock, [this, limit]() { return pending_count_ <= limit; });
+}
+
+size_t ClientNetwork::pendingRequests() const {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    return pending_count_;
+}
+
+void ClientNetwork::setMaxInFlight(size_t max_in_flight) {
+    max_in_flight_ = max_in_flight > 0 ? max_in_flight : 1;
+}
+
+void ClientNetwork::startAsyncEngine() {
+    if (io_thread_.joinable()) return;
+    
+    io_context_.restart();
+    work_guard_.reset(new boost::asio::executor_work_guard<boost::asio::io_context::executor_type>(
+        boost::asio::make_work_guard(io_context_)));
+    io_thread_ = std::thread([this]() { io_context_.run(); });
+}
+
+void ClientNetwork::stopAsyncEngine() {
+    if (!io_thread_.joinable()) return;
+    
+    work_guard_.reset();
+    io_context_.stop();
+    io_thread_.join();
+}
+
+void ClientNetwork::startWrite() {
+    if (write_in_progress_ || write_queue_.empty() || awaiting_queue_.size() >= max_in_flight_) {
+        return;
+    }
+    
+    std::shared_ptr<PendingRequest> pending = write_queue_.front();
+    write_queue_.pop_front();
+    
+    // Responses come back in request order, so the request joins the
+    // awaiting queue as soon as it is handed to the socket
+    awaiting_queue_.push_back(pending);
+    bool start_read = awaiting_queue_.size() == 1;
+    write_in_progress_ = true;
+    
+    unsigned session = session_id_;
+    boost::asio::async_write(socket_, boost::asio::buffer(pending->request),
+        [this, pending, session](const boost::system::error_code& ec, size_t) {
+            if (session != session_id_) return;
+            write_in_progress_ = false;
+            if (ec) {
+                failAllPending(ec, session);
+                return;
+            }
+            touch();
+            startWrite();
+        });
+    
+    if (start_read) {
+        startRead();
+    }
+}
+
+void ClientNetwork::startRead() {
+    if (awaiting_queue_.empty()) return;
+    
+    // The response of the oldest request is assembled in its own pooled buffer
+    std::shared_ptr<PendingRequest> pending = awaiting_queue_.front();
+    if (!pending->response) {
+        pending->response = buffer_pool_.acquire();
+    }
+    pending->response.resize(0);
+    pending->checksum = 0;
+    
+    readFrameHeader(pending, session_id_);
+}
+
+void ClientNetwork::readFrameHeader(const std::shared_ptr<PendingRequest>& pending, unsigned session) {
+    // The minimum header tells the version; longer headers are completed afterwards
+    boost::asio::async_read(socket_, boost::asio::buffer(pending->frame_header, ProtocolSizes::MIN_HEADER_SIZE),
+        [this, pending, session](const boost::system::error_code& ec, size_t) {
+            if (session != session_id_) return;
+            if (ec) {
+                failAllPending(ec, session);
+                return;
+            }
+            
+            size_t header_size = ProtocolHandler::headerSizeForVersion(pending->frame_header[0]);
+            if (header_size == 0) {
+                failAllPending(boost::system::errc::make_error_code(boost::system::errc::protocol_error), session);
+                return;
+            }
+            if (header_size == ProtocolSizes::MIN_HEADER_SIZE) {
+                onFrameHeader(pending, session);
+                return;
+            }
+            
+            boost::asio::async_read(socket_,
+                boost::asio::buffer(pending->frame_header + ProtocolSizes::MIN_HEADER_SIZE,
+                                    header_size - ProtocolSizes::MIN_HEADER_SIZE),
+                [this, pending, session](const boost::system::error_code& ec, size_t) {
+                    if (session != session_id_) return;
+                    if (ec) {
+                        failAllPending(ec, session);
+                        return;
+                    }
+                    onFrameHeader(pending, session);
+                });
+        });
+}
+
+void ClientNetwork::onFrameHeader(const std::shared_ptr<PendingRequest>& pending, unsigned session) {
+    bool first_frame = pending->response.size() == 0;
+    
+    FrameHeader frame;
+    ProtocolHandler::decodeHeader(pending->frame_header, ProtocolSizes::MAX_HEADER_SIZE, frame);
+    if (first_frame) {
+        // The first header is kept in the response, later ones only extend its payload
+        pending->header = frame;
+        pending->response.resize(frame.header_size);
+        std::memcpy(pending->response.data(), pending->frame_header, frame.header_size);
+    }
+    
+    size_t offset = pending->response.size();
+    if (frame.version != pending->header.version ||
+        offset - frame.header_size + frame.payload_size > ProtocolSizes::MAX_MESSAGE_SIZE) {
+        failAllPending(boost::system::errc::make_error_code(boost::system::errc::protocol_error), session);
+        return;
+    }
+    
+    pending->response.resize(offset + frame.payload_size);
+    pending->checksum = first_frame ? frame.checksum
+                                    : ProtocolHandler::joinFrameChecksum(frame.version, pending->checksum, frame.checksum);
+    pending->frame_flags = frame.flags;
+    
+    if (frame.payload_size == 0) {
+        onFramePayloadRead(pending, session);
+        return;
+    }
+    
+    boost::asio::async_read(socket_,
+        boost::asio::buffer(pending->response.data() + offset, frame.payload_size),
+        [this, pending, session](const boost::system::error_code& ec, size_t) {
+            if (session != session_id_) return;
+            if (ec) {
+                failAllPending(ec, session);
+                return;
+            }
+            onFramePayloadRead(pending, session);
+        });
+}
+
+void ClientNetwork::onFramePayloadRead(const std::shared_ptr<PendingRequest>& pending, unsigned session) {
+    if (pending->frame_flags & ProtocolFlags::CONTINUATION) {
+        readFrameHeader(pending, session);
+        return;
+    }
+    
+    if (pending->header.flags & ProtocolFlags::CONTINUATION) {
+        // Present the reassembled message to the parser as a single frame
+        pending->header.flags = 0;
+        pending->header.payload_size = static_cast<uint32_t>(pending->response.size() - pending->header.header_size);
+        pending->header.checksum = pending->checksum;
+        ProtocolHandler::encodeHeader(pending->header, pending->response.data());
+    }
+    onResponseRead(session);
+}
+
+void ClientNetwork::onResponseRead(unsigned session) {
+    std::shared_ptr<PendingRequest> pending = awaiting_queue_.front();
+    awaiting_queue_.pop_front();
+    touch();
+    
+    completeRequest(pending, true);
+    
+    if (session != session_id_) return;
+    startRead();
+    startWrite();  // A slot in the in-flight window just opened up
+}
+
+void ClientNetwork::completeRequest(const std::shared_ptr<PendingRequest>& pending, bool success) {
+    try {
+        if (pending->handler) {
+            if (!pending->response) {
+                pending->response = buffer_pool_.acquire();
+            }
+            pending->handler(success, pending->response.buffer());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Response handler failed: " << e.what() << std::endl;
+    }
+    
+    // Hand the buffer back to the pool unless the handler moved it out
+    pending->response.release();
+    
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    --pending_count_;
+    pending_cv_.notify_all();
+}
+
+void ClientNetwork::failAllPending(const boost::system::error_code& ec, unsigned session) {
+    if (session != session_id_) return;
+    
+    // Handlers still queued for this session complete with errors of their own; ignore them
+    ++session_id_;
+    
+    if (ec != boost::asio::error::operation_aborted) {
+        std::cerr << "Pipelined request failed: " << ec.message() << std::endl;
+    }
+    
+    // The stream position is unknown now, the session cannot be reused
+    closeSocket();
+    write_in_progress_ = false;
+    
+    std::deque<std::shared_ptr<PendingRequest>> failed;
+    failed.swap(awaiting_queue_);
+    failed.insert(failed.end(), write_queue_.begin(), write_queue_.end());
+    write_queue_.clear();
+    
+    for (size_t i = 0; i < failed.size(); i++) {
+        completeRequest(failed[i], false);
+    }
+}
+
 void ClientNetwork::setServerInfo(const std::string& host, unsigned short port) {
+    if (host != server_host_ || port != server_port_) {
+        endpoints_ = boost::asio::ip::tcp::resolver::results_type();
+    }
     server_host_ = host;
     server_port_ = port;
-} 
\ No newline at end of file
+}
+
+void ClientNetwork::setIdleTimeout(std::chrono::seconds timeout) {
+    idle_timeout_ = timeout;
+}
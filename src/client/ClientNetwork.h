@@ -3,15 +3,97 @@
 
 #include <string>
 #include <vector>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
 #include <boost/asio.hpp>
+#include "ProtocolHandler.h"
+#include "BufferPool.h"
 
+/**
+ * ClientNetwork - TCP transport for MessageU client
+ *
+ * Features:
+ * - Long-lived server session reused across requests
+ * - Lazy (re)connection with cached DNS resolution
+ * - Health check of idle sessions before reuse
+ * - Idle timeout after which the session is re-established
+ * - Asynchronous pipelined mode: many requests in flight on one session,
+ *   responses matched to requests in order (the server answers in order)
+ * - Pooled receive buffers: no heap allocations per response once warm
+ * - Protocol v1 and v2 frames; v2 continuation frames are joined into one message
+ * - Streaming receive that feeds socket chunks to the protocol decoder as they arrive
+ */
 class ClientNetwork {
+public:
+    // Completion handler for asynchronous requests, invoked on the network thread
+    typedef std::function<void(bool success, std::vector<uint8_t>& response)> ResponseHandler;
+    
 private:
+    struct PendingRequest {
+        std::vector<uint8_t> request;
+        BufferPool::Lease response;
+        ResponseHandler handler;
+        
+        // Response reassembly state (continuation frames)
+        uint8_t frame_header[ProtocolSizes::MAX_HEADER_SIZE];
+        FrameHeader header;    // First frame header
+        uint8_t frame_flags;   // Flags of the frame being read
+        uint32_t checksum;     // Checksum of the payload read so far
+    };
+    
     boost::asio::io_context io_context_;
     boost::asio::ip::tcp::socket socket_;
     std::string server_host_;
     unsigned short server_port_;
     
+    // Session state
+    boost::asio::ip::tcp::resolver::results_type endpoints_;  // Cached resolution of server_host_
+    std::atomic<std::chrono::steady_clock::rep> last_activity_;  // steady_clock ticks; written by the io thread too
+    std::chrono::seconds idle_timeout_;
+    
+    // Receive buffers shared by the synchronous and pipelined paths
+    BufferPool buffer_pool_;
+    
+    // Asynchronous engine (queues are only touched on the network thread)
+    std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guard_;
+    std::thread io_thread_;
+    std::deque<std::shared_ptr<PendingRequest>> write_queue_;     // Not yet written
+    std::deque<std::shared_ptr<PendingRequest>> awaiting_queue_;  // Written, waiting for a response
+    bool write_in_progress_;
+    size_t max_in_flight_;
+    std::atomic<unsigned> session_id_;  // Bumped on every connect, stale handlers are ignored
+    
+    // Outstanding asynchronous requests, shared with the caller thread
+    mutable std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+    size_t pending_count_;
+    
+    // Helper methods
+    bool isSessionHealthy();
+    void touch();
+    void closeSocket();
+    template <typename Buffer>
+    void readMessage(Buffer& data);  // Reads one message, joining continuation frames
+    
+    // Asynchronous engine helpers (network thread)
+    void startAsyncEngine();
+    void stopAsyncEngine();
+    void startWrite();
+    void startRead();
+    void readFrameHeader(const std::shared_ptr<PendingRequest>& pending, unsigned session);
+    void onFrameHeader(const std::shared_ptr<PendingRequest>& pending, unsigned session);
+    void onFramePayloadRead(const std::shared_ptr<PendingRequest>& pending, unsigned session);
+    void onResponseRead(unsigned session);
+    void completeRequest(const std::shared_ptr<PendingRequest>& pending, bool success);
+    void failAllPending(const boost::system::error_code& ec, unsigned session);
+    
 public:
     ClientNetwork();
     ~ClientNetwork();
@@ -20,10 +102,26 @@ public:
     void disconnect();
     bool isConnected() const;
     
+    // Reuse the current session if it is still usable, otherwise reconnect
+    bool ensureConnected();
+    unsigned sessionId() const { return session_id_; }  // Changes whenever the session is replaced
+    
     bool sendData(const std::vector<uint8_t>& data);
+    bool sendFrame(const OutgoingFrame& frame);  // One gather write, no concatenation
     bool receiveData(std::vector<uint8_t>& data);
+    bool receiveData(BufferPool::Lease& data);  // Reads into a pooled buffer, acquired if empty
+    bool receiveStream(ProtocolHandler& protocol, const ProtocolHandler::RecordHandler& on_record);  // Decodes while reading
+    BufferPoolStats receiveBufferStats() const;
+    
+    // Asynchronous pipelined requests
+    bool sendRequestAsync(std::vector<uint8_t> request, ResponseHandler handler);
+    std::future<std::vector<uint8_t>> sendRequestAsync(std::vector<uint8_t> request);
+    void waitForPending(size_t limit = 0);  // Until at most limit requests are outstanding
+    size_t pendingRequests() const;
+    void setMaxInFlight(size_t max_in_flight);
     
     void setServerInfo(const std::string& host, unsigned short port);
+    void setIdleTimeout(std::chrono::seconds timeout);
 };
 
-#endif // CLIENT_NETWORK_H 
\ No newline at end of file
+#endif // CLIENT_NETWORK_H
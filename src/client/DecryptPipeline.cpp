@@ -0,0 +1,144 @@
+#include "DecryptPipeline.h"
+#include "ClientCrypto.h"
+#include <algorithm>
+#include <cstring>
+
+DecryptPipeline::DecryptPipeline(size_t workers) : completed_(0), stopping_(false) {
+    if (workers == 0) {
+        workers = std::thread::hardware_concurrency();
+        if (workers == 0) workers = 1;
+    }
+    
+    for (size_t i = 0; i < workers; i++) {
+        workers_.push_back(std::thread(&DecryptPipeline::workerLoop, this));
+    }
+}
+
+DecryptPipeline::~DecryptPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i].join();
+    }
+}
+
+size_t DecryptPipeline::submit(const std::string& peer_id, const uint8_t* key, bool gcm_only, bool base64,
+                               const uint8_t* content, size_t size) {
+    size_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ticket = jobs_.size();
+        jobs_.push_back(Job());
+        Job& job = jobs_.back();
+        std::memset(job.peer, 0, sizeof(job.peer));
+        std::memcpy(job.peer, peer_id.data(), std::min(peer_id.size(), sizeof(job.peer)));
+        job.has_key = key != nullptr;
+        if (job.has_key) job.key.assign(key, AesContext::KEY_SIZE);
+        job.gcm_only = gcm_only;
+        job.base64 = base64;
+        job.content.assign(content, content + size);
+        queue_.push_back(&job);
+    }
+    work_ready_.notify_one();
+    return ticket;
+}
+
+void DecryptPipeline::finish(std::vector<Result>& results) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this]() { return completed_ == jobs_.size(); });
+    
+    results.clear();
+    results.reserve(jobs_.size());
+    for (size_t i = 0; i < jobs_.size(); i++) {
+        results.push_back(std::move(jobs_[i].result));
+    }
+    
+    jobs_.clear();
+    completed_ = 0;
+}
+
+AesContext& DecryptPipeline::contextFor(WorkerContexts& contexts, uint64_t& clock, const Job& job) {
+    // A handful of entries: a linear scan finds the peer, or else the least recently used one
+    WorkerContext* chosen = &contexts[0];
+    for (size_t i = 0; i < contexts.size(); i++) {
+        WorkerContext& candidate = contexts[i];
+        if (candidate.last_used != 0 && std::memcmp(candidate.peer, job.peer, PEER_ID_SIZE) == 0) {
+            chosen = &candidate;
+            break;
+        }
+        if (candidate.last_used < chosen->last_used) chosen = &candidate;
+    }
+    
+    // Key schedules are expanded when the peer is new to this worker or its key has changed
+    bool same_peer = chosen->last_used != 0 && std::memcmp(chosen->peer, job.peer, PEER_ID_SIZE) == 0;
+    if (!same_peer || std::memcmp(chosen->key, job.key.data(), AesContext::KEY_SIZE) != 0) {
+        chosen->context.setKey(job.key.data(), AesContext::KEY_SIZE);
+        std::memcpy(chosen->peer, job.peer, PEER_ID_SIZE);
+        std::memcpy(chosen->key, job.key.data(), AesContext::KEY_SIZE);
+    }
+    chosen->last_used = ++clock;
+    return chosen->context;
+}
+
+void DecryptPipeline::workerLoop() {
+    // Per-thread cipher contexts for the peers served most recently, in locked pages
+    WorkerContexts contexts(WORKER_CONTEXTS);
+    uint64_t clock = 0;
+    
+    while (true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_ready_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) return;  // Stopping with nothing left to do
+            job = queue_.front();
+            queue_.pop_front();
+        }
+        
+        Result& result = job->result;
+        result.has_key = job->has_key;
+        result.decrypted = false;
+        result.gcm = false;
+        
+        if (result.has_key) {
+            // Binary content is decrypted as received; base64 is decoded first, falling
+            // back to raw bytes like the sequential path did
+            std::vector<uint8_t> content;
+            if (job->base64) {
+                try {
+                    content = ClientCrypto::base64Decode(job->content.data(), job->content.size());
+                } catch (...) {
+                    content.swap(job->content);
+                }
+            } else {
+                content.swap(job->content);
+            }
+            
+            AesContext& context = contextFor(contexts, clock, *job);
+            job->key.clear();  // Wiped; the cached copy is in locked memory
+            
+            // Plaintext is never longer than the ciphertext; GCM output must not overlap its input
+            result.plaintext.resize(content.size());
+            size_t plaintext_size = 0;
+            if (AesContext::looksLikeGcm(content.data(), content.size()) &&
+                context.decryptGcm(content.data(), content.size(), result.plaintext.data(), plaintext_size)) {
+                result.decrypted = true;
+                result.gcm = true;
+            } else if (!job->gcm_only &&
+                       context.decrypt(content.data(), content.size(), result.plaintext.data(), plaintext_size)) {
+                result.decrypted = true;
+            }
+            result.plaintext.resize(result.decrypted ? plaintext_size : 0);
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            completed_++;
+        }
+        work_done_.notify_all();
+    }
+}
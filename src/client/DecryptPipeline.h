@@ -0,0 +1,92 @@
+#ifndef DECRYPT_PIPELINE_H
+#define DECRYPT_PIPELINE_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <cstdint>
+#include "AesContext.h"
+#include "SecureArena.h"
+
+/**
+ * DecryptPipeline - Worker pool for decoding and AES decryption of waiting messages
+ *
+ * Features:
+ * - Messages are decoded and decrypted on all cores while later frames of the response arrive
+ * - Each worker keeps AesContexts for the last few peers it served, so no cipher state is
+ *   shared; the cache is bounded and lives in locked pages
+ * - Results come back in submission order, whatever order the workers finish in
+ * - Each job carries its own copy of the key inline, so a key replaced later in the inbox
+ *   does not affect messages queued before it
+ * - AES-GCM messages are recognised and verified; CBC is the fallback unless the job forbids it
+ * - Plaintext is decrypted straight into a SecureBuffer; job keys are SecureBuffers too,
+ *   wiped once used
+ */
+class DecryptPipeline {
+public:
+    struct Result {
+        bool has_key;                    // False when submitted without a key
+        bool decrypted;
+        bool gcm;                        // Decrypted as AES-GCM (tag verified)
+        SecureBuffer plaintext;
+    };
+    
+    explicit DecryptPipeline(size_t workers = 0);  // 0 = one per hardware thread
+    ~DecryptPipeline();
+    
+    // Queues one message from peer_id; the key (KEY_SIZE bytes, or nullptr) and the content are
+    // copied, so the key store and the receive buffer may change afterwards.
+    // Returns the ticket, the message's index in the results of finish().
+    // gcm_only refuses CBC, for senders already seen using GCM.
+    // base64 is set when the server sent the content as base64 text rather than raw bytes.
+    size_t submit(const std::string& peer_id, const uint8_t* key, bool gcm_only, bool base64,
+                  const uint8_t* content, size_t size);
+    
+    // Waits for every queued message and moves the results out, indexed by ticket
+    void finish(std::vector<Result>& results);
+    
+    size_t workerCount() const { return workers_.size(); }
+    
+private:
+    static const size_t PEER_ID_SIZE = 16;
+    static const size_t WORKER_CONTEXTS = 8;  // Peers whose expanded keys each worker keeps
+    
+    struct Job {
+        uint8_t peer[PEER_ID_SIZE];
+        SecureBuffer key;
+        bool has_key;
+        bool gcm_only;
+        bool base64;
+        std::vector<uint8_t> content;
+        Result result;
+    };
+    
+    DecryptPipeline(const DecryptPipeline&);
+    DecryptPipeline& operator=(const DecryptPipeline&);
+    
+    // One cached context; the key is kept to notice when the peer's key has been replaced
+    struct WorkerContext {
+        uint8_t peer[PEER_ID_SIZE];
+        uint8_t key[AesContext::KEY_SIZE];
+        uint64_t last_used;  // 0 = free
+        AesContext context;
+    };
+    typedef std::vector<WorkerContext, LockedAllocator<WorkerContext> > WorkerContexts;
+    
+    static AesContext& contextFor(WorkerContexts& contexts, uint64_t& clock, const Job& job);
+    void workerLoop();
+    
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    std::deque<Job> jobs_;        // Stable addresses: only appended to until finish()
+    std::deque<Job*> queue_;      // Jobs not picked up by a worker yet
+    size_t completed_;
+    bool stopping_;
+};
+
+#endif // DECRYPT_PIPELINE_H
@@ -0,0 +1,422 @@
+#include "FileTransfer.h"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/hmac.h>
+
+namespace {
+    void putU32(uint8_t* out, uint32_t value) {
+        for (int i = 0; i < 4; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    
+    void putU64(uint8_t* out, uint64_t value) {
+        for (int i = 0; i < 8; i++) out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+    
+    uint32_t getU32(const uint8_t* in) {
+        uint32_t value = 0;
+        for (int i = 3; i >= 0; i--) value = value << 8 | in[i];
+        return value;
+    }
+    
+    uint64_t getU64(const uint8_t* in) {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; i--) value = value << 8 | in[i];
+        return value;
+    }
+    
+    // Receive state: magic(4) + count(4) + file size(8) + name length(1) + name(255) + chunk bitmap
+    const char STATE_MAGIC[4] = { 'M', 'U', 'R', '1' };
+    const size_t STATE_HEADER_SIZE = 4 + 4 + 8 + 1 + FileChunk::MAX_NAME_SIZE;
+    const char* PART_SUFFIX = ".part";
+    const char* STATE_SUFFIX = ".state";
+    
+    size_t stateSize(uint32_t count) {
+        return STATE_HEADER_SIZE + (static_cast<size_t>(count) + 7) / 8;
+    }
+    
+    bool endsWith(const std::string& value, const std::string& suffix) {
+        return value.size() > suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+    
+    bool writeAt(int fd, const uint8_t* data, size_t size, off_t offset) {
+        while (size > 0) {
+            ssize_t written = ::pwrite(fd, data, size, offset);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+            offset += written;
+        }
+        return true;
+    }
+    
+    bool exists(const std::string& path) {
+        struct stat info;
+        return ::stat(path.c_str(), &info) == 0;
+    }
+    
+    // Last path component with control characters replaced; the sender picks the name
+    std::string safeName(const std::string& name) {
+        size_t slash = name.find_last_of("/\\");
+        std::string base = slash == std::string::npos ? name : name.substr(slash + 1);
+        for (size_t i = 0; i < base.size(); i++) {
+            if (static_cast<unsigned char>(base[i]) < 0x20 || base[i] == 0x7F) base[i] = '_';
+        }
+        if (base.empty() || base == "." || base == "..") base = "file";
+        return base;
+    }
+}
+
+uint32_t FileChunk::chunkCount(uint64_t file_size) {
+    uint64_t count = (file_size + DATA_SIZE - 1) / DATA_SIZE;
+    return count > 0 ? static_cast<uint32_t>(std::min<uint64_t>(count, UINT32_MAX)) : 1;
+}
+
+size_t FileChunk::dataSize(uint64_t file_size, uint32_t index) {
+    uint64_t offset = static_cast<uint64_t>(index) * DATA_SIZE;
+    return offset < file_size ? static_cast<size_t>(std::min<uint64_t>(file_size - offset, DATA_SIZE)) : 0;
+}
+
+size_t FileChunk::encodeHeader(const Header& header, uint8_t* out) {
+    size_t name_size = header.index == 0 ? std::min(header.name.size(), MAX_NAME_SIZE) : 0;
+    putU64(out, header.transfer_id);
+    putU32(out + 8, header.index);
+    putU32(out + 12, header.count);
+    putU64(out + 16, header.file_size);
+    out[24] = static_cast<uint8_t>(name_size);
+    std::memcpy(out + FIXED_HEADER_SIZE, header.name.data(), name_size);
+    return FIXED_HEADER_SIZE + name_size;
+}
+
+bool FileChunk::decodeHeader(const uint8_t* data, size_t size, Header& header, size_t& header_size) {
+    if (size < FIXED_HEADER_SIZE) return false;
+    header.transfer_id = getU64(data);
+    header.index = getU32(data + 8);
+    header.count = getU32(data + 12);
+    header.file_size = getU64(data + 16);
+    
+    size_t name_size = data[24];
+    if (size < FIXED_HEADER_SIZE + name_size) return false;
+    header.name.assign(reinterpret_cast<const char*>(data + FIXED_HEADER_SIZE), name_size);
+    header_size = FIXED_HEADER_SIZE + name_size;
+    
+    // The count must match the size, so a transfer cannot claim more chunks than its bytes need
+    return header.count <= MAX_CHUNKS && header.index < header.count && header.count == chunkCount(header.file_size) &&
+           size - header_size == dataSize(header.file_size, header.index);
+}
+
+TransferManifest::TransferManifest() : file_size_(0), transfer_id_(0), count_(0) {
+}
+
+bool TransferManifest::build(const std::string& path, const uint8_t* key, size_t key_size, uint64_t nonce,
+                             std::string& error) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        error = "cannot open " + path;
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    file_size_ = static_cast<uint64_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    
+    count_ = FileChunk::chunkCount(file_size_);
+    if (count_ > FileChunk::MAX_CHUNKS) {
+        error = "file too large";
+        return false;
+    }
+    name_ = path.substr(path.find_last_of("/\\") + 1);
+    
+    // Pass over the file, one chunk of memory at a time
+    std::vector<uint8_t> buffer(FileChunk::DATA_SIZE);
+    digests_.resize(static_cast<size_t>(count_) * CryptoPP::SHA256::DIGESTSIZE);
+    CryptoPP::SHA256 sha;
+    for (uint32_t index = 0; index < count_; index++) {
+        size_t size = FileChunk::dataSize(file_size_, index);
+        if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
+            error = "failed to read " + path;
+            return false;
+        }
+        sha.CalculateDigest(&digests_[static_cast<size_t>(index) * CryptoPP::SHA256::DIGESTSIZE], buffer.data(), size);
+    }
+    
+    uint8_t mac[CryptoPP::SHA256::DIGESTSIZE];
+    uint8_t field[8];
+    CryptoPP::HMAC<CryptoPP::SHA256> hmac(key, key_size);
+    
+    // Labels keep transfer and chunk MACs from ever being confused with each other
+    static const char TRANSFER_LABEL[] = "MessageU transfer";
+    hmac.Update(reinterpret_cast<const uint8_t*>(TRANSFER_LABEL), sizeof(TRANSFER_LABEL));
+    putU64(field, nonce);
+    hmac.Update(field, 8);
+    putU64(field, file_size_);
+    hmac.Update(field, 8);
+    field[0] = static_cast<uint8_t>(std::min(name_.size(), FileChunk::MAX_NAME_SIZE));
+    hmac.Update(field, 1);
+    hmac.Update(reinterpret_cast<const uint8_t*>(name_.data()), field[0]);
+    hmac.Update(digests_.data(), digests_.size());
+    hmac.Final(mac);
+    transfer_id_ = getU64(mac);
+    
+    static const char CHUNK_LABEL[] = "MessageU chunk";
+    ids_.resize(static_cast<size_t>(count_) * FileChunk::ID_SIZE);
+    for (uint32_t index = 0; index < count_; index++) {
+        hmac.Update(reinterpret_cast<const uint8_t*>(CHUNK_LABEL), sizeof(CHUNK_LABEL));
+        putU64(field, transfer_id_);
+        hmac.Update(field, 8);
+        putU32(field, index);
+        hmac.Update(field, 4);
+        hmac.Update(&digests_[static_cast<size_t>(index) * CryptoPP::SHA256::DIGESTSIZE], CryptoPP::SHA256::DIGESTSIZE);
+        hmac.Final(mac);
+        std::memcpy(&ids_[static_cast<size_t>(index) * FileChunk::ID_SIZE], mac, FileChunk::ID_SIZE);
+    }
+    return true;
+}
+
+std::vector<uint8_t> TransferManifest::chunkId(uint32_t index) const {
+    const uint8_t* id = &ids_[static_cast<size_t>(index) * FileChunk::ID_SIZE];
+    return std::vector<uint8_t>(id, id + FileChunk::ID_SIZE);
+}
+
+bool TransferManifest::matches(uint32_t index, const uint8_t* data, size_t size) const {
+    if (index >= count_ || size != FileChunk::dataSize(file_size_, index)) return false;
+    uint8_t digest[CryptoPP::SHA256::DIGESTSIZE];
+    CryptoPP::SHA256().CalculateDigest(digest, data, size);
+    return std::memcmp(digest, &digests_[static_cast<size_t>(index) * sizeof(digest)], sizeof(digest)) == 0;
+}
+
+FileAssembler::FileAssembler(const std::string& directory) : directory_(directory) {
+    DIR* dir = ::opendir(directory_.c_str());
+    if (!dir) return;  // Nothing received yet
+    
+    std::string suffix(STATE_SUFFIX);
+    while (struct dirent* entry = ::readdir(dir)) {
+        std::string file = entry->d_name;
+        if (endsWith(file, suffix)) {
+            reload(file.substr(0, file.size() - suffix.size()));
+        }
+    }
+    ::closedir(dir);
+}
+
+FileAssembler::~FileAssembler() {
+    // Incomplete transfers stay on disk for the next assembler
+    for (IncomingMap::iterator it = incoming_.begin(); it != incoming_.end(); ++it) {
+        if (it->second.fd >= 0) ::close(it->second.fd);
+        if (it->second.state_fd >= 0) ::close(it->second.state_fd);
+    }
+}
+
+FileAssembler::Outcome FileAssembler::accept(const std::string& sender_id, const uint8_t* plaintext, size_t size,
+                                             Status& status) {
+    status.name.clear();
+    status.path.clear();
+    status.index = 0;
+    status.received = 0;
+    status.count = 0;
+    status.file_size = 0;
+    status.error.clear();
+    
+    FileChunk::Header header;
+    size_t header_size = 0;
+    if (!FileChunk::decodeHeader(plaintext, size, header, header_size)) {
+        status.error = "malformed file chunk";
+        return CHUNK_REJECTED;
+    }
+    status.index = header.index;
+    status.count = header.count;
+    status.file_size = header.file_size;
+    
+    char transfer[17];
+    std::snprintf(transfer, sizeof(transfer), "%016llx", static_cast<unsigned long long>(header.transfer_id));
+    std::string key = sender_id + "-" + transfer;
+    
+    // Any chunk may open the transfer; after a resume chunk 0 is not necessarily first
+    IncomingMap::iterator it = incoming_.find(key);
+    if (it == incoming_.end()) {
+        it = start(key, header, status.error);
+        if (it == incoming_.end()) return CHUNK_REJECTED;
+    }
+    Incoming& incoming = it->second;
+    
+    if (header.count != incoming.count || header.file_size != incoming.file_size) {
+        status.error = "chunk inconsistent with the transfer";
+        drop(it);
+        return CHUNK_REJECTED;
+    }
+    
+    status.name = header.index == 0 ? header.name : incoming.name;
+    status.received = incoming.received_count;
+    if (incoming.received[header.index]) return CHUNK_DUPLICATE;
+    
+    // Each chunk has its own place in the file, whatever order they come in; the state records
+    // it only once its bytes are written
+    off_t offset = static_cast<off_t>(static_cast<uint64_t>(header.index) * FileChunk::DATA_SIZE);
+    incoming.received[header.index] = true;
+    if (header.index == 0) incoming.name = header.name;
+    if (!writeAt(incoming.fd, plaintext + header_size, size - header_size, offset) ||
+        (header.index == 0 && !writeStateHeader(incoming)) || !writeStateBit(incoming, header.index)) {
+        status.error = std::string("write failed: ") + std::strerror(errno);
+        drop(it);
+        return CHUNK_REJECTED;
+    }
+    status.received = ++incoming.received_count;
+    
+    if (incoming.received_count < incoming.count) return CHUNK_STORED;
+    return finish(it, status);
+}
+
+FileAssembler::IncomingMap::iterator FileAssembler::start(const std::string& key, const FileChunk::Header& header,
+                                                          std::string& error) {
+    if (::mkdir(directory_.c_str(), 0700) != 0 && errno != EEXIST) {
+        error = "cannot create " + directory_ + ": " + std::strerror(errno);
+        return incoming_.end();
+    }
+    
+    // Chunks are rewritten at their offsets, so a part file left without its state is reused as is
+    Incoming incoming;
+    incoming.part_path = directory_ + "/" + key + PART_SUFFIX;
+    incoming.state_path = directory_ + "/" + key + STATE_SUFFIX;
+    incoming.count = header.count;
+    incoming.file_size = header.file_size;
+    incoming.received.assign(header.count, false);
+    incoming.received_count = 0;
+    incoming.state_fd = -1;
+    incoming.fd = ::open(incoming.part_path.c_str(), O_WRONLY | O_CREAT, 0600);
+    if (incoming.fd < 0) {
+        error = "cannot create " + incoming.part_path + ": " + std::strerror(errno);
+        return incoming_.end();
+    }
+    
+    // A fresh state is all zero past the header: no chunks yet
+    incoming.state_fd = ::open(incoming.state_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (incoming.state_fd < 0 || ::ftruncate(incoming.state_fd, static_cast<off_t>(stateSize(incoming.count))) != 0 ||
+        !writeStateHeader(incoming)) {
+        error = "cannot create " + incoming.state_path + ": " + std::strerror(errno);
+        if (incoming.state_fd >= 0) ::close(incoming.state_fd);
+        ::close(incoming.fd);
+        ::unlink(incoming.state_path.c_str());
+        return incoming_.end();
+    }
+    
+    return incoming_.insert(std::make_pair(key, incoming)).first;
+}
+
+bool FileAssembler::reload(const std::string& key) {
+    Incoming incoming;
+    incoming.part_path = directory_ + "/" + key + PART_SUFFIX;
+    incoming.state_path = directory_ + "/" + key + STATE_SUFFIX;
+    incoming.fd = -1;
+    incoming.state_fd = ::open(incoming.state_path.c_str(), O_RDWR);
+    if (incoming.state_fd < 0) return false;
+    
+    // A state that does not describe a valid transfer is left alone; the transfer starts over
+    std::vector<uint8_t> state;
+    struct stat info;
+    if (::fstat(incoming.state_fd, &info) == 0 && info.st_size >= static_cast<off_t>(STATE_HEADER_SIZE) &&
+        info.st_size <= static_cast<off_t>(stateSize(FileChunk::MAX_CHUNKS))) {
+        state.resize(static_cast<size_t>(info.st_size));
+        if (::pread(incoming.state_fd, state.data(), state.size(), 0) != static_cast<ssize_t>(state.size())) {
+            state.clear();
+        }
+    }
+    
+    bool valid = !state.empty() && std::memcmp(state.data(), STATE_MAGIC, sizeof(STATE_MAGIC)) == 0;
+    if (valid) {
+        incoming.count = getU32(&state[4]);
+        incoming.file_size = getU64(&state[8]);
+        valid = incoming.count > 0 && incoming.count <= FileChunk::MAX_CHUNKS &&
+                incoming.count == FileChunk::chunkCount(incoming.file_size) &&
+                state.size() == stateSize(incoming.count) && exists(incoming.part_path);
+    }
+    if (valid) {
+        incoming.name.assign(reinterpret_cast<const char*>(&state[17]), state[16]);
+        incoming.received.assign(incoming.count, false);
+        incoming.received_count = 0;
+        for (uint32_t index = 0; index < incoming.count; index++) {
+            if (state[STATE_HEADER_SIZE + index / 8] & (1u << (index % 8))) {
+                incoming.received[index] = true;
+                incoming.received_count++;
+            }
+        }
+        incoming.fd = ::open(incoming.part_path.c_str(), O_WRONLY);
+        valid = incoming.fd >= 0;
+    }
+    if (!valid) {
+        ::close(incoming.state_fd);
+        return false;
+    }
+    
+    incoming_.insert(std::make_pair(key, incoming));
+    return true;
+}
+
+bool FileAssembler::writeStateHeader(const Incoming& incoming) {
+    uint8_t header[STATE_HEADER_SIZE] = {0};
+    std::memcpy(header, STATE_MAGIC, sizeof(STATE_MAGIC));
+    putU32(header + 4, incoming.count);
+    putU64(header + 8, incoming.file_size);
+    size_t name_size = std::min(incoming.name.size(), FileChunk::MAX_NAME_SIZE);
+    header[16] = static_cast<uint8_t>(name_size);
+    std::memcpy(header + 17, incoming.name.data(), name_size);
+    return writeAt(incoming.state_fd, header, sizeof(header), 0);
+}
+
+bool FileAssembler::writeStateBit(const Incoming& incoming, uint32_t index) {
+    uint32_t first = index / 8 * 8;
+    uint8_t bits = 0;
+    for (uint32_t i = first; i < first + 8 && i < incoming.count; i++) {
+        if (incoming.received[i]) bits |= static_cast<uint8_t>(1u << (i - first));
+    }
+    return writeAt(incoming.state_fd, &bits, 1, static_cast<off_t>(STATE_HEADER_SIZE + index / 8));
+}
+
+FileAssembler::Outcome FileAssembler::finish(IncomingMap::iterator it, Status& status) {
+    // The final name appears only once every byte is on disk
+    Incoming& incoming = it->second;
+    bool synced = ::fsync(incoming.fd) == 0;
+    ::close(incoming.fd);
+    incoming.fd = -1;
+    
+    status.path = destinationFor(safeName(incoming.name));
+    if (!synced || std::rename(incoming.part_path.c_str(), status.path.c_str()) != 0) {
+        status.error = std::string("could not finish the file: ") + std::strerror(errno);
+        drop(it);
+        return CHUNK_REJECTED;
+    }
+    ::close(incoming.state_fd);
+    ::unlink(incoming.state_path.c_str());
+    incoming_.erase(it);
+    return FILE_COMPLETE;
+}
+
+void FileAssembler::drop(IncomingMap::iterator it) {
+    if (it->second.fd >= 0) {
+        ::close(it->second.fd);
+    }
+    if (it->second.state_fd >= 0) {
+        ::close(it->second.state_fd);
+    }
+    ::unlink(it->second.part_path.c_str());
+    ::unlink(it->second.state_path.c_str());
+    incoming_.erase(it);
+}
+
+std::string FileAssembler::destinationFor(const std::string& name) const {
+    // "name", then "name.1", "name.2", ... skipping existing files
+    std::string base = directory_ + "/" + name;
+    std::string path = base;
+    for (unsigned suffix = 1; exists(path); suffix++) {
+        path = base + "." + std::to_string(suffix);
+    }
+    return path;
+}
@@ -0,0 +1,150 @@
+#ifndef FILE_TRANSFER_H
+#define FILE_TRANSFER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * FileChunk - Plaintext layout of one piece of a file attachment
+ *
+ * A file is sent as a run of MessageTypes::FILE_CHUNK messages, each encrypted on its own with the
+ * recipient's symmetric key. The plaintext starts with transfer ID(8) + index(4) +
+ * count(4) + file size(8) + name length(1) + name, little-endian; only chunk 0
+ * carries the name. The file bytes at index * DATA_SIZE follow.
+ */
+namespace FileChunk {
+    const size_t DATA_SIZE = 60 * 1024;  // File bytes per chunk; a whole chunk request fits a v1 frame
+    const size_t FIXED_HEADER_SIZE = 25;
+    const size_t MAX_NAME_SIZE = 255;
+    const size_t MAX_HEADER_SIZE = FIXED_HEADER_SIZE + MAX_NAME_SIZE;
+    const size_t ID_SIZE = 16;              // Chunk IDs the server uses to recognise stored chunks
+    const uint32_t MAX_CHUNKS = 1u << 24;   // About 1 TB; bounds what a receiver tracks per transfer
+    
+    struct Header {
+        uint64_t transfer_id;
+        uint32_t index;
+        uint32_t count;
+        uint64_t file_size;
+        std::string name;  // Chunk 0 only; at most MAX_NAME_SIZE bytes are sent
+    };
+    
+    uint32_t chunkCount(uint64_t file_size);  // At least one, so empty files arrive too
+    size_t dataSize(uint64_t file_size, uint32_t index);  // File bytes carried by chunk index
+    size_t encodeHeader(const Header& header, uint8_t* out);  // out holds MAX_HEADER_SIZE; returns bytes written
+    bool decodeHeader(const uint8_t* data, size_t size, Header& header, size_t& header_size);
+}
+
+/**
+ * TransferManifest - Content-derived identity of one outgoing file
+ *
+ * Features:
+ * - One pass over the file records a SHA-256 digest per chunk; file bytes are not kept
+ * - The transfer ID is an HMAC, under the recipient's symmetric key, over a per-send nonce,
+ *   the name, the size and every digest
+ * - Chunk IDs are HMACs over the transfer ID, the index and the chunk digest: stable across
+ *   retries of the same send, different for every position and opaque to the server
+ * - Chunks re-read for sending are checked against their digest, so a file changed
+ *   mid-transfer is noticed instead of being spliced
+ */
+class TransferManifest {
+public:
+    TransferManifest();
+    
+    // Reads the file once; nonce tells separate sends of the same file apart
+    bool build(const std::string& path, const uint8_t* key, size_t key_size, uint64_t nonce, std::string& error);
+    
+    const std::string& name() const { return name_; }
+    uint64_t transferId() const { return transfer_id_; }
+    uint64_t fileSize() const { return file_size_; }
+    uint32_t chunkCount() const { return count_; }
+    std::vector<uint8_t> chunkId(uint32_t index) const;  // ID_SIZE bytes
+    const std::vector<uint8_t>& chunkIds() const { return ids_; }  // All IDs back to back, in chunk order
+    
+    // False if data is not what chunk index held when the manifest was built
+    bool matches(uint32_t index, const uint8_t* data, size_t size) const;
+    
+private:
+    std::string name_;
+    uint64_t file_size_;
+    uint64_t transfer_id_;
+    uint32_t count_;
+    std::vector<uint8_t> digests_;  // SHA-256 per chunk
+    std::vector<uint8_t> ids_;      // ID_SIZE bytes per chunk
+};
+
+/**
+ * FileAssembler - Writes incoming file chunks to disk as they are decrypted
+ *
+ * Features:
+ * - One open file per (sender, transfer); each chunk is written at its own offset, so chunks
+ *   re-sent after a resume may arrive in any order and repeats are ignored
+ * - Data goes to a ".part" file named after the transfer, renamed once every chunk is in
+ * - A ".state" file beside it records the size, the name and a bitmap of the chunks written,
+ *   one byte rewritten per chunk
+ * - Names are reduced to their last path component; existing files are never overwritten
+ * - A chunk inconsistent with its transfer drops the transfer and its partial file
+ *
+ * The server deletes chunks once it has handed them out, so incomplete transfers are kept on
+ * disk: a new assembler reloads every ".state" file in its directory and carries on.
+ */
+class FileAssembler {
+public:
+    enum Outcome {
+        CHUNK_STORED,     // Written; more chunks to come
+        CHUNK_DUPLICATE,  // Already written earlier; ignored
+        FILE_COMPLETE,    // Last missing chunk written and the file moved to its final name
+        CHUNK_REJECTED    // See Status::error; the transfer, if any, is dropped
+    };
+    
+    struct Status {
+        std::string name;   // Sent file name, once chunk 0 is in
+        std::string path;   // Final destination, on FILE_COMPLETE
+        uint32_t index;
+        uint32_t received;  // Distinct chunks of the transfer written so far
+        uint32_t count;
+        uint64_t file_size;
+        std::string error;
+    };
+    
+    // Reloads the transfers left incomplete by an earlier assembler on the same directory
+    explicit FileAssembler(const std::string& directory);
+    ~FileAssembler();
+    
+    // Writes one decrypted chunk from sender_id
+    Outcome accept(const std::string& sender_id, const uint8_t* plaintext, size_t size, Status& status);
+    
+    size_t activeTransfers() const { return incoming_.size(); }
+    
+private:
+    struct Incoming {
+        int fd;
+        int state_fd;
+        std::string part_path;
+        std::string state_path;
+        std::string name;
+        uint32_t count;
+        uint64_t file_size;
+        std::vector<bool> received;
+        uint32_t received_count;
+    };
+    typedef std::map<std::string, Incoming> IncomingMap;
+    
+    FileAssembler(const FileAssembler&);
+    FileAssembler& operator=(const FileAssembler&);
+    
+    IncomingMap::iterator start(const std::string& key, const FileChunk::Header& header, std::string& error);
+    bool reload(const std::string& key);
+    bool writeStateHeader(const Incoming& incoming);
+    bool writeStateBit(const Incoming& incoming, uint32_t index);  // The bitmap byte holding index
+    Outcome finish(IncomingMap::iterator it, Status& status);
+    void drop(IncomingMap::iterator it);
+    std::string destinationFor(const std::string& name) const;
+    
+    std::string directory_;
+    IncomingMap incoming_;  // sender ID + transfer ID -> open transfer
+};
+
+#endif // FILE_TRANSFER_H
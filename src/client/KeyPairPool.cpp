@@ -0,0 +1,103 @@
+#include "KeyPairPool.h"
+#include <chrono>
+#include <iostream>
+#include <cryptopp/osrng.h>
+
+KeyPairPool::KeyPairPool(unsigned key_bits) : key_bits_(key_bits), target_(0), demand_(0), stopping_(false) {
+    stats_.generated = 0;
+    stats_.failed = 0;
+    stats_.total_ms = 0;
+    stats_.last_ms = 0;
+}
+
+KeyPairPool::~KeyPairPool() {
+    stop();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void KeyPairPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        ready_.clear();
+    }
+    space_available_.notify_all();
+    pair_ready_.notify_all();
+}
+
+void KeyPairPool::start(size_t target) {
+    if (worker_.joinable()) return;
+    target_ = target > 0 ? target : 1;
+    worker_ = std::thread(&KeyPairPool::workerLoop, this);
+}
+
+bool KeyPairPool::take(KeyPair& out) {
+    if (!worker_.joinable()) return false;
+    
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (ready_.empty() && !stopping_) {
+        // Pairs are not replaced as they are taken; this caller asks for one
+        demand_++;
+        space_available_.notify_one();
+    }
+    pair_ready_.wait(lock, [this]() { return stopping_ || !ready_.empty(); });
+    if (ready_.empty()) return false;
+    
+    out = ready_.front();
+    ready_.pop_front();
+    return true;
+}
+
+size_t KeyPairPool::ready() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_.size();
+}
+
+KeyPairPool::Stats KeyPairPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void KeyPairPool::workerLoop() {
+    CryptoPP::AutoSeededRandomPool rng;
+    
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            space_available_.wait(lock, [this]() { return stopping_ || stats_.generated < target_ || demand_ > 0; });
+            if (stopping_) return;
+        }
+        
+        // Prime generation runs without the lock, so take() and stats() stay responsive
+        KeyPair pair;
+        bool ok = true;
+        std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+        try {
+            pair.private_key.GenerateRandomWithKeySize(rng, key_bits_);
+            pair.public_key.AssignFrom(pair.private_key);
+        } catch (const CryptoPP::Exception& e) {
+            std::cerr << "Background RSA key generation failed: " << e.what() << std::endl;
+            ok = false;
+        }
+        pair.generation_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!ok) {
+                // Retrying would most likely fail the same way; callers fall back to generating inline
+                stats_.failed++;
+                stopping_ = true;
+            } else {
+                stats_.generated++;
+                stats_.total_ms += pair.generation_ms;
+                stats_.last_ms = pair.generation_ms;
+                ready_.push_back(pair);
+                if (demand_ > 0) demand_--;
+            }
+        }
+        pair_ready_.notify_all();
+        if (!ok) return;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef KEY_PAIR_POOL_H
+#define KEY_PAIR_POOL_H
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cryptopp/rsa.h>
+
+/**
+ * KeyPairPool - RSA key pairs generated ahead of time on a background thread
+ *
+ * Features:
+ * - One worker generates the target number of key pairs up front
+ * - Each pair records how long its prime generation took; totals are kept for reporting
+ * - take() hands out a ready pair at once; only a take() that finds the pool empty has
+ *   another generated, so nothing is generated that no one asked for
+ * - The worker has its own random pool; nothing is shared with ClientCrypto's generator
+ *
+ * Generation cannot be interrupted, so stop() and destruction wait for a pair already in progress.
+ * If a generation fails the worker stops, and take() returns false once the pool is empty.
+ */
+class KeyPairPool {
+public:
+    static const unsigned DEFAULT_KEY_BITS = 2048;
+    
+    struct KeyPair {
+        CryptoPP::RSA::PrivateKey private_key;
+        CryptoPP::RSA::PublicKey public_key;
+        double generation_ms;
+    };
+    
+    struct Stats {
+        size_t generated;
+        size_t failed;
+        double total_ms;
+        double last_ms;
+    };
+    
+    explicit KeyPairPool(unsigned key_bits = DEFAULT_KEY_BITS);
+    ~KeyPairPool();
+    
+    // Starts the worker (once); target is how many pairs to keep ready, at least one
+    void start(size_t target);
+    bool isRunning() const { return worker_.joinable(); }
+    
+    // Copies a ready pair into out, waiting if none is ready; false if the pool is not (or no longer) running
+    bool take(KeyPair& out);
+    
+    // Drops the ready pairs and ends the worker once it is idle; take() returns false afterwards
+    void stop();
+    
+    size_t ready() const;
+    Stats stats() const;
+    
+private:
+    KeyPairPool(const KeyPairPool&);
+    KeyPairPool& operator=(const KeyPairPool&);
+    
+    void workerLoop();
+    
+    unsigned key_bits_;
+    size_t target_;
+    std::thread worker_;
+    mutable std::mutex mutex_;
+    std::condition_variable space_available_;  // Worker waits here while the pool is full
+    std::condition_variable pair_ready_;       // take() waits here while the pool is empty
+    std::deque<KeyPair> ready_;
+    size_t demand_;  // Pairs asked for by take() calls that found the pool empty
+    Stats stats_;
+    bool stopping_;
+};
+
+#endif // KEY_PAIR_POOL_H
@@ -0,0 +1,257 @@
+#include "KeyStoreFile.h"
+#include "Checksum.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+    const uint8_t MAGIC[4] = {'M', 'U', 'K', 'S'};
+    const uint8_t FORMAT_VERSION = 1;
+    
+    // Superseded records are tolerated up to this many before a load rewrites the file
+    const size_t COMPACT_MIN_RECORDS = 1024;
+    
+    // Multi-byte fields are little-endian on disk, whatever the host
+    void putU32(uint8_t* out, uint32_t value) {
+        out[0] = static_cast<uint8_t>(value);
+        out[1] = static_cast<uint8_t>(value >> 8);
+        out[2] = static_cast<uint8_t>(value >> 16);
+        out[3] = static_cast<uint8_t>(value >> 24);
+    }
+    
+    uint32_t getU32(const uint8_t* in) {
+        return static_cast<uint32_t>(in[0]) | static_cast<uint32_t>(in[1]) << 8 |
+               static_cast<uint32_t>(in[2]) << 16 | static_cast<uint32_t>(in[3]) << 24;
+    }
+    
+    bool writeAll(int fd, const uint8_t* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+    
+    // Makes a rename in the directory of path durable; the file's own fsync does not cover it
+    bool syncDirectory(const std::string& path) {
+        std::string::size_type slash = path.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+        int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return false;
+        bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        return ok;
+    }
+}
+
+KeyStoreFile::KeyStoreFile() : fd_(-1), records_(0) {
+}
+
+KeyStoreFile::~KeyStoreFile() {
+    close();
+}
+
+void KeyStoreFile::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    records_ = 0;
+}
+
+void KeyStoreFile::fillHeader(uint8_t* header) const {
+    std::memset(header, 0, HEADER_SIZE);
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    header[4] = FORMAT_VERSION;
+    header[5] = static_cast<uint8_t>(RECORD_SIZE);
+    std::memcpy(header + 8, owner_id_.data(), owner_id_.size());
+    putU32(header + 24, Checksum::crc32c(header, 24));
+}
+
+bool KeyStoreFile::open(const std::string& path, const std::string& owner_id, SymmetricKeyStore& store) {
+    close();
+    if (owner_id.empty() || owner_id.size() > SymmetricKeyStore::ID_SIZE) {
+        std::cerr << "Key store needs a client ID of at most 16 bytes" << std::endl;
+        return false;
+    }
+    path_ = path;
+    owner_id_ = owner_id;
+    
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        std::cerr << "Cannot open key store " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        std::cerr << "Cannot read key store " << path << ": " << std::strerror(errno) << std::endl;
+        ::close(fd);
+        return false;
+    }
+    
+    // Keys from a file someone else can write would be trusted, and ours would be readable by them
+    if (info.st_uid != ::geteuid()) {
+        std::cerr << "Key store " << path << " is owned by another user (uid " << info.st_uid
+                  << "); refusing to use it" << std::endl;
+        ::close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    
+    // Map the whole file and replay it; records are applied straight from the mapping
+    size_t valid = 0;
+    bool header_ok = false;
+    if (size >= HEADER_SIZE) {
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Cannot map key store " << path << ": " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            return false;
+        }
+        
+        const uint8_t* data = static_cast<const uint8_t*>(mapping);
+        uint8_t expected[HEADER_SIZE];
+        fillHeader(expected);
+        header_ok = std::memcmp(data, expected, HEADER_SIZE) == 0;
+        if (header_ok) {
+            valid = HEADER_SIZE + replay(data + HEADER_SIZE, size - HEADER_SIZE, store);
+        }
+        ::munmap(mapping, size);
+    }
+    
+    fd_ = fd;
+    if (!header_ok) {
+        // New file, another client's file or an unknown format: start a fresh one
+        if (size > 0) {
+            std::cout << "Key store " << path << " does not belong to this client; starting a new one" << std::endl;
+        }
+        return rewrite(store);
+    }
+    
+    if (valid < size) {
+        // Torn or corrupt tail from an interrupted append; keep everything before it
+        std::cout << "Key store: discarding " << (size - valid) << " bytes of incomplete records" << std::endl;
+        if (::ftruncate(fd_, static_cast<off_t>(valid)) != 0) {
+            std::cerr << "Cannot truncate key store: " << std::strerror(errno) << std::endl;
+            close();
+            return false;
+        }
+    }
+    
+    if (records_ > COMPACT_MIN_RECORDS && records_ > 2 * store.size()) {
+        return rewrite(store);
+    }
+    
+    if (::lseek(fd_, 0, SEEK_END) < 0) {
+        close();
+        return false;
+    }
+    std::cout << "Key store loaded: " << store.size() << " peer keys from " << path << std::endl;
+    return true;
+}
+
+size_t KeyStoreFile::replay(const uint8_t* data, size_t size, SymmetricKeyStore& store) {
+    records_ = 0;
+    size_t offset = 0;
+    for (; offset + RECORD_SIZE <= size; offset += RECORD_SIZE) {
+        const uint8_t* record = data + offset;
+        if (getU32(record + 36) != Checksum::crc32c(record, 36)) break;
+        
+        const uint8_t* id = record + 4;
+        if (record[0] == OP_PUT) {
+            SymmetricKeyStore::Entry* entry = store.insert(id, record + 20);
+            if (entry) entry->flags = record[1];
+        } else if (record[0] == OP_REMOVE) {
+            store.remove(id);
+        } else {
+            break;
+        }
+        records_++;
+    }
+    return offset;
+}
+
+void KeyStoreFile::encodeRecord(uint8_t* record, uint8_t op, uint8_t flags, const uint8_t* id, const uint8_t* key) {
+    std::memset(record, 0, RECORD_SIZE);
+    record[0] = op;
+    record[1] = flags;
+    std::memcpy(record + 4, id, SymmetricKeyStore::ID_SIZE);
+    if (key) std::memcpy(record + 20, key, SymmetricKeyStore::KEY_SIZE);
+    putU32(record + 36, Checksum::crc32c(record, 36));
+}
+
+bool KeyStoreFile::append(uint8_t op, uint8_t flags, const uint8_t* id, const uint8_t* key) {
+    if (fd_ < 0) return false;
+    
+    uint8_t record[RECORD_SIZE];
+    encodeRecord(record, op, flags, id, key);
+    
+    // One write per record; a crash can only tear the last one, which the CRC catches
+    bool ok = writeAll(fd_, record, sizeof(record)) && ::fsync(fd_) == 0;
+    std::memset(record, 0, sizeof(record));
+    if (!ok) {
+        std::cerr << "Failed to write key store " << path_ << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    records_++;
+    return true;
+}
+
+bool KeyStoreFile::recordPut(const SymmetricKeyStore::Entry& entry) {
+    return append(OP_PUT, entry.flags, entry.id, entry.key);
+}
+
+bool KeyStoreFile::recordRemove(const uint8_t* id) {
+    return append(OP_REMOVE, 0, id, nullptr);
+}
+
+bool KeyStoreFile::rewrite(const SymmetricKeyStore& store) {
+    // Header and every live key in one (locked) buffer, one write and one sync
+    SecureBuffer contents(HEADER_SIZE + store.size() * RECORD_SIZE);
+    fillHeader(contents.data());
+    uint8_t* record = contents.data() + HEADER_SIZE;
+    for (size_t i = 0; i < store.capacity(); i++) {
+        const SymmetricKeyStore::Entry* entry = store.slotAt(i);
+        if (entry) {
+            encodeRecord(record, OP_PUT, entry->flags, entry->id, entry->key);
+            record += RECORD_SIZE;
+        }
+    }
+    
+    // Written to a temporary file and renamed over the journal, so a crash leaves one or the other
+    std::string temp_path = path_ + ".tmp";
+    int fd = ::open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    bool ok = fd >= 0 && writeAll(fd, contents.data(), contents.size()) && ::fsync(fd) == 0 &&
+              ::rename(temp_path.c_str(), path_.c_str()) == 0 && syncDirectory(path_);
+    int error = errno;
+    contents.clear();  // Wiped
+    
+    // The old descriptor refers to the replaced file; appends go to the new one
+    close();
+    if (!ok) {
+        std::cerr << "Failed to write key store " << path_ << ": " << std::strerror(error) << std::endl;
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(temp_path.c_str());
+        }
+        return false;
+    }
+    fd_ = fd;
+    records_ = store.size();
+    if (::lseek(fd_, 0, SEEK_END) < 0) {
+        close();
+        return false;
+    }
+    std::cout << "Key store written: " << store.size() << " peer keys to " << path_ << std::endl;
+    return true;
+}
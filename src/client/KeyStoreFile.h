@@ -0,0 +1,62 @@
+#ifndef KEY_STORE_FILE_H
+#define KEY_STORE_FILE_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "SymmetricKeyStore.h"
+
+/**
+ * KeyStoreFile - On-disk journal of peer symmetric keys, so they survive a restart
+ *
+ * Features:
+ * - 32-byte header (magic, version, record size, owner client ID) followed by fixed 40-byte records
+ * - Record: op, mode flags, client ID, key and a CRC32C over the rest
+ * - Loaded by mapping the file and replaying the records into a SymmetricKeyStore
+ * - Every change is one appended record, written with a single write() and synced
+ * - A torn record at the end (crash mid-append) fails its CRC and is cut off on the next load
+ * - Rewritten through a temporary file and rename() when superseded records dominate;
+ *   the directory is synced after the rename so the new file survives a crash
+ *
+ * The file is created with mode 0600: it holds key material in the clear, like me.info.
+ * A file owned by another user is refused.
+ * A file written for another client ID is replaced rather than loaded.
+ */
+class KeyStoreFile {
+public:
+    static const size_t HEADER_SIZE = 32;
+    static const size_t RECORD_SIZE = 40;
+    
+    KeyStoreFile();
+    ~KeyStoreFile();
+    
+    // Loads the file into store (creating it if missing) and keeps it open for appends
+    bool open(const std::string& path, const std::string& owner_id, SymmetricKeyStore& store);
+    void close();
+    bool isOpen() const { return fd_ >= 0; }
+    
+    // Journal one change; failures are reported and leave the in-memory store authoritative
+    bool recordPut(const SymmetricKeyStore::Entry& entry);
+    bool recordRemove(const uint8_t* id);
+    
+    size_t recordCount() const { return records_; }
+    
+private:
+    enum Op { OP_PUT = 1, OP_REMOVE = 2 };
+    
+    KeyStoreFile(const KeyStoreFile&);
+    KeyStoreFile& operator=(const KeyStoreFile&);
+    
+    static void encodeRecord(uint8_t* record, uint8_t op, uint8_t flags, const uint8_t* id, const uint8_t* key);
+    bool append(uint8_t op, uint8_t flags, const uint8_t* id, const uint8_t* key);
+    size_t replay(const uint8_t* data, size_t size, SymmetricKeyStore& store);  // Returns the valid length
+    bool rewrite(const SymmetricKeyStore& store);
+    void fillHeader(uint8_t* header) const;
+    
+    std::string path_;
+    std::string owner_id_;
+    int fd_;
+    size_t records_;  // Records in the file, live or superseded
+};
+
+#endif // KEY_STORE_FILE_H
@@ -1,11 +1,69 @@
 #include "MessageUClient.h"
+#include "MessageView.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <limits>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+    // Budget for one page of waiting messages, so memory stays flat however many are queued
+    const uint32_t MESSAGES_PAGE_COUNT = 64;
+    const uint32_t MESSAGES_PAGE_BYTES = 256 * 1024;
+    
+    // Payload budget of one batched send on v2 and later; v1 frames are capped by their 16-bit size
+    const size_t SEND_BATCH_BYTES = 1024 * 1024;
+    
+    // Peer symmetric keys, kept next to me.info so a restart does not repeat key exchanges
+    const char* KEY_STORE_FILE = "me.keys";
+    
+    // RSA key pairs kept ready for registration unless client.info says otherwise
+    const size_t DEFAULT_KEY_POOL_SIZE = 1;
+    
+    // Received attachments land here, created on first use
+    const char* RECEIVED_FILES_DIR = "received";
+    
+    // Chunk requests in flight while sending a file; memory stays at this many chunks
+    const size_t FILE_SEND_WINDOW = 8;
+    
+    // Connections tried per file send; waits between them double from one second
+    const unsigned FILE_SEND_ATTEMPTS = 5;
+    
+    // Nonces of file sends that did not finish, so sending the file again resumes after a restart
+    const char* TRANSFERS_FILE = "me.transfers";
+    
+    // me.info is line based, so a PEM is kept as its base64 body on one line
+    std::string pemLine(const std::string& pem) {
+        std::istringstream lines(pem);
+        std::string line;
+        std::string body;
+        while (std::getline(lines, line)) {
+            if (line.compare(0, 5, "-----") != 0) body += line;
+        }
+        return body;
+    }
+    
+    const char* batchStatusText(uint8_t status) {
+        switch (status) {
+            case BatchStatus::STORED: return "sent";
+            case BatchStatus::RECIPIENT_NOT_FOUND: return "recipient not found";
+            case BatchStatus::INVALID_ENTRY: return "invalid entry";
+            case BatchStatus::STORE_FAILED: return "server failed to store the batch";
+            default: return "unknown status";
+        }
+    }
+}
 
 MessageUClient::MessageUClient() 
-    : server_port_(0), is_registered_(false), is_connected_(false) {
+    : server_port_(0), is_registered_(false), is_connected_(false), negotiated_session_(0),
+      key_pool_size_(DEFAULT_KEY_POOL_SIZE), received_files_(RECEIVED_FILES_DIR) {
     // Constructor implementation
 }
 
@@ -22,8 +80,26 @@ bool MessageUClient::initialize() {
         return false;
     }
     
-    // Load client configuration
+    // Optional tuning, then the client identity
+    loadClientOptions();
     loadClientConfig();
+    loadUnfinishedTransfers();
+    if (received_files_.activeTransfers() > 0) {
+        std::cout << "Incoming files still being received: " << received_files_.activeTransfers()
+                  << " (in " << RECEIVED_FILES_DIR << ")" << std::endl;
+    }
+    
+    // Registration takes a ready key pair instead of waiting on prime generation
+    if (!is_registered_ && key_pool_size_ > 0) {
+        key_pairs_.start(key_pool_size_);
+        std::cout << "Generating RSA key pairs in the background" << std::endl;
+    }
+    
+    // The session to the server is opened lazily and reused by every operation
+    network_.setServerInfo(server_ip_, server_port_);
+    
+    std::cout << "Crypto acceleration: " << ClientCrypto::accelerationReport() << std::endl;
+    std::cout << "Secure memory: " << SecureBuffer::report() << std::endl;
     
     std::cout << "Client initialized successfully!" << std::endl;
     return true;
@@ -55,7 +131,36 @@ void MessageUClient::run() {
 
 void MessageUClient::shutdown() {
     std::cout << "Shutting down MessageU Client..." << std::endl;
-    // Cleanup logic will be implemented here
+    network_.disconnect();
+}
+
+bool MessageUClient::ensureSession() {
+    // Reuse the server session, connecting only if needed
+    if (!network_.ensureConnected()) {
+        return false;
+    }
+    if (negotiated_session_ == network_.sessionId()) {
+        return true;
+    }
+    
+    // New session: start from v1 with no features and ask for the best both sides support
+    protocol_.setProtocolVersion(ProtocolVersions::V1);
+    protocol_.setFeatures(0);
+    std::vector<uint8_t> request = protocol_.createNegotiateRequest();
+    if (!network_.sendData(request) || !network_.receiveData(response_)) {
+        std::cout << "Failed to negotiate protocol version." << std::endl;
+        network_.disconnect();
+        return false;
+    }
+    
+    // Servers without negotiation answer with an error; the session then stays on v1
+    if (protocol_.parseResponse(response_.data(), response_.size()) && protocol_.isNegotiateResponse()) {
+        protocol_.setProtocolVersion(protocol_.getNegotiatedVersion());
+        protocol_.setFeatures(protocol_.getNegotiatedFeatures());
+    }
+    
+    negotiated_session_ = network_.sessionId();
+    return true;
 }
 
 bool MessageUClient::loadServerConfig() {
@@ -92,6 +197,40 @@ bool MessageUClient::loadServerConfig() {
     return true;
 }
 
+void MessageUClient::loadClientOptions() {
+    // Optional "name=value" lines; every option has a default
+    std::ifstream file("client.info");
+    if (!file.is_open()) {
+        return;
+    }
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t equals = line.find('=');
+        if (line.empty() || line[0] == '#' || equals == std::string::npos) continue;
+        
+        std::string name = line.substr(0, equals);
+        std::string value = line.substr(equals + 1);
+        if (name == "pubkey_ttl") {
+            try {
+                public_keys_.setTtl(std::stol(value));
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid pubkey_ttl in client.info: " << value << std::endl;
+            }
+        } else if (name == "pubkey_cache") {
+            if (!value.empty()) public_keys_.enablePersistence(value);
+        } else if (name == "keypool_size") {
+            try {
+                key_pool_size_ = static_cast<size_t>(std::stoul(value));
+            } catch (const std::exception& e) {
+                std::cerr << "Invalid keypool_size in client.info: " << value << std::endl;
+            }
+        } else {
+            std::cout << "Ignoring unknown option in client.info: " << name << std::endl;
+        }
+    }
+}
+
 bool MessageUClient::loadClientConfig() {
     std::ifstream file("me.info");
     if (!file.is_open()) {
@@ -126,10 +265,15 @@ bool MessageUClient::loadClientConfig() {
         is_registered_ = true;
         std::cout << "Client config loaded: " << client_name_ << " (ID: " << client_id_ << ")" << std::endl;
         
+        if (!crypto_.openKeyStore(KEY_STORE_FILE, client_id_)) {
+            std::cout << "Warning: peer keys will not be saved across restarts" << std::endl;
+        }
+        
         // Load the private key into the crypto object if available
         if (line_count >= 4 && !private_key.empty()) {
             // Load the private key into the crypto object
             if (crypto_.loadPrivateKeyFromPEM(private_key)) {
+                client_public_key_ = crypto_.getPublicKeyPEM();
                 std::cout << "Private key loaded for decryption" << std::endl;
             } else {
                 std::cout << "Warning: Failed to load private key for decryption" << std::endl;
@@ -151,6 +295,8 @@ void MessageUClient::showMenu() {
     std::cout << "130) Request for public key" << std::endl;
     std::cout << "140) Request for waiting messages" << std::endl;
     std::cout << "150) Send a text message" << std::endl;
+    std::cout << "155) Send a text message to several recipients" << std::endl;
+    std::cout << "160) Send a file" << std::endl;
     std::cout << "0) Exit client" << std::endl;
     std::cout << "===========================" << std::endl;
 }
@@ -172,11 +318,17 @@ void MessageUClient::handleMenuChoice(int choice) {
         case 150:
             sendMessage();
             break;
+        case 155:
+            sendMessageToMany();
+            break;
+        case 160:
+            sendFile();
+            break;
         case 0:
             exitClient();
             break;
         default:
-            std::cout << "Invalid choice. Please select 110, 120, 130, 140, 150, or 0." << std::endl;
+            std::cout << "Invalid choice. Please select 110, 120, 130, 140, 150, 155, 160, or 0." << std::endl;
             break;
     }
 }
@@ -200,8 +352,12 @@ void MessageUClient::registerUser() {
         return;
     }
     
-    // Generate RSA key pair for the user
-    if (!crypto_.generateKeyPair()) {
+    // Use a key pair generated in the background; generate one here only without the pool
+    KeyPairPool::KeyPair pair;
+    if (key_pairs_.take(pair)) {
+        crypto_.useKeyPair(pair.private_key, pair.public_key);
+        std::cout << "Using RSA key pair generated in the background (" << pair.generation_ms << " ms)" << std::endl;
+    } else if (!crypto_.generateKeyPair()) {
         std::cout << "Failed to generate RSA key pair." << std::endl;
         return;
     }
@@ -212,36 +368,50 @@ void MessageUClient::registerUser() {
         return;
     }
     
-    std::cout << "Generated RSA key pair for: " << username << std::endl;
+    // Peers decode the registered key through PublicKeyCache, so it must survive the same path
+    PublicKeyCache::Entry registered;
+    registered.client_id = username;
+    registered.pem = public_key;
+    registered.fetched = 0;
+    registered.decoded = false;
+    if (!PublicKeyCache::isWellFormedPem(public_key) || !public_keys_.rsaKey(registered)) {
+        std::cout << "Public key does not decode as an RSA key; not registering." << std::endl;
+        return;
+    }
     
-    // Create registration request with PEM-formatted public key
-    std::vector<uint8_t> request = protocol_.createRegistrationRequest(username, public_key);
+    std::cout << "Generated RSA key pair for: " << username << std::endl;
     
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
         std::cout << "Failed to connect to server." << std::endl;
         return;
     }
     
-    std::cout << "Connected to server. Sending registration request..." << std::endl;
+    // Create registration request with PEM-formatted public key
+    OutgoingFrame request;
+    if (!protocol_.buildRegistrationFrame(request, username, public_key)) {
+        std::cout << "Registration request too large." << std::endl;
+        return;
+    }
+    
+    std::cout << "Sending registration request..." << std::endl;
     
     // Send registration request
-    if (!network_.sendData(request)) {
+    if (!network_.sendFrame(request)) {
         std::cout << "Failed to send registration request." << std::endl;
         network_.disconnect();
         return;
     }
     
     // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
+    if (!network_.receiveData(response_)) {
         std::cout << "Failed to receive registration response." << std::endl;
         network_.disconnect();
         return;
     }
     
     // Parse response
-    if (!protocol_.parseResponse(response)) {
+    if (!protocol_.parseResponse(response_.data(), response_.size())) {
         std::cout << "Invalid response format." << std::endl;
         network_.disconnect();
         return;
@@ -249,21 +419,16 @@ void MessageUClient::registerUser() {
     
     if (protocol_.isRegistrationSuccess()) {
         // Extract client ID from response payload
-        if (response.size() >= 9 + 16) { // header(9) + client_id(16)
-            std::string client_id;
-            for (int i = 9; i < 25; i++) {
-                if (response[i] != 0) {
-                    client_id += static_cast<char>(response[i]);
-                }
-            }
+        std::string client_id = protocol_.getRegistrationClientId();
+        if (!client_id.empty()) {
             
-            // Save to me.info file
+            // Save to me.info file; the key pair is the one just registered, one base64 line each
             std::ofstream file("me.info");
             if (file.is_open()) {
                 file << username << std::endl;
                 file << client_id << std::endl;
-                file << public_key << std::endl;
-                file << crypto_.getPrivateKeyPEM() << std::endl;  // Save private key too
+                file << pemLine(public_key) << std::endl;
+                file << pemLine(crypto_.getPrivateKeyPEM()) << std::endl;  // Save private key too
                 file.close();
                 
                 // Update internal state
@@ -271,6 +436,12 @@ void MessageUClient::registerUser() {
                 client_id_ = client_id;
                 client_public_key_ = public_key;
                 is_registered_ = true;
+                key_pairs_.stop();  // Pairs still ready are not needed now
+                
+                // Keys saved for an earlier identity are not loaded for this one
+                if (!crypto_.openKeyStore(KEY_STORE_FILE, client_id_)) {
+                    std::cout << "Warning: peer keys will not be saved across restarts" << std::endl;
+                }
                 
                 std::cout << "Registration successful!" << std::endl;
                 std::cout << "Client ID: " << client_id << std::endl;
@@ -289,8 +460,6 @@ void MessageUClient::registerUser() {
             std::cout << "Registration failed: Unknown error" << std::endl;
         }
     }
-    
-    network_.disconnect();
 }
 
 void MessageUClient::requestClientList() {
@@ -301,16 +470,16 @@ void MessageUClient::requestClientList() {
     
     std::cout << "=== Requesting Client List ===" << std::endl;
     
-    // Create request for client list
-    std::vector<uint8_t> request = protocol_.createRequestUsersRequest();
-    
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
         std::cout << "Failed to connect to server." << std::endl;
         return;
     }
     
-    std::cout << "Connected to server. Sending client list request..." << std::endl;
+    // Create request for client list
+    std::vector<uint8_t> request = protocol_.createRequestUsersRequest();
+    
+    std::cout << "Sending client list request..." << std::endl;
     
     // Send request
     if (!network_.sendData(request)) {
@@ -320,15 +489,14 @@ void MessageUClient::requestClientList() {
     }
     
     // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
+    if (!network_.receiveData(response_)) {
         std::cout << "Failed to receive client list response." << std::endl;
         network_.disconnect();
         return;
     }
     
     // Parse response
-    if (!protocol_.parseResponse(response)) {
+    if (!protocol_.parseResponse(response_.data(), response_.size())) {
         std::cout << "Invalid response format." << std::endl;
         network_.disconnect();
         return;
@@ -355,8 +523,6 @@ void MessageUClient::requestClientList() {
             std::cout << "Failed to get client list: Unknown error" << std::endl;
         }
     }
-    
-    network_.disconnect();
 }
 
 void MessageUClient::getPublicKey() {
@@ -378,16 +544,24 @@ void MessageUClient::getPublicKey() {
         return;
     }
     
-    // Create public key request
-    std::vector<uint8_t> request = protocol_.createRequestPublicKeyRequest(client_identifier);
+    // A key fetched within the TTL is shown without asking the server again
+    const PublicKeyCache::Entry* cached = public_keys_.find(client_identifier);
+    if (cached) {
+        crypto_.addPeerAlias(client_identifier, cached->client_id);
+        showPublicKey(*cached, true);
+        return;
+    }
     
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
         std::cout << "Failed to connect to server." << std::endl;
         return;
     }
     
-    std::cout << "Connected to server. Sending public key request..." << std::endl;
+    // Create public key request
+    std::vector<uint8_t> request = protocol_.createRequestPublicKeyRequest(client_identifier);
+    
+    std::cout << "Sending public key request..." << std::endl;
     
     // Send request
     if (!network_.sendData(request)) {
@@ -397,15 +571,14 @@ void MessageUClient::getPublicKey() {
     }
     
     // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
+    if (!network_.receiveData(response_)) {
         std::cout << "Failed to receive public key response." << std::endl;
         network_.disconnect();
         return;
     }
     
     // Parse response
-    if (!protocol_.parseResponse(response)) {
+    if (!protocol_.parseResponse(response_.data(), response_.size())) {
         std::cout << "Invalid response format." << std::endl;
         network_.disconnect();
         return;
@@ -417,13 +590,12 @@ void MessageUClient::getPublicKey() {
         std::string client_id = public_key_data.first;
         std::string public_key = public_key_data.second;
         
+        const PublicKeyCache::Entry* entry = nullptr;
         if (!client_id.empty() && !public_key.empty()) {
-            std::cout << "\nPublic Key Retrieved Successfully!" << std::endl;
-            std::cout << "================================" << std::endl;
-            std::cout << "Client ID: " << client_id << std::endl;
-            std::cout << "Public Key:" << std::endl;
-            std::cout << public_key << std::endl;
-            std::cout << "================================" << std::endl;
+            entry = rememberPublicKey(client_identifier, client_id, public_key);
+        }
+        if (entry) {
+            showPublicKey(*entry, false);
         } else {
             std::cout << "Invalid public key response format." << std::endl;
         }
@@ -435,8 +607,6 @@ void MessageUClient::getPublicKey() {
             std::cout << "Failed to get public key: Unknown error" << std::endl;
         }
     }
-    
-    network_.disconnect();
 }
 
 void MessageUClient::getWaitingMessages() {
@@ -447,139 +617,205 @@ void MessageUClient::getWaitingMessages() {
     
     std::cout << "=== Get Waiting Messages ===" << std::endl;
     
-    // Create request for waiting messages
-    std::vector<uint8_t> request = protocol_.createRequestMessagesRequest(client_id_);
-    
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
         std::cout << "Failed to connect to server." << std::endl;
         return;
     }
     
-    std::cout << "Connected to server. Sending waiting messages request..." << std::endl;
-    
-    // Send request
-    if (!network_.sendData(request)) {
-        std::cout << "Failed to send waiting messages request." << std::endl;
-        network_.disconnect();
-        return;
+    std::cout << "Sending waiting messages request..." << std::endl;
+    
+    // v2 servers hand out bounded pages; older ones answer with the whole inbox at once
+    bool paged = protocol_.getProtocolVersion() >= ProtocolVersions::V2;
+    uint32_t cursor = 0;
+    size_t shown = 0;
+    bool more = true;
+    std::vector<PendingMessage> pending;
+    std::vector<DecryptPipeline::Result> results;
+    decrypt_pipeline_.finish(results);  // Drop anything an interrupted earlier drain left queued
+    
+    // Records are handled frame by frame, once each frame verifies, while later frames still arrive
+    ProtocolHandler::RecordHandler on_record = [this, &shown, &pending](const MessageRecordView& message) {
+        processWaitingMessage(message, ++shown, pending);
+    };
+    
+    while (more) {
+        // Create request for the next page of waiting messages
+        std::vector<uint8_t> request = paged
+            ? protocol_.createRequestMessagesPageRequest(client_id_, cursor, MESSAGES_PAGE_COUNT, MESSAGES_PAGE_BYTES)
+            : protocol_.createRequestMessagesRequest(client_id_);
+        
+        // Send request
+        if (!network_.sendData(request)) {
+            std::cout << "Failed to send waiting messages request." << std::endl;
+            network_.disconnect();
+            return;
+        }
+        
+        // Receive and parse response in one pass
+        if (!network_.receiveStream(protocol_, on_record)) {
+            std::cout << "Failed to receive waiting messages response." << std::endl;
+            network_.disconnect();
+            return;
+        }
+        
+        if (protocol_.isMessagesPageReceived()) {
+            if (!protocol_.getMessagesPageCursor(cursor, more)) {
+                std::cout << "Invalid response format." << std::endl;
+                network_.disconnect();
+                return;
+            }
+        } else if (protocol_.isMessagesReceived()) {
+            more = false;
+        } else {
+            std::string error_msg = protocol_.getErrorMessage();
+            if (!error_msg.empty()) {
+                std::cout << "Failed to get waiting messages: " << error_msg << std::endl;
+            } else {
+                std::cout << "Failed to get waiting messages: Unknown error" << std::endl;
+            }
+            return;
+        }
+        
+        // Messages whose key may have come later in the same response; without one they are still
+        // submitted, so every message has a result to print
+        for (size_t i = 0; i < pending.size(); i++) {
+            PendingMessage& message = pending[i];
+            if (message.ticket != NO_TICKET) continue;
+            message.ticket = decrypt_pipeline_.submit(message.from_client_id,
+                                                      crypto_.findSymmetricKey(message.from_client_id),
+                                                      crypto_.peerSendsGcm(message.from_client_id),
+                                                      !protocol_.isBinaryContent(),
+                                                      message.encoded.data(), message.encoded.size());
+        }
+        
+        // Printed in the original order, however the workers finished
+        decrypt_pipeline_.finish(results);
+        for (size_t i = 0; i < pending.size(); i++) {
+            const DecryptPipeline::Result& result = results[pending[i].ticket];
+            if (result.gcm) {
+                crypto_.notePeerSendsGcm(pending[i].from_client_id);  // Our replies to them switch to GCM too
+            }
+            showWaitingMessage(pending[i], result);
+        }
+        pending.clear();
     }
     
-    // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
-        std::cout << "Failed to receive waiting messages response." << std::endl;
-        network_.disconnect();
-        return;
+    if (shown > 0) {
+        std::cout << "=================" << std::endl;
+    } else {
+        std::cout << "No waiting messages." << std::endl;
     }
-    
-    // Parse response
-    if (!protocol_.parseResponse(response)) {
-        std::cout << "Invalid response format." << std::endl;
-        network_.disconnect();
-        return;
+}
+
+void MessageUClient::processWaitingMessage(const MessageRecordView& message, size_t number,
+                                           std::vector<PendingMessage>& pending) {
+    if (number == 1) {
+        std::cout << "\nWaiting Messages:" << std::endl;
+        std::cout << "=================" << std::endl;
     }
     
-    if (protocol_.isMessagesReceived()) {
-        // Extract messages data
-        auto messages = protocol_.getMessagesData();
-        
-        if (!messages.empty()) {
-            std::cout << "\nWaiting Messages:" << std::endl;
-            std::cout << "=================" << std::endl;
-            
-            // First, process any symmetric key messages (Type 2)
-            for (size_t i = 0; i < messages.size(); i++) {
-                auto message_data = messages[i];
-                std::string from_client_id = std::get<0>(message_data);
-                uint32_t message_id = std::get<1>(message_data);
-                uint8_t message_type = std::get<2>(message_data);
-                std::string content = std::get<3>(message_data);
-                
-                if (message_type == 2) { // Symmetric key message
-                    std::cout << "Processing symmetric key from: " << from_client_id << std::endl;
-                    
-                    // Convert content string to bytes for processing
-                    std::vector<uint8_t> encrypted_key;
-                    
-                    // Decode base64 content
-                    try {
-                        std::string base64_content = content;
-                        encrypted_key = crypto_.base64Decode(base64_content);
-                    } catch (...) {
-                        // Fallback: treat as raw bytes
-                        encrypted_key = std::vector<uint8_t>(content.begin(), content.end());
-                    }
-                    
-                    // Process the symmetric key exchange message
-                    if (processSymmetricKeyMessage(from_client_id, encrypted_key)) {
-                        std::cout << "✓ Symmetric key processed successfully from " << from_client_id << std::endl;
-                    } else {
-                        std::cout << "✗ Failed to process symmetric key from " << from_client_id << std::endl;
-                    }
-                }
-            }
-            
-            // Now process regular messages (Type 1)
-            for (size_t i = 0; i < messages.size(); i++) {
-                auto message_data = messages[i];
-                std::string from_client_id = std::get<0>(message_data);
-                uint32_t message_id = std::get<1>(message_data);
-                uint8_t message_type = std::get<2>(message_data);
-                std::string content = std::get<3>(message_data);
-                std::string sender_name = std::get<4>(message_data);
-                
-                if (message_type == 1) { // Regular message
-                    // Convert content string to bytes for decryption
-                    std::vector<uint8_t> encrypted_content;
-                    
-                    // Decode base64 content
-                    try {
-                        // Simple base64 decoding (for testing)
-                        std::string base64_content = content;
-                        encrypted_content = crypto_.base64Decode(base64_content);
-                    } catch (...) {
-                        // Fallback: treat as raw bytes
-                        encrypted_content = std::vector<uint8_t>(content.begin(), content.end());
-                    }
-                    
-                    // Try to decrypt the message
-                    std::string decrypted_content;
-                    if (crypto_.hasSymmetricKey(from_client_id)) {
-                        std::vector<uint8_t> symmetric_key = crypto_.getSymmetricKey(from_client_id);
-                        std::vector<uint8_t> decrypted_bytes = crypto_.decryptAES(encrypted_content, symmetric_key);
-                        
-                        if (!decrypted_bytes.empty()) {
-                            decrypted_content = std::string(decrypted_bytes.begin(), decrypted_bytes.end());
-                        } else {
-                            decrypted_content = "[Failed to decrypt message]";
-                        }
-                    } else {
-                        decrypted_content = "[No symmetric key available for decryption]";
-                    }
-                    
-                    std::cout << "Message " << (i + 1) << ":" << std::endl;
-                    std::cout << "  From: " << sender_name << std::endl;
-                    std::cout << "  ID: " << message_id << std::endl;
-                    std::cout << "  Type: " << static_cast<int>(message_type) << std::endl;
-                    std::cout << "  Content: " << decrypted_content << std::endl;
-                    std::cout << "  ---" << std::endl;
-                }
+    // Only key, text and file chunk messages are handled
+    if (message.message_type != MessageTypes::TEXT && message.message_type != MessageTypes::SYMMETRIC_KEY &&
+        message.message_type != MessageTypes::FILE_CHUNK) return;
+    
+    std::string from_client_id = message.from_client_id.str();
+    
+    if (message.message_type == MessageTypes::SYMMETRIC_KEY) {
+        // Keys are handled right away, in order, so the texts after them can use them
+        // Servers that did not negotiate binary content send it as base64 text
+        std::vector<uint8_t> content;
+        if (protocol_.isBinaryContent()) {
+            content.assign(message.content.begin(), message.content.end());
+        } else {
+            try {
+                content = crypto_.base64Decode(message.content.data, message.content.size);
+            } catch (...) {
+                // Fallback: treat as raw bytes
+                content.assign(message.content.begin(), message.content.end());
             }
-            std::cout << "=================" << std::endl;
+        }
+        
+        std::cout << "Processing symmetric key from: " << from_client_id << std::endl;
+        
+        // Process the symmetric key exchange message
+        if (processSymmetricKeyMessage(from_client_id, content)) {
+            std::cout << "✓ Symmetric key processed successfully from " << from_client_id << std::endl;
         } else {
-            std::cout << "No waiting messages." << std::endl;
+            std::cout << "✗ Failed to process symmetric key from " << from_client_id << std::endl;
         }
-    } else {
-        std::string error_msg = protocol_.getErrorMessage();
-        if (!error_msg.empty()) {
-            std::cout << "Failed to get waiting messages: " << error_msg << std::endl;
+    } else { // Regular message or file chunk, both decrypted by the pipeline
+        PendingMessage text;
+        text.number = number;
+        text.from_client_id = from_client_id;
+        text.sender_name = message.sender_name.str();
+        text.message_id = message.message_id;
+        text.message_type = message.message_type;
+        text.ticket = NO_TICKET;
+        
+        const uint8_t* symmetric_key = crypto_.findSymmetricKey(from_client_id);
+        if (symmetric_key) {
+            // Workers start on it while later frames of the response are still arriving
+            text.ticket = decrypt_pipeline_.submit(from_client_id, symmetric_key, crypto_.peerSendsGcm(from_client_id),
+                                                   !protocol_.isBinaryContent(),
+                                                   message.content.data, message.content.size);
         } else {
-            std::cout << "Failed to get waiting messages: Unknown error" << std::endl;
+            // Its key may still be on the way; keep a copy until the page is complete
+            text.encoded.assign(message.content.begin(), message.content.end());
         }
+        pending.push_back(std::move(text));
+    }
+}
+
+void MessageUClient::showWaitingMessage(const PendingMessage& message, const DecryptPipeline::Result& result) {
+    if (message.message_type == MessageTypes::FILE_CHUNK) {
+        storeFileChunk(message, result);
+        return;
     }
     
-    network_.disconnect();
+    std::string decrypted_content;
+    if (!result.has_key) {
+        decrypted_content = "[No symmetric key available for decryption]";
+    } else if (result.decrypted && !result.plaintext.empty()) {
+        decrypted_content.assign(result.plaintext.begin(), result.plaintext.end());
+    } else {
+        decrypted_content = "[Failed to decrypt message]";
+    }
+    
+    std::cout << "Message " << message.number << ":" << std::endl;
+    std::cout << "  From: " << message.sender_name << std::endl;
+    std::cout << "  ID: " << message.message_id << std::endl;
+    std::cout << "  Type: " << static_cast<int>(message.message_type) << std::endl;
+    std::cout << "  Content: " << decrypted_content << std::endl;
+    std::cout << "  ---" << std::endl;
+    
+    // The printed copy goes the same way as the SecureBuffer it came from
+    SecureArena::wipe(&decrypted_content[0], decrypted_content.size());
+}
+
+void MessageUClient::storeFileChunk(const PendingMessage& message, const DecryptPipeline::Result& result) {
+    if (!result.has_key || !result.decrypted) {
+        std::cout << "✗ File chunk from " << message.sender_name << " (message " << message.message_id << "): "
+                  << (result.has_key ? "failed to decrypt" : "no symmetric key available") << std::endl;
+        return;
+    }
+    
+    // Written straight to disk; the plaintext goes away with this page's results
+    FileAssembler::Status status;
+    FileAssembler::Outcome outcome = received_files_.accept(message.from_client_id, result.plaintext.data(),
+                                                            result.plaintext.size(), status);
+    if (outcome == FileAssembler::CHUNK_REJECTED) {
+        std::cout << "✗ File chunk " << status.index + 1 << "/" << status.count << " from " << message.sender_name
+                  << " rejected: " << status.error << std::endl;
+    } else if (outcome == FileAssembler::FILE_COMPLETE) {
+        std::cout << "✓ Received file from " << message.sender_name << ": " << status.path
+                  << " (" << status.file_size << " bytes)" << std::endl;
+    } else if (outcome == FileAssembler::CHUNK_STORED && status.received == 1) {
+        // After a resume the first chunk here need not be chunk 0, so the name may not be known yet
+        std::cout << "Receiving file from " << message.sender_name
+                  << (status.name.empty() ? std::string() : ": " + status.name)
+                  << " (" << status.file_size << " bytes in " << status.count << " chunks)..." << std::endl;
+    }
 }
 
 void MessageUClient::sendMessage() {
@@ -601,18 +837,54 @@ void MessageUClient::sendMessage() {
         return;
     }
     
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
+        std::cout << "Failed to connect to server." << std::endl;
+        return;
+    }
+    
     // Check if we have a symmetric key for this recipient
+    std::vector<uint8_t> encrypted_key;  // Set when the key travels with the message
+    
+    // A key created for the compound request is dropped again unless the server stored it
+    auto discard_new_key = [this, &encrypted_key, &recipient]() {
+        if (!encrypted_key.empty()) crypto_.removeSymmetricKey(recipient);
+    };
     if (!crypto_.hasSymmetricKey(recipient)) {
         std::cout << "No symmetric key found for recipient: " << recipient << std::endl;
-        std::cout << "Initiating key exchange..." << std::endl;
         
-        // Send symmetric key (this will also get the public key)
-        if (!sendSymmetricKey(recipient)) {
-            std::cout << "Failed to send symmetric key. Cannot send message." << std::endl;
-            return;
+        if (protocol_.getFeatures() & ProtocolFeatures::SEND_WITH_KEY) {
+            // Key and message go in one request; only an unknown public key costs another round trip
+            const PublicKeyCache::Entry* known = getPublicKeyForRecipient(recipient);
+            if (!known) {
+                std::cout << "Failed to get recipient's public key. Cannot send message." << std::endl;
+                return;
+            }
+            
+            // A nickname may resolve to a peer whose key was saved in an earlier run
+            if (!crypto_.hasSymmetricKey(recipient)) {
+                const CryptoPP::RSA::PublicKey* rsa_key = public_keys_.rsaKey(*known);
+                if (!rsa_key) {
+                    std::cout << "Recipient's public key is not a valid RSA key. Cannot send message." << std::endl;
+                    return;
+                }
+                encrypted_key = crypto_.createKeyExchangeMessage(recipient, *rsa_key);
+                if (encrypted_key.empty()) {
+                    std::cout << "Failed to create key exchange message." << std::endl;
+                    return;
+                }
+            }
+        } else {
+            std::cout << "Initiating key exchange..." << std::endl;
+            
+            // Send symmetric key (this will also get the public key)
+            if (!sendSymmetricKey(recipient)) {
+                std::cout << "Failed to send symmetric key. Cannot send message." << std::endl;
+                return;
+            }
+            
+            std::cout << "Key exchange completed successfully!" << std::endl;
         }
-        
-        std::cout << "Key exchange completed successfully!" << std::endl;
     }
     
     // Get message content from user
@@ -622,61 +894,65 @@ void MessageUClient::sendMessage() {
     
     if (message_content.empty()) {
         std::cout << "Message content cannot be empty." << std::endl;
+        discard_new_key();
         return;
     }
     
     // Convert message content to bytes
     std::vector<uint8_t> message_bytes(message_content.begin(), message_content.end());
     
-    // Encrypt the message with the symmetric key
-    std::vector<uint8_t> symmetric_key = crypto_.getSymmetricKey(recipient);
-    if (symmetric_key.empty()) {
-        std::cout << "Failed to get symmetric key for encryption." << std::endl;
-        return;
-    }
-    
-    std::vector<uint8_t> encrypted_message = crypto_.encryptAES(message_bytes, symmetric_key);
-    if (encrypted_message.empty()) {
+    // Encrypt the message with the recipient's cached cipher context
+    std::vector<uint8_t> encrypted_message;
+    if (!crypto_.encryptForPeer(recipient, message_bytes.data(), message_bytes.size(), encrypted_message)) {
         std::cout << "Failed to encrypt message." << std::endl;
+        discard_new_key();
         return;
     }
     
     std::cout << "Message encrypted successfully." << std::endl;
     
-    // Create send message request with encrypted content
-    std::vector<uint8_t> request = protocol_.createSendMessageRequest(client_id_, recipient, encrypted_message);
-    
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
-        std::cout << "Failed to connect to server." << std::endl;
+    // Create send message request with encrypted content, and the new key if there is one
+    OutgoingFrame request;
+    bool built = encrypted_key.empty()
+        ? protocol_.buildSendMessageFrame(request, client_id_, recipient, encrypted_message)
+        : protocol_.buildSendWithKeyFrame(request, client_id_, recipient, encrypted_key, encrypted_message);
+    if (!built) {
+        std::cout << "Message too large for this server." << std::endl;
+        discard_new_key();
         return;
     }
     
-    std::cout << "Connected to server. Sending encrypted message..." << std::endl;
+    std::cout << "Sending encrypted message..." << std::endl;
     
     // Send request
-    if (!network_.sendData(request)) {
+    if (!network_.sendFrame(request)) {
         std::cout << "Failed to send message request." << std::endl;
         network_.disconnect();
+        discard_new_key();
         return;
     }
     
     // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
+    if (!network_.receiveData(response_)) {
         std::cout << "Failed to receive send message response." << std::endl;
         network_.disconnect();
+        discard_new_key();
         return;
     }
     
     // Parse response
-    if (!protocol_.parseResponse(response)) {
+    if (!protocol_.parseResponse(response_.data(), response_.size())) {
         std::cout << "Invalid response format." << std::endl;
         network_.disconnect();
+        discard_new_key();
         return;
     }
     
-    if (protocol_.isSendMessageSuccess()) {
+    if (protocol_.isSendWithKeySuccess()) {
+        // Replies come from the resolved client ID; the key is already filed under it
+        crypto_.addPeerAlias(recipient, protocol_.getSendWithKeyClientId());
+        std::cout << "✓ Key exchange completed and encrypted message sent successfully!" << std::endl;
+    } else if (protocol_.isSendMessageSuccess()) {
         std::string success_msg = protocol_.getErrorMessage(); // This actually gets the success message
         if (!success_msg.empty()) {
             std::cout << "✓ " << success_msg << std::endl;
@@ -684,6 +960,9 @@ void MessageUClient::sendMessage() {
             std::cout << "✓ Encrypted message sent successfully!" << std::endl;
         }
     } else {
+        // Neither the key nor the message was stored, so the next send exchanges a key again
+        discard_new_key();
+        
         std::string error_msg = protocol_.getErrorMessage();
         if (!error_msg.empty()) {
             std::cout << "✗ Failed to send message: " << error_msg << std::endl;
@@ -691,8 +970,471 @@ void MessageUClient::sendMessage() {
             std::cout << "✗ Failed to send message: Unknown error" << std::endl;
         }
     }
+}
+
+void MessageUClient::sendMessageToMany() {
+    if (!is_registered_) {
+        std::cout << "Must register first before sending messages." << std::endl;
+        return;
+    }
     
-    network_.disconnect();
+    std::cout << "=== Send Message to Several Recipients ===" << std::endl;
+    
+    // Get comma-separated recipients from user
+    std::string recipient_list;
+    std::cout << "Enter recipient IDs or nicknames, separated by commas: ";
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+    std::getline(std::cin, recipient_list);
+    
+    std::vector<std::string> recipients;
+    std::stringstream list_stream(recipient_list);
+    std::string recipient;
+    while (std::getline(list_stream, recipient, ',')) {
+        size_t first = recipient.find_first_not_of(" \t");
+        if (first == std::string::npos) continue;
+        size_t last = recipient.find_last_not_of(" \t");
+        recipients.push_back(recipient.substr(first, last - first + 1));
+    }
+    
+    if (recipients.empty()) {
+        std::cout << "Recipient cannot be empty." << std::endl;
+        return;
+    }
+    
+    // Get message content from user
+    std::string message_content;
+    std::cout << "Enter message content: ";
+    std::getline(std::cin, message_content);
+    
+    if (message_content.empty()) {
+        std::cout << "Message content cannot be empty." << std::endl;
+        return;
+    }
+    
+    std::vector<uint8_t> message_bytes(message_content.begin(), message_content.end());
+    
+    // Encrypt once per recipient, exchanging keys first where needed
+    std::vector<BatchMessage> messages;
+    for (size_t i = 0; i < recipients.size(); i++) {
+        if (!crypto_.hasSymmetricKey(recipients[i])) {
+            std::cout << "No symmetric key found for recipient: " << recipients[i] << std::endl;
+            std::cout << "Initiating key exchange..." << std::endl;
+            if (!sendSymmetricKey(recipients[i])) {
+                std::cout << "✗ " << recipients[i] << ": key exchange failed, skipped" << std::endl;
+                continue;
+            }
+        }
+        
+        BatchMessage message;
+        message.recipient = recipients[i];
+        if (!crypto_.encryptForPeer(recipients[i], message_bytes.data(), message_bytes.size(), message.message)) {
+            std::cout << "✗ " << recipients[i] << ": failed to encrypt message, skipped" << std::endl;
+            continue;
+        }
+        messages.push_back(message);
+    }
+    
+    if (messages.empty()) {
+        std::cout << "No messages to send." << std::endl;
+        return;
+    }
+    
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
+        std::cout << "Failed to connect to server." << std::endl;
+        return;
+    }
+    
+    // Servers without batch support get one request per message
+    if (!(protocol_.getFeatures() & ProtocolFeatures::BATCH_SEND)) {
+        for (size_t i = 0; i < messages.size(); i++) {
+            std::vector<uint8_t> request = protocol_.createSendMessageRequest(client_id_, messages[i].recipient,
+                                                                              messages[i].message);
+            if (request.empty()) {
+                std::cout << "✗ " << messages[i].recipient << ": message too large for this server" << std::endl;
+                continue;
+            }
+            if (!network_.sendData(request) || !network_.receiveData(response_) ||
+                !protocol_.parseResponse(response_.data(), response_.size())) {
+                std::cout << "Failed to send message to " << messages[i].recipient << "." << std::endl;
+                network_.disconnect();
+                return;
+            }
+            
+            if (protocol_.isSendMessageSuccess()) {
+                std::cout << "✓ " << messages[i].recipient << ": sent" << std::endl;
+            } else {
+                std::cout << "✗ " << messages[i].recipient << ": " << protocol_.getErrorMessage() << std::endl;
+            }
+        }
+        return;
+    }
+    
+    // Split into batches the server accepts and the frame version can carry
+    size_t byte_budget = protocol_.getProtocolVersion() == ProtocolVersions::V1
+        ? ProtocolSizes::MAX_PAYLOAD_V1 - ProtocolSizes::CLIENT_ID_SIZE - 4
+        : SEND_BATCH_BYTES;
+    size_t sent = 0;
+    size_t start = 0;
+    while (start < messages.size()) {
+        size_t end = start;
+        size_t batch_bytes = 0;
+        while (end < messages.size() && end - start < ProtocolSizes::MAX_BATCH_ENTRIES) {
+            size_t entry_bytes = ProtocolHandler::batchEntrySize(messages[end]);
+            if (end > start && batch_bytes + entry_bytes > byte_budget) break;
+            batch_bytes += entry_bytes;
+            end++;
+        }
+        
+        std::vector<BatchMessage> batch(messages.begin() + start, messages.begin() + end);
+        std::cout << "Sending batch of " << batch.size() << " encrypted messages..." << std::endl;
+        
+        // Send request and receive the per-entry statuses
+        std::vector<uint8_t> request = protocol_.createSendMessageBatchRequest(client_id_, batch);
+        if (request.empty()) {
+            std::cout << "Failed to create batch request: payload too large." << std::endl;
+            return;
+        }
+        if (!network_.sendData(request) || !network_.receiveData(response_)) {
+            std::cout << "Failed to send message batch." << std::endl;
+            network_.disconnect();
+            return;
+        }
+        
+        if (!protocol_.parseResponse(response_.data(), response_.size())) {
+            std::cout << "Invalid response format." << std::endl;
+            network_.disconnect();
+            return;
+        }
+        
+        if (!protocol_.isSendMessageBatchResponse()) {
+            std::cout << "✗ Failed to send message batch: " << protocol_.getErrorMessage() << std::endl;
+            return;
+        }
+        
+        std::vector<uint8_t> statuses = protocol_.getSendMessageBatchStatus();
+        if (statuses.size() != batch.size()) {
+            std::cout << "Invalid response format." << std::endl;
+            network_.disconnect();
+            return;
+        }
+        
+        for (size_t i = 0; i < batch.size(); i++) {
+            std::cout << (statuses[i] == BatchStatus::STORED ? "✓ " : "✗ ") << batch[i].recipient << ": "
+                      << batchStatusText(statuses[i]) << std::endl;
+            if (statuses[i] == BatchStatus::STORED) sent++;
+        }
+        start = end;
+    }
+    
+    std::cout << "Sent " << sent << " of " << messages.size() << " messages." << std::endl;
+}
+
+void MessageUClient::sendFile() {
+    if (!is_registered_) {
+        std::cout << "Must register first before sending messages." << std::endl;
+        return;
+    }
+    
+    std::cout << "=== Send File ===" << std::endl;
+    
+    std::string recipient;
+    std::cout << "Enter recipient ID or nickname: ";
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer
+    std::getline(std::cin, recipient);
+    
+    if (recipient.empty()) {
+        std::cout << "Recipient cannot be empty." << std::endl;
+        return;
+    }
+    
+    std::string path;
+    std::cout << "Enter file path: ";
+    std::getline(std::cin, path);
+    
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
+        std::cout << "Failed to connect to server." << std::endl;
+        return;
+    }
+    
+    if (!(protocol_.getFeatures() & ProtocolFeatures::FILE_CHUNKS)) {
+        std::cout << "The server does not support file transfers." << std::endl;
+        return;
+    }
+    
+    if (!crypto_.hasSymmetricKey(recipient)) {
+        std::cout << "No symmetric key found for recipient: " << recipient << std::endl;
+        std::cout << "Initiating key exchange..." << std::endl;
+        if (!sendSymmetricKey(recipient)) {
+            std::cout << "Failed to send symmetric key. Cannot send file." << std::endl;
+            return;
+        }
+    }
+    
+    const uint8_t* key = crypto_.findSymmetricKey(recipient);
+    if (!key) {
+        std::cout << "No symmetric key found for recipient: " << recipient << std::endl;
+        return;
+    }
+    
+    // Sending the same file again after a failure reuses the nonce, so the chunk IDs repeat
+    // and the server can say which chunks it already holds
+    std::string transfer_key = recipient + "\t" + path;
+    std::map<std::string, uint64_t>::const_iterator unfinished = unfinished_transfers_.find(transfer_key);
+    bool resuming = unfinished != unfinished_transfers_.end();
+    uint64_t nonce = resuming ? unfinished->second : crypto_.generateRandomId();
+    
+    TransferManifest manifest;
+    std::string error;
+    if (!manifest.build(path, key, AesContext::KEY_SIZE, nonce, error)) {
+        std::cout << "✗ Cannot send file: " << error << std::endl;
+        return;
+    }
+    if (!resuming) {
+        unfinished_transfers_[transfer_key] = nonce;
+        saveUnfinishedTransfers();
+    }
+    
+    std::cout << (resuming ? "Resuming " : "Sending ") << manifest.name() << " (" << manifest.fileSize()
+              << " bytes in " << manifest.chunkCount() << " chunks)..." << std::endl;
+    
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    TransferOutcome outcome = TRANSFER_RETRY;
+    for (unsigned attempt = 0; attempt < FILE_SEND_ATTEMPTS && outcome == TRANSFER_RETRY; attempt++) {
+        if (attempt > 0) {
+            unsigned delay = 1u << (attempt - 1);
+            std::cout << "Connection lost (" << error << "), retrying in " << delay << " s..." << std::endl;
+            std::this_thread::sleep_for(std::chrono::seconds(delay));
+            if (!ensureSession()) {
+                error = "failed to connect to server";
+                continue;
+            }
+            if (!(protocol_.getFeatures() & ProtocolFeatures::FILE_CHUNKS)) {
+                error = "the server no longer supports file transfers";
+                outcome = TRANSFER_FAILED;
+                break;
+            }
+        }
+        
+        // A fresh send has nothing stored yet; anything else asks before sending
+        std::vector<bool> stored(manifest.chunkCount(), false);
+        if (resuming || attempt > 0) {
+            outcome = queryStoredChunks(recipient, manifest, stored, error);
+            if (outcome != TRANSFER_DONE) continue;
+        }
+        outcome = sendFileChunks(recipient, path, manifest, stored, sent, error);
+    }
+    
+    if (outcome != TRANSFER_DONE) {
+        std::cout << "✗ File transfer stopped after sending " << sent << " chunks: " << error << std::endl;
+        std::cout << "Send the file again to resume." << std::endl;
+        return;
+    }
+    unfinished_transfers_.erase(transfer_key);
+    saveUnfinishedTransfers();
+    
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "✓ Sent " << manifest.name() << " to " << recipient << ": " << sent << " chunks sent, "
+              << manifest.chunkCount() - sent << " already on the server ("
+              << (seconds > 0 ? manifest.fileSize() / seconds / (1024 * 1024) : 0) << " MB/s)" << std::endl;
+}
+
+MessageUClient::TransferOutcome MessageUClient::queryStoredChunks(const std::string& recipient,
+                                                                  const TransferManifest& manifest,
+                                                                  std::vector<bool>& stored, std::string& error) {
+    const std::vector<uint8_t>& ids = manifest.chunkIds();
+    for (uint32_t start = 0; start < manifest.chunkCount(); start += ProtocolSizes::MAX_CHUNK_QUERY) {
+        uint32_t count = std::min(manifest.chunkCount() - start, ProtocolSizes::MAX_CHUNK_QUERY);
+        std::vector<uint8_t> batch(ids.begin() + static_cast<size_t>(start) * FileChunk::ID_SIZE,
+                                   ids.begin() + static_cast<size_t>(start + count) * FileChunk::ID_SIZE);
+        
+        std::vector<uint8_t> request = protocol_.createQueryFileChunksRequest(client_id_, recipient, batch);
+        if (!network_.sendData(request) || !network_.receiveData(response_)) {
+            error = "connection lost";
+            network_.disconnect();
+            return TRANSFER_RETRY;
+        }
+        
+        if (!protocol_.parseResponse(response_.data(), response_.size())) {
+            error = "invalid response format";
+            network_.disconnect();
+            return TRANSFER_RETRY;
+        }
+        
+        if (!protocol_.isFileChunksResponse()) {
+            error = protocol_.getErrorMessage();
+            return TRANSFER_FAILED;
+        }
+        
+        std::vector<uint8_t> statuses = protocol_.getFileChunksStatus();
+        if (statuses.size() != count) {
+            error = "invalid response format";
+            network_.disconnect();
+            return TRANSFER_RETRY;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            stored[start + i] = statuses[i] != 0;
+        }
+    }
+    return TRANSFER_DONE;
+}
+
+MessageUClient::TransferOutcome MessageUClient::sendFileChunks(const std::string& recipient, const std::string& path,
+                                                               const TransferManifest& manifest,
+                                                               const std::vector<bool>& stored, size_t& sent,
+                                                               std::string& error) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        error = "cannot open " + path;
+        return TRANSFER_FAILED;
+    }
+    
+    FileChunk::Header header;
+    header.transfer_id = manifest.transferId();
+    header.count = manifest.chunkCount();
+    header.file_size = manifest.fileSize();
+    header.name = manifest.name();
+    
+    // One plaintext and one ciphertext buffer for the whole file; each request owns its copy
+    // only while in flight, and at most FILE_SEND_WINDOW are
+    std::vector<uint8_t> plaintext(FileChunk::MAX_HEADER_SIZE + FileChunk::DATA_SIZE);
+    std::vector<uint8_t> encrypted;
+    std::atomic<size_t> acknowledged(0);
+    std::atomic<bool> failed(false);
+    std::atomic<bool> lost(false);
+    std::string failure;  // Written once by the first failure, read after waitForPending()
+    
+    // Responses arrive on the network thread, in request order; they are checked as parseResponse does
+    ClientNetwork::ResponseHandler on_response = [&acknowledged, &failed, &lost, &failure](bool success,
+                                                                                           std::vector<uint8_t>& response) {
+        FrameHeader frame;
+        if (success && ProtocolHandler::verifyResponse(response.data(), response.size(), frame)) {
+            if (frame.code == ProtocolCodes::SEND_MESSAGE_SUCCESS) {
+                ++acknowledged;
+                return;
+            }
+            if (!failed.exchange(true)) {
+                failure.assign(response.begin() + frame.header_size,
+                               response.begin() + frame.header_size + frame.payload_size);
+            }
+        } else if (!failed.exchange(true)) {
+            lost = true;
+            failure = success ? "invalid response format" : "connection lost";
+        }
+    };
+    
+    for (uint32_t index = 0; index < header.count && !failed; index++) {
+        if (stored[index]) continue;
+        
+        header.index = index;
+        size_t header_size = FileChunk::encodeHeader(header, plaintext.data());
+        size_t data_size = FileChunk::dataSize(header.file_size, index);
+        uint8_t* data = plaintext.data() + header_size;
+        
+        file.seekg(static_cast<std::streamoff>(static_cast<uint64_t>(index) * FileChunk::DATA_SIZE));
+        if (!file.read(reinterpret_cast<char*>(data), data_size)) {
+            if (!failed.exchange(true)) failure = "failed to read " + path;
+            break;
+        }
+        
+        // Chunks already stored came from the file as it was; a changed file must not be spliced onto them
+        if (!manifest.matches(index, data, data_size)) {
+            if (!failed.exchange(true)) failure = path + " changed during the transfer";
+            break;
+        }
+        if (!crypto_.encryptForPeer(recipient, plaintext.data(), header_size + data_size, encrypted)) {
+            if (!failed.exchange(true)) failure = "failed to encrypt chunk";
+            break;
+        }
+        
+        // Chunks are pipelined, but no more than the window are queued or awaiting a response
+        network_.waitForPending(FILE_SEND_WINDOW - 1);
+        std::vector<uint8_t> request = protocol_.createSendFileChunkRequest(client_id_, recipient,
+                                                                            manifest.chunkId(index), encrypted);
+        if (request.empty()) {
+            if (!failed.exchange(true)) failure = "chunk request too large for this server";
+            break;
+        }
+        if (!network_.sendRequestAsync(request, on_response)) {
+            if (!failed.exchange(true)) {
+                lost = true;
+                failure = "failed to connect to server";
+            }
+            break;
+        }
+    }
+    network_.waitForPending();
+    
+    sent += acknowledged;
+    if (!failed) return TRANSFER_DONE;
+    if (lost) network_.disconnect();  // A corrupt response leaves the session untrusted, as elsewhere
+    error = failure;
+    return lost ? TRANSFER_RETRY : TRANSFER_FAILED;
+}
+
+void MessageUClient::loadUnfinishedTransfers() {
+    std::ifstream file(TRANSFERS_FILE);
+    if (!file.is_open()) return;  // No send was left unfinished
+    
+    // Lines: "<nonce, 16 hex digits>\t<recipient>\t<path>"
+    std::string line;
+    while (std::getline(file, line)) {
+        std::string::size_type tab = line.find('\t');
+        if (tab != 16 || line.find('\t', tab + 1) == std::string::npos) continue;
+        
+        std::string digits = line.substr(0, tab);
+        char* end = nullptr;
+        uint64_t nonce = std::strtoull(digits.c_str(), &end, 16);
+        if (*end != '\0') continue;
+        unfinished_transfers_[line.substr(tab + 1)] = nonce;
+    }
+    if (!unfinished_transfers_.empty()) {
+        std::cout << "Unfinished file sends: " << unfinished_transfers_.size()
+                  << " (send the same file again to resume)" << std::endl;
+    }
+}
+
+bool MessageUClient::saveUnfinishedTransfers() const {
+    if (unfinished_transfers_.empty()) {
+        std::remove(TRANSFERS_FILE);
+        return true;
+    }
+    
+    // Rewritten through a temporary file, so a crash leaves the old list or the new one
+    std::string temp_path = std::string(TRANSFERS_FILE) + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Cannot write " << temp_path << std::endl;
+            return false;
+        }
+        for (std::map<std::string, uint64_t>::const_iterator it = unfinished_transfers_.begin();
+             it != unfinished_transfers_.end(); ++it) {
+            if (it->first.find('\n') != std::string::npos) continue;  // Such a path resumes only in this run
+            file << std::hex << std::setw(16) << std::setfill('0') << it->second << std::dec
+                 << '\t' << it->first << '\n';
+        }
+        if (!file.flush()) {
+            std::cerr << "Cannot write " << temp_path << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(temp_path.c_str(), TRANSFERS_FILE) != 0) {
+        std::cerr << "Cannot replace " << TRANSFERS_FILE << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void MessageUClient::showPublicKey(const PublicKeyCache::Entry& entry, bool cached) {
+    std::cout << "\nPublic Key Retrieved Successfully!" << (cached ? " (cached)" : "") << std::endl;
+    std::cout << "================================" << std::endl;
+    std::cout << "Client ID: " << entry.client_id << std::endl;
+    std::cout << "Public Key:" << std::endl;
+    std::cout << entry.pem << std::endl;
+    std::cout << "================================" << std::endl;
 }
 
 void MessageUClient::exitClient() {
@@ -700,36 +1442,42 @@ void MessageUClient::exitClient() {
     std::cout << "Goodbye!" << std::endl;
 }
 
-bool MessageUClient::getPublicKeyForRecipient(const std::string& recipient) {
-    // Create public key request
-    std::vector<uint8_t> request = protocol_.createRequestPublicKeyRequest(recipient);
+const PublicKeyCache::Entry* MessageUClient::getPublicKeyForRecipient(const std::string& recipient) {
+    // A key fetched within the TTL saves the round trip
+    const PublicKeyCache::Entry* cached = public_keys_.find(recipient);
+    if (cached) {
+        crypto_.addPeerAlias(recipient, cached->client_id);
+        return cached;
+    }
     
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
         std::cout << "Failed to connect to server for public key request." << std::endl;
-        return false;
+        return nullptr;
     }
     
+    // Create public key request
+    std::vector<uint8_t> request = protocol_.createRequestPublicKeyRequest(recipient);
+    
     // Send request
     if (!network_.sendData(request)) {
         std::cout << "Failed to send public key request." << std::endl;
         network_.disconnect();
-        return false;
+        return nullptr;
     }
     
     // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
+    if (!network_.receiveData(response_)) {
         std::cout << "Failed to receive public key response." << std::endl;
         network_.disconnect();
-        return false;
+        return nullptr;
     }
     
     // Parse response
-    if (!protocol_.parseResponse(response)) {
+    if (!protocol_.parseResponse(response_.data(), response_.size())) {
         std::cout << "Invalid public key response format." << std::endl;
         network_.disconnect();
-        return false;
+        return nullptr;
     }
     
     if (protocol_.isPublicKeyReceived()) {
@@ -737,72 +1485,86 @@ bool MessageUClient::getPublicKeyForRecipient(const std::string& recipient) {
         std::string client_id = public_key_data.first;
         std::string public_key = public_key_data.second;
         
+        const PublicKeyCache::Entry* entry = nullptr;
         if (!client_id.empty() && !public_key.empty()) {
+            entry = rememberPublicKey(recipient, client_id, public_key);
+        }
+        if (entry) {
             std::cout << "Received public key for: " << client_id << std::endl;
-            network_.disconnect();
-            return true;
+            return entry;
         } else {
             std::cout << "Invalid public key response format." << std::endl;
             network_.disconnect();
-            return false;
+            return nullptr;
         }
     } else {
         std::string error_msg = protocol_.getErrorMessage();
         std::cout << "Failed to get public key: " << error_msg << std::endl;
-        network_.disconnect();
-        return false;
+        return nullptr;
     }
 }
 
+const PublicKeyCache::Entry* MessageUClient::rememberPublicKey(const std::string& identifier,
+                                                              const std::string& client_id,
+                                                              const std::string& public_key) {
+    if (!public_keys_.put(identifier, client_id, public_key)) {
+        return nullptr;
+    }
+    crypto_.addPeerAlias(identifier, client_id);  // Keys are filed by client ID, whichever name was typed
+    return public_keys_.find(client_id);
+}
+
 bool MessageUClient::sendSymmetricKey(const std::string& recipient) {
-    // Get recipient's public key first
-    if (!getPublicKeyForRecipient(recipient)) {
+    // Get recipient's public key first, from the cache when it is fresh
+    const PublicKeyCache::Entry* recipient_key = getPublicKeyForRecipient(recipient);
+    if (!recipient_key) {
         std::cout << "Failed to get recipient's public key for key exchange." << std::endl;
         return false;
     }
     
-    // Get the public key from the last response
-    auto public_key_data = protocol_.getPublicKeyData();
-    std::string recipient_public_key = public_key_data.second;
-    
-    if (recipient_public_key.empty()) {
-        std::cout << "Failed to get recipient's public key." << std::endl;
+    // Decoded once per cached key, not once per exchange
+    const CryptoPP::RSA::PublicKey* recipient_public_key = public_keys_.rsaKey(*recipient_key);
+    if (!recipient_public_key) {
+        std::cout << "Recipient's public key is not a valid RSA key." << std::endl;
         return false;
     }
     
     // Create symmetric key exchange message
-    std::vector<uint8_t> encrypted_key = crypto_.createKeyExchangeMessage(recipient, recipient_public_key);
+    std::vector<uint8_t> encrypted_key = crypto_.createKeyExchangeMessage(recipient, *recipient_public_key);
     if (encrypted_key.empty()) {
         std::cout << "Failed to create key exchange message." << std::endl;
         return false;
     }
     
-    // Create symmetric key request
-    std::vector<uint8_t> request = protocol_.createSendSymmetricKeyRequest(client_id_, recipient, encrypted_key);
-    
-    // Connect to server
-    if (!network_.connect(server_ip_, server_port_)) {
+    // Reuse the server session; requests are framed for its negotiated version
+    if (!ensureSession()) {
         std::cout << "Failed to connect to server for key exchange." << std::endl;
         return false;
     }
     
+    // Create symmetric key request
+    OutgoingFrame request;
+    if (!protocol_.buildSendSymmetricKeyFrame(request, client_id_, recipient, encrypted_key)) {
+        std::cout << "Symmetric key request too large." << std::endl;
+        return false;
+    }
+    
     // Send request
-    if (!network_.sendData(request)) {
+    if (!network_.sendFrame(request)) {
         std::cout << "Failed to send symmetric key." << std::endl;
         network_.disconnect();
         return false;
     }
     
     // Receive response
-    std::vector<uint8_t> response;
-    if (!network_.receiveData(response)) {
+    if (!network_.receiveData(response_)) {
         std::cout << "Failed to receive key exchange response." << std::endl;
         network_.disconnect();
         return false;
     }
     
     // Parse response
-    if (!protocol_.parseResponse(response)) {
+    if (!protocol_.parseResponse(response_.data(), response_.size())) {
         std::cout << "Invalid key exchange response format." << std::endl;
         network_.disconnect();
         return false;
@@ -810,12 +1572,10 @@ bool MessageUClient::sendSymmetricKey(const std::string& recipient) {
     
     if (protocol_.isSymmetricKeyReceived()) {
         std::cout << "Symmetric key sent successfully!" << std::endl;
-        network_.disconnect();
         return true;
     } else {
         std::string error_msg = protocol_.getErrorMessage();
         std::cout << "Failed to send symmetric key: " << error_msg << std::endl;
-        network_.disconnect();
         return false;
     }
 }
@@ -3,25 +3,32 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include "ClientNetwork.h"
 #include "ClientCrypto.h"
 #include "ProtocolHandler.h"
+#include "DecryptPipeline.h"
+#include "PublicKeyCache.h"
+#include "KeyPairPool.h"
+#include "FileTransfer.h"
 
 /**
  * MessageU Client - Main client application
  * 
  * Features:
- * - User registration with RSA key generation
+ * - User registration with RSA key generation, done ahead of time in the background
  * - End-to-end encrypted messaging
  * - Automatic key exchange and management
  * - Client discovery and public key retrieval
  * - Secure message storage and retrieval
+ * - File attachments streamed in encrypted chunks, in and out, with bounded memory
  */
 class MessageUClient {
 private:
     ClientNetwork network_;
     ClientCrypto crypto_;
     ProtocolHandler protocol_;
+    BufferPool::Lease response_;  // Last response, viewed by protocol_ until the next receive
     
     // Configuration data
     std::string server_ip_;
@@ -34,23 +41,61 @@ private:
     // State
     bool is_registered_;
     bool is_connected_;
+    unsigned negotiated_session_;  // Session whose protocol version was negotiated (0 = none)
+    PublicKeyCache public_keys_;  // Recipients' public keys from earlier responses, by client ID or nickname
+    DecryptPipeline decrypt_pipeline_;  // Decodes and decrypts waiting text messages on all cores
+    size_t key_pool_size_;              // Key pairs to keep ready before registration (0 = generate on demand)
+    KeyPairPool key_pairs_;             // Started at initialize() while unregistered, stopped once registered
+    FileAssembler received_files_;      // Incoming attachments, written to disk chunk by chunk
+    std::map<std::string, uint64_t> unfinished_transfers_;  // Recipient + path -> nonce of a send that did not finish; saved in me.transfers
+    
+    // Text message of the current page, printed in order once the page is decrypted
+    struct PendingMessage {
+        size_t number;
+        std::string from_client_id;
+        std::string sender_name;
+        uint32_t message_id;
+        uint8_t message_type;
+        size_t ticket;                   // DecryptPipeline ticket, NO_TICKET until submitted
+        std::vector<uint8_t> encoded;    // Content as received, held until its key (possibly later in the page) is known
+    };
+    static const size_t NO_TICKET = static_cast<size_t>(-1);
     
     // Private methods
     bool loadServerConfig();
+    void loadClientOptions();
     bool loadClientConfig();
+    bool ensureSession();
     void showMenu();
     void handleMenuChoice(int choice);
     // Menu options
     void registerUser();
     void requestClientList();
     void getPublicKey();
+    void showPublicKey(const PublicKeyCache::Entry& entry, bool cached);
     void getWaitingMessages();
+    void processWaitingMessage(const MessageRecordView& message, size_t number, std::vector<PendingMessage>& pending);
+    void showWaitingMessage(const PendingMessage& message, const DecryptPipeline::Result& result);
+    void storeFileChunk(const PendingMessage& message, const DecryptPipeline::Result& result);
     void sendMessage();
+    void sendMessageToMany();
+    void sendFile();
+    
+    // File transfer helpers; a lost connection is worth retrying, a refusal is not
+    enum TransferOutcome { TRANSFER_DONE, TRANSFER_RETRY, TRANSFER_FAILED };
+    TransferOutcome queryStoredChunks(const std::string& recipient, const TransferManifest& manifest,
+                                      std::vector<bool>& stored, std::string& error);
+    TransferOutcome sendFileChunks(const std::string& recipient, const std::string& path, const TransferManifest& manifest,
+                                   const std::vector<bool>& stored, size_t& sent, std::string& error);
+    void loadUnfinishedTransfers();
+    bool saveUnfinishedTransfers() const;
     void exitClient();
     
     // Key exchange helper methods
-    bool getPublicKeyForRecipient(const std::string& recipient);
+    const PublicKeyCache::Entry* getPublicKeyForRecipient(const std::string& recipient);  // Cached or fetched; nullptr on failure
     bool sendSymmetricKey(const std::string& recipient);
+    const PublicKeyCache::Entry* rememberPublicKey(const std::string& identifier, const std::string& client_id,
+                                                   const std::string& public_key);
     bool processSymmetricKeyMessage(const std::string& sender_id, const std::vector<uint8_t>& encrypted_key);
     
 public:
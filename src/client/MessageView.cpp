@@ -0,0 +1,58 @@
+#include "MessageView.h"
+
+MessagesView::Iterator::Iterator() : reader_(nullptr, 0, false), remaining_(0) {
+}
+
+MessagesView::Iterator::Iterator(const ProtocolSchema::FieldReader& reader, uint32_t count)
+    : reader_(reader), remaining_(count) {
+    load();
+}
+
+void MessagesView::Iterator::load() {
+    if (remaining_ == 0) return;
+    
+    // A record that does not fit ends the iteration
+    if (!ProtocolSchema::MessageRecord::decode(reader_, record_.from_client_id, record_.message_id,
+                                               record_.message_type, record_.content, record_.sender_name)) {
+        remaining_ = 0;
+    }
+}
+
+MessagesView::Iterator& MessagesView::Iterator::operator++() {
+    if (remaining_ > 0) {
+        remaining_--;
+        load();
+    }
+    return *this;
+}
+
+MessagesView::Iterator MessagesView::Iterator::operator++(int) {
+    Iterator previous = *this;
+    ++(*this);
+    return previous;
+}
+
+MessagesView::MessagesView() : records_(nullptr, 0, false), count_(0) {
+}
+
+MessagesView::MessagesView(const uint8_t* payload, size_t size, bool compact, bool paged)
+    : records_(payload, size, compact), count_(0) {
+    // A messages page carries the same records behind its cursor fields
+    if (paged) {
+        uint32_t next_cursor = 0;
+        uint8_t more = 0;
+        if (!ProtocolSchema::MessagesPageHeader::decode(records_, next_cursor, more)) return;
+    }
+    
+    if (!ProtocolSchema::U32::decode(records_, count_)) {
+        count_ = 0;
+    }
+}
+
+MessagesView::Iterator MessagesView::begin() const {
+    return Iterator(records_, count_);
+}
+
+MessagesView::Iterator MessagesView::end() const {
+    return Iterator();
+}
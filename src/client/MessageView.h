@@ -0,0 +1,80 @@
+#ifndef MESSAGE_VIEW_H
+#define MESSAGE_VIEW_H
+
+#include "ProtocolSchema.h"
+#include <iterator>
+#include <ostream>
+
+// One record of a messages response; fields point into the receive buffer
+struct MessageRecordView {
+    ByteView from_client_id;
+    uint32_t message_id;
+    uint8_t message_type;
+    ByteView content;
+    ByteView sender_name;
+};
+
+/**
+ * MessagesView - Lazy, non-owning view over the records of a messages response
+ *
+ * Features:
+ * - Records are decoded one at a time while iterating, straight from the receive buffer
+ * - Fields are ByteViews; iterating allocates and copies nothing
+ * - Covers MESSAGES_RESPONSE and MESSAGES_PAGE_RESPONSE, padded or compact
+ * - Iteration ends early at a truncated record
+ *
+ * A view is only valid until its ProtocolHandler parses the next response
+ * and the receive buffer is reused.
+ */
+class MessagesView {
+public:
+    class Iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef MessageRecordView value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const MessageRecordView* pointer;
+        typedef const MessageRecordView& reference;
+        
+        Iterator();  // End iterator
+        
+        reference operator*() const { return record_; }
+        pointer operator->() const { return &record_; }
+        Iterator& operator++();
+        Iterator operator++(int);
+        
+        // Iterators of one view are ordered by the records they have left
+        bool operator==(const Iterator& other) const { return remaining_ == other.remaining_; }
+        bool operator!=(const Iterator& other) const { return remaining_ != other.remaining_; }
+        
+    private:
+        friend class MessagesView;
+        
+        Iterator(const ProtocolSchema::FieldReader& reader, uint32_t count);
+        void load();
+        
+        ProtocolSchema::FieldReader reader_;
+        uint32_t remaining_;  // Records left, including the current one; 0 at the end
+        MessageRecordView record_;
+    };
+    
+    typedef Iterator const_iterator;
+    
+    MessagesView();
+    MessagesView(const uint8_t* payload, size_t size, bool compact, bool paged);
+    
+    Iterator begin() const;
+    Iterator end() const;
+    uint32_t count() const { return count_; }  // Records announced by the server
+    bool empty() const { return count_ == 0; }
+    
+private:
+    ProtocolSchema::FieldReader records_;  // Positioned at the first record
+    uint32_t count_;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const ByteView& view) {
+    return out.write(view.chars(), static_cast<std::streamsize>(view.size));
+}
+
+#endif // MESSAGE_VIEW_H
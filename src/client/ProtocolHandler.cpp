@@ -1,416 +1,505 @@
 #include "ProtocolHandler.h"
+#include "Checksum.h"
+#include "ProtocolSchema.h"
+#include "MessageView.h"
 #include <iostream>
 #include <cstring>
+#include <stdexcept>
 #include <algorithm>
+#include <tuple>
 
-ProtocolHandler::ProtocolHandler() {
-    // Constructor implementation
+namespace {
+    // Shared source for the zero padding of fixed-size fields
+    const uint8_t ZERO_PADDING[ProtocolSizes::PUBLIC_KEY_SIZE] = {0};
+    
+    // Position inside a streamed messages payload
+    const int STREAM_PAGE_HEADER = 0;
+    const int STREAM_COUNT = 1;
+    const int STREAM_RECORDS = 2;
+    const int STREAM_TRAILER = 3;  // Anything after the announced records is skipped
 }
 
-ProtocolHandler::~ProtocolHandler() {
-    // Destructor implementation
+OutgoingFrame::OutgoingFrame() {
+    reset();
 }
 
-std::vector<uint8_t> ProtocolHandler::createRegistrationRequest(const std::string& username, const std::string& public_key) {
-    // Create payload: username(255) + public_key(1024)
-    std::vector<uint8_t> payload;
-    
-    auto username_bytes = packString(username, ProtocolSizes::USERNAME_SIZE);
-    payload.insert(payload.end(), username_bytes.begin(), username_bytes.end());
-    
-    auto public_key_bytes = packString(public_key, ProtocolSizes::PUBLIC_KEY_SIZE);
-    payload.insert(payload.end(), public_key_bytes.begin(), public_key_bytes.end());
-    
-    // Create header: version(1) + code(2) + payload_size(2) + checksum(4) = 9 bytes
-    uint32_t checksum = calculateChecksum(payload);
+void OutgoingFrame::reset() {
+    std::memset(header_, 0, sizeof(header_));
+    scratch_used_ = 0;
+    segment_count_ = 0;
+    append(header_, sizeof(header_));
+}
+
+void OutgoingFrame::append(const uint8_t* data, size_t size) {
+    if (size == 0) return;
+    if (segment_count_ >= MAX_SEGMENTS) {
+        throw std::length_error("OutgoingFrame: too many segments");
+    }
+    segments_[segment_count_].data = data;
+    segments_[segment_count_].size = size;
+    segment_count_++;
+}
+
+void OutgoingFrame::appendPadded(const std::string& str, size_t fixed_size) {
+    size_t copy_size = std::min(str.length(), fixed_size);
+    append(reinterpret_cast<const uint8_t*>(str.data()), copy_size);
+    
+    // Padding comes from the shared zero block, in slices if needed
+    size_t padding = fixed_size - copy_size;
+    while (padding > 0) {
+        size_t slice = std::min(padding, sizeof(ZERO_PADDING));
+        append(ZERO_PADDING, slice);
+        padding -= slice;
+    }
+}
+
+void OutgoingFrame::appendByte(uint8_t value) {
+    if (scratch_used_ + 1 > sizeof(scratch_)) {
+        throw std::length_error("OutgoingFrame: scratch space exhausted");
+    }
+    uint8_t* field = scratch_ + scratch_used_;
+    field[0] = value;
+    scratch_used_ += 1;
+    append(field, 1);
+}
+
+void OutgoingFrame::appendVarint(uint32_t value) {
+    if (scratch_used_ + 5 > sizeof(scratch_)) {
+        throw std::length_error("OutgoingFrame: scratch space exhausted");
+    }
     
+    // LEB128: 7 bits per byte, high bit set while more bytes follow
+    uint8_t* field = scratch_ + scratch_used_;
+    size_t length = 0;
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        field[length++] = value ? (byte | 0x80) : byte;
+    } while (value);
+    scratch_used_ += length;
+    append(field, length);
+}
+
+void OutgoingFrame::appendUint32(uint32_t value) {
+    if (scratch_used_ + 4 > sizeof(scratch_)) {
+        throw std::length_error("OutgoingFrame: scratch space exhausted");
+    }
+    uint8_t* field = scratch_ + scratch_used_;
+    field[0] = value & 0xFF;
+    field[1] = (value >> 8) & 0xFF;
+    field[2] = (value >> 16) & 0xFF;
+    field[3] = (value >> 24) & 0xFF;
+    scratch_used_ += 4;
+    append(field, 4);
+}
+
+size_t OutgoingFrame::size() const {
+    size_t total = 0;
+    for (size_t i = 0; i < segment_count_; i++) {
+        total += segments_[i].size;
+    }
+    return total;
+}
+
+std::vector<uint8_t> OutgoingFrame::flatten() const {
     std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
-    
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::REGISTRATION_REQUEST & 0xFF);
-    result.push_back((ProtocolCodes::REGISTRATION_REQUEST >> 8) & 0xFF);
-    
-    // Payload size (2 bytes, little-endian)
-    uint16_t payload_size = static_cast<uint16_t>(payload.size());
-    result.push_back(payload_size & 0xFF);
-    result.push_back((payload_size >> 8) & 0xFF);
-    
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
-    
-    // Add payload
-    result.insert(result.end(), payload.begin(), payload.end());
-    
+    result.reserve(size());
+    for (size_t i = 0; i < segment_count_; i++) {
+        result.insert(result.end(), segments_[i].data, segments_[i].data + segments_[i].size);
+    }
     return result;
 }
 
+ProtocolHandler::ProtocolHandler()
+    : protocol_version_(ProtocolVersions::V1), features_(0), response_code_(0), payload_(nullptr), payload_size_(0) {
+    beginStream();
+}
+
+ProtocolHandler::~ProtocolHandler() {
+    // Destructor implementation
+}
+
+template <typename Schema, typename... Values>
+bool ProtocolHandler::buildFrame(OutgoingFrame& frame, const Values&... values) {
+    frame.reset();
+    ProtocolSchema::FrameWriter writer(frame, isCompactEncoding());
+    Schema::encode(writer, values...);
+    return finishFrame(frame, Schema::CODE);
+}
+
+template <typename Schema, typename... Values>
+std::vector<uint8_t> ProtocolHandler::createRequest(const Values&... values) {
+    OutgoingFrame frame;
+    if (!buildFrame<Schema>(frame, values...)) {
+        return std::vector<uint8_t>();
+    }
+    return frame.flatten();
+}
+
+std::vector<uint8_t> ProtocolHandler::createRegistrationRequest(const std::string& username, const std::string& public_key) {
+    return createRequest<ProtocolSchema::RegistrationRequest>(username, public_key);
+}
+
+bool ProtocolHandler::buildRegistrationFrame(OutgoingFrame& frame, const std::string& username, const std::string& public_key) {
+    return buildFrame<ProtocolSchema::RegistrationRequest>(frame, username, public_key);
+}
+
 std::vector<uint8_t> ProtocolHandler::createLoginRequest(const std::string& username) {
-    // Create payload: username(255)
-    std::vector<uint8_t> payload = packString(username, ProtocolSizes::USERNAME_SIZE);
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
-    
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::LOGIN_REQUEST & 0xFF);
-    result.push_back((ProtocolCodes::LOGIN_REQUEST >> 8) & 0xFF);
-    
-    // Payload size (2 bytes, little-endian)
-    uint16_t payload_size = static_cast<uint16_t>(payload.size());
-    result.push_back(payload_size & 0xFF);
-    result.push_back((payload_size >> 8) & 0xFF);
-    
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
-    
-    // Add payload
-    result.insert(result.end(), payload.begin(), payload.end());
-    
-    return result;
+    return createRequest<ProtocolSchema::LoginRequest>(username);
 }
 
 std::vector<uint8_t> ProtocolHandler::createSendMessageRequest(const std::string& sender_id, const std::string& recipient, const std::vector<uint8_t>& message) {
-    // Create payload: sender_id(16) + recipient(255) + message_length(4) + message
-    std::vector<uint8_t> payload;
-    
-    auto sender_id_bytes = packString(sender_id, ProtocolSizes::CLIENT_ID_SIZE);
-    payload.insert(payload.end(), sender_id_bytes.begin(), sender_id_bytes.end());
-    
-    auto recipient_bytes = packString(recipient, ProtocolSizes::USERNAME_SIZE);
-    payload.insert(payload.end(), recipient_bytes.begin(), recipient_bytes.end());
-    
-    // Message length (4 bytes, little-endian)
-    uint32_t message_length = static_cast<uint32_t>(message.size());
-    payload.push_back(message_length & 0xFF);
-    payload.push_back((message_length >> 8) & 0xFF);
-    payload.push_back((message_length >> 16) & 0xFF);
-    payload.push_back((message_length >> 24) & 0xFF);
-    
-    // Message content
-    payload.insert(payload.end(), message.begin(), message.end());
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
-    
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::SEND_MESSAGE_REQUEST & 0xFF);
-    result.push_back((ProtocolCodes::SEND_MESSAGE_REQUEST >> 8) & 0xFF);
-    
-    // Payload size (2 bytes, little-endian)
-    uint16_t payload_size = static_cast<uint16_t>(payload.size());
-    result.push_back(payload_size & 0xFF);
-    result.push_back((payload_size >> 8) & 0xFF);
-    
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
-    
-    // Add payload
-    result.insert(result.end(), payload.begin(), payload.end());
-    
-    return result;
+    return createRequest<ProtocolSchema::SendMessageRequest>(sender_id, recipient, message);
+}
+
+bool ProtocolHandler::buildSendMessageFrame(OutgoingFrame& frame, const std::string& sender_id, const std::string& recipient, const std::vector<uint8_t>& message) {
+    // The message body is borrowed, not copied
+    return buildFrame<ProtocolSchema::SendMessageRequest>(frame, sender_id, recipient, message);
 }
 
 std::vector<uint8_t> ProtocolHandler::createRequestMessagesRequest(const std::string& client_id) {
-    // Create payload: client_id(16)
-    std::vector<uint8_t> payload = packString(client_id, ProtocolSizes::CLIENT_ID_SIZE);
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
-    
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::REQUEST_MESSAGES & 0xFF);
-    result.push_back((ProtocolCodes::REQUEST_MESSAGES >> 8) & 0xFF);
-    
-    // Payload size (2 bytes, little-endian)
-    uint16_t payload_size = static_cast<uint16_t>(payload.size());
-    result.push_back(payload_size & 0xFF);
-    result.push_back((payload_size >> 8) & 0xFF);
-    
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
-    
-    // Add payload
-    result.insert(result.end(), payload.begin(), payload.end());
-    
-    return result;
+    return createRequest<ProtocolSchema::RequestMessagesRequest>(client_id);
+}
+
+std::vector<uint8_t> ProtocolHandler::createRequestMessagesPageRequest(const std::string& client_id, uint32_t cursor,
+                                                                      uint32_t max_count, uint32_t max_bytes) {
+    return createRequest<ProtocolSchema::RequestMessagesPageRequest>(client_id, cursor, max_count, max_bytes);
 }
 
 std::vector<uint8_t> ProtocolHandler::createRequestUsersRequest() {
-    // Empty payload
-    std::vector<uint8_t> payload;
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
-    
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::REQUEST_USERS & 0xFF);
-    result.push_back((ProtocolCodes::REQUEST_USERS >> 8) & 0xFF);
-    
-    // Payload size (2 bytes, little-endian)
-    result.push_back(0);  // payload_size = 0
-    result.push_back(0);
-    
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
-    
-    return result;
+    return createRequest<ProtocolSchema::RequestUsersRequest>();
 }
 
 std::vector<uint8_t> ProtocolHandler::createRequestPublicKeyRequest(const std::string& client_identifier) {
-    // Create payload: client_identifier(255)
-    std::vector<uint8_t> payload = packString(client_identifier, ProtocolSizes::USERNAME_SIZE);
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
-    
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::REQUEST_PUBLIC_KEY & 0xFF);
-    result.push_back((ProtocolCodes::REQUEST_PUBLIC_KEY >> 8) & 0xFF);
-    
-    // Payload size (2 bytes, little-endian)
-    uint16_t payload_size = static_cast<uint16_t>(payload.size());
-    result.push_back(payload_size & 0xFF);
-    result.push_back((payload_size >> 8) & 0xFF);
-    
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
-    
-    // Add payload
-    result.insert(result.end(), payload.begin(), payload.end());
-    
-    return result;
+    return createRequest<ProtocolSchema::RequestPublicKeyRequest>(client_identifier);
 }
 
 std::vector<uint8_t> ProtocolHandler::createSendSymmetricKeyRequest(const std::string& sender_id, const std::string& recipient, const std::vector<uint8_t>& encrypted_key) {
-    // Create payload: sender_id(16) + recipient(255) + key_length(4) + encrypted_key
+    return createRequest<ProtocolSchema::SendSymmetricKeyRequest>(sender_id, recipient, encrypted_key);
+}
+
+bool ProtocolHandler::buildSendSymmetricKeyFrame(OutgoingFrame& frame, const std::string& sender_id, const std::string& recipient, const std::vector<uint8_t>& encrypted_key) {
+    return buildFrame<ProtocolSchema::SendSymmetricKeyRequest>(frame, sender_id, recipient, encrypted_key);
+}
+
+std::vector<uint8_t> ProtocolHandler::createLogoutRequest() {
+    return createRequest<ProtocolSchema::LogoutRequest>();
+}
+
+std::vector<uint8_t> ProtocolHandler::createSendMessageBatchRequest(const std::string& sender_id,
+                                                                  const std::vector<BatchMessage>& messages) {
+    // Entries outnumber the frame's segments, so the payload is encoded into one buffer first
     std::vector<uint8_t> payload;
+    size_t payload_size = ProtocolSchema::SendMessageBatchRequest::FIXED_SIZE;
+    for (size_t i = 0; i < messages.size(); i++) {
+        payload_size += batchEntrySize(messages[i]);
+    }
+    payload.reserve(payload_size);
     
-    auto sender_id_bytes = packString(sender_id, ProtocolSizes::CLIENT_ID_SIZE);
-    payload.insert(payload.end(), sender_id_bytes.begin(), sender_id_bytes.end());
-    
-    auto recipient_bytes = packString(recipient, ProtocolSizes::USERNAME_SIZE);
-    payload.insert(payload.end(), recipient_bytes.begin(), recipient_bytes.end());
-    
-    // Key length (4 bytes, little-endian)
-    uint32_t key_length = static_cast<uint32_t>(encrypted_key.size());
-    payload.push_back(key_length & 0xFF);
-    payload.push_back((key_length >> 8) & 0xFF);
-    payload.push_back((key_length >> 16) & 0xFF);
-    payload.push_back((key_length >> 24) & 0xFF);
-    
-    // Encrypted key content
-    payload.insert(payload.end(), encrypted_key.begin(), encrypted_key.end());
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
-    
-    // Version (1 byte)
-    result.push_back(1);
+    ProtocolSchema::VectorWriter writer(payload, isCompactEncoding());
+    ProtocolSchema::SendMessageBatchRequest::encode(writer, sender_id, static_cast<uint32_t>(messages.size()));
+    for (size_t i = 0; i < messages.size(); i++) {
+        ProtocolSchema::BatchEntry::encode(writer, messages[i].recipient, messages[i].message);
+    }
     
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::SEND_SYMMETRIC_KEY & 0xFF);
-    result.push_back((ProtocolCodes::SEND_SYMMETRIC_KEY >> 8) & 0xFF);
+    OutgoingFrame frame;
+    frame.append(payload.data(), payload.size());
+    if (!finishFrame(frame, ProtocolSchema::SendMessageBatchRequest::CODE)) {
+        return std::vector<uint8_t>();
+    }
+    return frame.flatten();
+}
+
+size_t ProtocolHandler::batchEntrySize(const BatchMessage& message) {
+    // Padded size, an upper bound for the compact encoding
+    return ProtocolSchema::BatchEntry::FIXED_SIZE + message.message.size();
+}
+
+std::vector<uint8_t> ProtocolHandler::createSendWithKeyRequest(const std::string& sender_id, const std::string& recipient,
+                                                             const std::vector<uint8_t>& encrypted_key,
+                                                             const std::vector<uint8_t>& message) {
+    return createRequest<ProtocolSchema::SendWithKeyRequest>(sender_id, recipient, encrypted_key, message);
+}
+
+std::vector<uint8_t> ProtocolHandler::createSendFileChunkRequest(const std::string& sender_id, const std::string& recipient,
+                                                               const std::vector<uint8_t>& chunk_id,
+                                                               const std::vector<uint8_t>& chunk) {
+    return createRequest<ProtocolSchema::SendFileChunkRequest>(sender_id, recipient, chunk_id, chunk);
+}
+
+std::vector<uint8_t> ProtocolHandler::createQueryFileChunksRequest(const std::string& sender_id, const std::string& recipient,
+                                                                 const std::vector<uint8_t>& chunk_ids) {
+    return createRequest<ProtocolSchema::QueryFileChunksRequest>(sender_id, recipient, chunk_ids);
+}
+
+bool ProtocolHandler::buildSendWithKeyFrame(OutgoingFrame& frame, const std::string& sender_id, const std::string& recipient,
+                                            const std::vector<uint8_t>& encrypted_key, const std::vector<uint8_t>& message) {
+    return buildFrame<ProtocolSchema::SendWithKeyRequest>(frame, sender_id, recipient, encrypted_key, message);
+}
+
+std::vector<uint8_t> ProtocolHandler::createNegotiateRequest() {
+    // Always a v1 frame so that servers without v2 support can still answer it
+    uint8_t session_version = protocol_version_;
+    protocol_version_ = ProtocolVersions::V1;
+    std::vector<uint8_t> request = createRequest<ProtocolSchema::NegotiateRequest>(preferredVersion(), ProtocolFeatures::SUPPORTED);
+    protocol_version_ = session_version;
+    
+    return request;
+}
+
+bool ProtocolHandler::parseResponse(const std::vector<uint8_t>& data) {
+    // Keep a private copy for callers whose buffer does not outlive the parse
+    receive_buffer_ = data;
+    return parseResponse(receive_buffer_.data(), receive_buffer_.size());
+}
+
+bool ProtocolHandler::parseResponse(const uint8_t* data, size_t size) {
+    response_code_ = 0;
+    payload_ = nullptr;
+    payload_size_ = 0;
+    
+    // Header is parsed once here; accessors only look at the payload view
+    FrameHeader header;
+    if (!verifyResponse(data, size, header)) return false;
+    
+    response_code_ = header.code;
+    payload_ = data + header.header_size;
+    payload_size_ = header.payload_size;
+    return true;
+}
+
+void ProtocolHandler::beginStream() {
+    response_code_ = 0;
+    payload_ = nullptr;
+    payload_size_ = 0;
+    
+    stream_.header_received = 0;
+    stream_.header_size = 0;
+    stream_.in_payload = false;
+    stream_.first_frame = true;
+    stream_.frame_remaining = 0;
+    stream_.frame_checksum = 0;
+    stream_.message_checksum = 0;
+    stream_.message_size = 0;
+    stream_.records = false;
+    stream_.phase = STREAM_PAGE_HEADER;
+    stream_.records_left = 0;
+    stream_.pending.clear();  // Keeps capacity
+}
+
+size_t ProtocolHandler::streamBytesWanted() const {
+    if (stream_.in_payload) return stream_.frame_remaining;
     
-    // Payload size (2 bytes, little-endian)
-    uint16_t payload_size = static_cast<uint16_t>(payload.size());
-    result.push_back(payload_size & 0xFF);
-    result.push_back((payload_size >> 8) & 0xFF);
+    // The minimum header tells the version, which tells the full header size
+    if (stream_.header_size == 0) return ProtocolSizes::MIN_HEADER_SIZE - stream_.header_received;
+    return stream_.header_size - stream_.header_received;
+}
+
+ProtocolHandler::StreamStatus ProtocolHandler::feedStream(const uint8_t* data, size_t size, const RecordHandler& on_record) {
+    while (size > 0) {
+        if (!stream_.in_payload) {
+            size_t take = std::min(size, streamBytesWanted());
+            std::memcpy(stream_.header + stream_.header_received, data, take);
+            stream_.header_received += take;
+            data += take;
+            size -= take;
+            
+            if (stream_.header_size == 0 && stream_.header_received == ProtocolSizes::MIN_HEADER_SIZE) {
+                stream_.header_size = headerSizeForVersion(stream_.header[0]);
+                if (stream_.header_size == 0) return STREAM_FAILED;
+            }
+            if (stream_.header_size == 0 || stream_.header_received < stream_.header_size) continue;
+            if (!startStreamFrame()) return STREAM_FAILED;
+        } else {
+            size_t take = std::min(size, static_cast<size_t>(stream_.frame_remaining));
+            stream_.frame_checksum = frameChecksum(stream_.frame.version, data, take, stream_.frame_checksum);
+            stream_.pending.insert(stream_.pending.end(), data, data + take);
+            stream_.frame_remaining -= static_cast<uint32_t>(take);
+            data += take;
+            size -= take;
+        }
+        
+        // Also reached straight after the header of an empty frame
+        if (stream_.in_payload && stream_.frame_remaining == 0) {
+            bool complete = false;
+            if (!finishStreamFrame(complete, on_record)) return STREAM_FAILED;
+            if (complete) return STREAM_COMPLETE;  // Bytes past the response are not consumed
+        }
+    }
+    return STREAM_NEED_MORE;
+}
+
+bool ProtocolHandler::startStreamFrame() {
+    FrameHeader& frame = stream_.frame;
+    if (!decodeHeader(stream_.header, stream_.header_size, frame)) return false;
+    
+    if (stream_.first_frame) {
+        // Messages responses are decoded record by record, anything else is buffered whole
+        stream_.first = frame;
+        stream_.records = frame.code == ProtocolCodes::MESSAGES_RESPONSE ||
+                          frame.code == ProtocolCodes::MESSAGES_PAGE_RESPONSE;
+        stream_.phase = frame.code == ProtocolCodes::MESSAGES_PAGE_RESPONSE ? STREAM_PAGE_HEADER : STREAM_COUNT;
+    } else if (frame.version != stream_.first.version) {
+        return false;
+    }
     
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
+    if (stream_.message_size + frame.payload_size > ProtocolSizes::MAX_MESSAGE_SIZE) {
+        std::cerr << "Response exceeds maximum message size" << std::endl;
+        return false;
+    }
     
-    // Add payload
-    result.insert(result.end(), payload.begin(), payload.end());
+    // Records wait in the buffer until their frame verifies, so a frame may not grow it unbounded
+    if (stream_.records && frame.payload_size > ProtocolSizes::MAX_FRAME_PAYLOAD) {
+        std::cerr << "Response frame too large: " << frame.payload_size << " bytes" << std::endl;
+        return false;
+    }
     
-    return result;
+    // v3 checksums run across the whole message; additive ones start over with every frame
+    stream_.frame_checksum = frame.version == ProtocolVersions::V3 ? stream_.message_checksum : 0;
+    stream_.frame_remaining = frame.payload_size;
+    stream_.in_payload = true;
+    return true;
 }
 
-std::vector<uint8_t> ProtocolHandler::createLogoutRequest() {
-    // Empty payload
-    std::vector<uint8_t> payload;
-    
-    // Create header
-    uint32_t checksum = calculateChecksum(payload);
-    
-    std::vector<uint8_t> result;
+bool ProtocolHandler::finishStreamFrame(bool& complete, const RecordHandler& on_record) {
+    if (stream_.frame_checksum != stream_.frame.checksum) {
+        std::cerr << "Response checksum mismatch" << std::endl;
+        return false;
+    }
     
-    // Version (1 byte)
-    result.push_back(1);
+    // Records act on the client (key records install keys), so none leaves an unverified frame
+    if (stream_.records) {
+        drainStreamRecords(on_record);
+    }
     
-    // Code (2 bytes, little-endian)
-    result.push_back(ProtocolCodes::LOGOUT_REQUEST & 0xFF);
-    result.push_back((ProtocolCodes::LOGOUT_REQUEST >> 8) & 0xFF);
+    stream_.message_checksum = joinFrameChecksum(stream_.frame.version, stream_.message_checksum, stream_.frame.checksum);
+    stream_.message_size += stream_.frame.payload_size;
+    stream_.first_frame = false;
+    stream_.in_payload = false;
+    stream_.header_received = 0;
+    stream_.header_size = 0;
+    
+    complete = !(stream_.frame.flags & ProtocolFlags::CONTINUATION);
+    if (!complete) return true;
+    
+    response_code_ = stream_.first.code;
+    if (stream_.records) {
+        // Records went to the handler; only the page cursor is left for the accessors
+        bool paged = stream_.first.code == ProtocolCodes::MESSAGES_PAGE_RESPONSE && stream_.phase != STREAM_PAGE_HEADER;
+        payload_ = stream_.page_header;
+        payload_size_ = paged ? sizeof(stream_.page_header) : 0;
+    } else {
+        payload_ = stream_.pending.data();
+        payload_size_ = stream_.pending.size();
+    }
+    return true;
+}
+
+void ProtocolHandler::drainStreamRecords(const RecordHandler& on_record) {
+    ProtocolSchema::FieldReader reader(stream_.pending.data(), stream_.pending.size(), isCompactEncoding());
+    
+    if (stream_.phase == STREAM_PAGE_HEADER) {
+        const uint8_t* page_header = nullptr;
+        if (reader.readBytes(sizeof(stream_.page_header), page_header)) {
+            std::memcpy(stream_.page_header, page_header, sizeof(stream_.page_header));
+            stream_.phase = STREAM_COUNT;
+        }
+    }
     
-    // Payload size (2 bytes, little-endian)
-    result.push_back(0);  // payload_size = 0
-    result.push_back(0);
+    if (stream_.phase == STREAM_COUNT && ProtocolSchema::U32::decode(reader, stream_.records_left)) {
+        stream_.phase = stream_.records_left > 0 ? STREAM_RECORDS : STREAM_TRAILER;
+    }
     
-    // Checksum (4 bytes, little-endian)
-    result.push_back(checksum & 0xFF);
-    result.push_back((checksum >> 8) & 0xFF);
-    result.push_back((checksum >> 16) & 0xFF);
-    result.push_back((checksum >> 24) & 0xFF);
+    // Every complete record is handed out; a partial one waits for more bytes
+    while (stream_.phase == STREAM_RECORDS) {
+        MessageRecordView record;
+        if (!ProtocolSchema::MessageRecord::decode(reader, record.from_client_id, record.message_id,
+                                                   record.message_type, record.content, record.sender_name)) {
+            break;
+        }
+        on_record(record);
+        if (--stream_.records_left == 0) {
+            stream_.phase = STREAM_TRAILER;
+        }
+    }
     
-    return result;
-}
-
-bool ProtocolHandler::parseResponse(const std::vector<uint8_t>& data) {
-    // Store response for later parsing
-    receive_buffer_ = data;
-    return true;
+    // Only the unfinished tail stays buffered
+    size_t consumed = stream_.phase == STREAM_TRAILER ? stream_.pending.size() : reader.offset();
+    stream_.pending.erase(stream_.pending.begin(), stream_.pending.begin() + consumed);
 }
 
 bool ProtocolHandler::isRegistrationSuccess() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    // Parse code from header
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::REGISTRATION_SUCCESS;
+    return response_code_ == ProtocolCodes::REGISTRATION_SUCCESS;
 }
 
 bool ProtocolHandler::isLoginSuccess() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::LOGIN_SUCCESS;
+    return response_code_ == ProtocolCodes::LOGIN_SUCCESS;
 }
 
 bool ProtocolHandler::isMessageReceived() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::MESSAGES_RESPONSE;
+    return response_code_ == ProtocolCodes::MESSAGES_RESPONSE;
 }
 
 bool ProtocolHandler::isUsersListReceived() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::USERS_RESPONSE;
+    return response_code_ == ProtocolCodes::USERS_RESPONSE;
 }
 
 bool ProtocolHandler::isPublicKeyReceived() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::PUBLIC_KEY_RESPONSE;
+    return response_code_ == ProtocolCodes::PUBLIC_KEY_RESPONSE;
 }
 
 bool ProtocolHandler::isMessagesReceived() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::MESSAGES_RESPONSE;
+    return response_code_ == ProtocolCodes::MESSAGES_RESPONSE;
+}
+
+bool ProtocolHandler::isMessagesPageReceived() const {
+    return response_code_ == ProtocolCodes::MESSAGES_PAGE_RESPONSE;
 }
 
 bool ProtocolHandler::isSendMessageSuccess() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::SEND_MESSAGE_SUCCESS;
+    return response_code_ == ProtocolCodes::SEND_MESSAGE_SUCCESS;
 }
 
 bool ProtocolHandler::isSymmetricKeyReceived() const {
-    if (receive_buffer_.size() < 9) return false;
-    
-    uint16_t code = static_cast<uint16_t>(receive_buffer_[1]) | (static_cast<uint16_t>(receive_buffer_[2]) << 8);
-    return code == ProtocolCodes::SYMMETRIC_KEY_RESPONSE;
+    return response_code_ == ProtocolCodes::SYMMETRIC_KEY_RESPONSE;
+}
+
+bool ProtocolHandler::isSendMessageBatchResponse() const {
+    return response_code_ == ProtocolCodes::SEND_MESSAGE_BATCH_RESPONSE;
+}
+
+bool ProtocolHandler::isSendWithKeySuccess() const {
+    return response_code_ == ProtocolCodes::SEND_WITH_KEY_RESPONSE;
+}
+
+bool ProtocolHandler::isFileChunksResponse() const {
+    return response_code_ == ProtocolCodes::FILE_CHUNKS_RESPONSE;
 }
 
 std::string ProtocolHandler::getErrorMessage() const {
-    if (receive_buffer_.size() < 9) return "";
-    
-    // Extract payload
-    uint16_t payload_size = static_cast<uint16_t>(receive_buffer_[3]) | (static_cast<uint16_t>(receive_buffer_[4]) << 8);
-    if (receive_buffer_.size() < 9 + payload_size) return "";
+    if (!payload_) return "";
+    return std::string(reinterpret_cast<const char*>(payload_), payload_size_);
+}
+
+std::string ProtocolHandler::getRegistrationClientId() const {
+    if (!isRegistrationSuccess()) return "";
     
-    std::string error_msg;
-    for (size_t i = 9; i < 9 + payload_size; i++) {
-        error_msg += static_cast<char>(receive_buffer_[i]);
-    }
-    return error_msg;
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    std::string client_id;
+    ProtocolSchema::RegistrationSuccess::decode(reader, client_id);
+    return client_id;
 }
 
 std::vector<std::string> ProtocolHandler::getUsersList() const {
-    if (receive_buffer_.size() < 9) return {};
-    
-    // Extract payload
-    uint16_t payload_size = static_cast<uint16_t>(receive_buffer_[3]) | (static_cast<uint16_t>(receive_buffer_[4]) << 8);
-    if (receive_buffer_.size() < 9 + payload_size) return {};
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    uint32_t num_users = 0;
+    if (!ProtocolSchema::U32::decode(reader, num_users)) return {};
     
     std::vector<std::string> users;
-    
-    // Parse number of users (4 bytes)
-    if (payload_size < 4) return {};
-    uint32_t num_users = static_cast<uint32_t>(receive_buffer_[9]) |
-                        (static_cast<uint32_t>(receive_buffer_[10]) << 8) |
-                        (static_cast<uint32_t>(receive_buffer_[11]) << 16) |
-                        (static_cast<uint32_t>(receive_buffer_[12]) << 24);
-    
-    size_t offset = 13;  // Start after number of users
-    
-    // Parse each user: client_id(16) + name(255)
     for (uint32_t i = 0; i < num_users; i++) {
-        if (offset + 16 + 255 > receive_buffer_.size()) break;
-        
-        // Extract client ID (16 bytes)
-        std::string client_id = unpackString(receive_buffer_, offset, 16);
-        offset += 16;
-        
-        // Extract name (255 bytes)
-        std::string name = unpackString(receive_buffer_, offset, 255);
-        offset += 255;
+        std::string client_id;
+        std::string name;
+        if (!ProtocolSchema::UserRecord::decode(reader, client_id, name)) break;
         
         // Format: "Name (ID: client_id)"
         std::string user_info = name + " (ID: " + client_id + ")";
@@ -421,148 +510,252 @@ std::vector<std::string> ProtocolHandler::getUsersList() const {
 }
 
 std::pair<std::string, std::string> ProtocolHandler::getPublicKeyData() const {
-    if (receive_buffer_.size() < 9) return {"", ""};
-    
-    // Extract payload
-    uint16_t payload_size = static_cast<uint16_t>(receive_buffer_[3]) | (static_cast<uint16_t>(receive_buffer_[4]) << 8);
-    if (receive_buffer_.size() < 9 + payload_size) return {"", ""};
-    
-    // Parse: client_id(16) + public_key(1024)
-    if (payload_size < 16 + 1024) return {"", ""};
-    
-    // Extract client ID (16 bytes)
-    std::string client_id = unpackString(receive_buffer_, 9, 16);
-    
-    // Extract public key (1024 bytes)
-    std::string public_key = unpackString(receive_buffer_, 9 + 16, 1024);
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    std::string client_id;
+    std::string public_key;
+    if (!ProtocolSchema::PublicKeyResponse::decode(reader, client_id, public_key)) {
+        return {"", ""};
+    }
     
     return {client_id, public_key};
 }
 
 std::vector<std::tuple<std::string, uint32_t, uint8_t, std::string, std::string>> ProtocolHandler::getMessagesData() const {
-    if (receive_buffer_.size() < 9) return {};
-    
-    // Extract payload
-    uint16_t payload_size = static_cast<uint16_t>(receive_buffer_[3]) | (static_cast<uint16_t>(receive_buffer_[4]) << 8);
-    if (receive_buffer_.size() < 9 + payload_size) return {};
+    MessagesView view = getMessagesView();
     
     std::vector<std::tuple<std::string, uint32_t, uint8_t, std::string, std::string>> messages;
-    
-    // Parse number of messages (4 bytes)
-    if (payload_size < 4) return {};
-    uint32_t num_messages = static_cast<uint32_t>(receive_buffer_[9]) |
-                           (static_cast<uint32_t>(receive_buffer_[10]) << 8) |
-                           (static_cast<uint32_t>(receive_buffer_[11]) << 16) |
-                           (static_cast<uint32_t>(receive_buffer_[12]) << 24);
-    
-    size_t offset = 13;  // Start after number of messages
-    
-    // Parse each message: from_client_id(16) + message_id(4) + message_type(1) + content_size(4) + content + sender_name(255)
-    for (uint32_t i = 0; i < num_messages; i++) {
-        if (offset + 16 + 4 + 1 + 4 > receive_buffer_.size()) break;
-        
-        // Extract from client ID (16 bytes)
-        std::string from_client_id = unpackString(receive_buffer_, offset, 16);
-        offset += 16;
-        
-        // Extract message ID (4 bytes)
-        if (offset + 4 > receive_buffer_.size()) break;
-        uint32_t message_id = static_cast<uint32_t>(receive_buffer_[offset]) |
-                             (static_cast<uint32_t>(receive_buffer_[offset + 1]) << 8) |
-                             (static_cast<uint32_t>(receive_buffer_[offset + 2]) << 16) |
-                             (static_cast<uint32_t>(receive_buffer_[offset + 3]) << 24);
-        offset += 4;
-        
-        // Extract message type (1 byte)
-        if (offset >= receive_buffer_.size()) break;
-        uint8_t message_type = receive_buffer_[offset];
-        offset += 1;
-        
-        // Extract content size (4 bytes)
-        if (offset + 4 > receive_buffer_.size()) break;
-        uint32_t content_size = static_cast<uint32_t>(receive_buffer_[offset]) |
-                               (static_cast<uint32_t>(receive_buffer_[offset + 1]) << 8) |
-                               (static_cast<uint32_t>(receive_buffer_[offset + 2]) << 16) |
-                               (static_cast<uint32_t>(receive_buffer_[offset + 3]) << 24);
-        offset += 4;
-        
-        // Extract content
-        if (offset + content_size > receive_buffer_.size()) break;
-        std::string content;
-        for (uint32_t j = 0; j < content_size; j++) {
-            content += static_cast<char>(receive_buffer_[offset + j]);
-        }
-        offset += content_size;
-        
-        // Extract sender name (255 bytes)
-        if (offset + 255 > receive_buffer_.size()) break;
-        std::string sender_name = unpackString(receive_buffer_, offset, 255);
-        offset += 255;
-        
-        // Add message to list
-        messages.push_back(std::make_tuple(from_client_id, message_id, message_type, content, sender_name));
+    for (MessagesView::Iterator it = view.begin(); it != view.end(); ++it) {
+        messages.push_back(std::make_tuple(it->from_client_id.str(), it->message_id, it->message_type,
+                                           it->content.str(), it->sender_name.str()));
     }
     
     return messages;
 }
 
-std::pair<std::string, std::vector<uint8_t>> ProtocolHandler::getSymmetricKeyData() const {
-    if (receive_buffer_.size() < 9) return {"", std::vector<uint8_t>()};
-    
-    // Extract payload
-    uint16_t payload_size = static_cast<uint16_t>(receive_buffer_[3]) | (static_cast<uint16_t>(receive_buffer_[4]) << 8);
-    if (receive_buffer_.size() < 9 + payload_size) return {"", std::vector<uint8_t>()};
-    
-    // Parse: sender_id(16) + key_length(4) + encrypted_key
-    if (payload_size < 16 + 4) return {"", std::vector<uint8_t>()};
-    
-    // Extract sender ID (16 bytes)
-    std::string sender_id = unpackString(receive_buffer_, 9, 16);
-    
-    // Extract key length (4 bytes)
-    uint32_t key_length = static_cast<uint32_t>(receive_buffer_[25]) |
-                         (static_cast<uint32_t>(receive_buffer_[26]) << 8) |
-                         (static_cast<uint32_t>(receive_buffer_[27]) << 16) |
-                         (static_cast<uint32_t>(receive_buffer_[28]) << 24);
-    
-    // Extract encrypted key
-    if (payload_size < 16 + 4 + key_length) return {"", std::vector<uint8_t>()};
+MessagesView ProtocolHandler::getMessagesView() const {
+    if (!isMessagesReceived() && !isMessagesPageReceived()) return MessagesView();
+    return MessagesView(payload_, payload_size_, isCompactEncoding(), isMessagesPageReceived());
+}
+
+bool ProtocolHandler::getMessagesPageCursor(uint32_t& next_cursor, bool& more) const {
+    if (!isMessagesPageReceived()) return false;
     
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    uint8_t more_flag = 0;
+    if (!ProtocolSchema::MessagesPageHeader::decode(reader, next_cursor, more_flag)) return false;
+    more = more_flag != 0;
+    return true;
+}
+
+std::pair<std::string, std::vector<uint8_t>> ProtocolHandler::getSymmetricKeyData() const {
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    std::string sender_id;
     std::vector<uint8_t> encrypted_key;
-    for (uint32_t i = 0; i < key_length; i++) {
-        encrypted_key.push_back(receive_buffer_[29 + i]);
+    if (!ProtocolSchema::SymmetricKeyResponse::decode(reader, sender_id, encrypted_key)) {
+        return {"", std::vector<uint8_t>()};
     }
     
     return {sender_id, encrypted_key};
 }
 
+std::vector<uint8_t> ProtocolHandler::getFileChunksStatus() const {
+    if (!isFileChunksResponse()) return {};
+    
+    // Same shape as the batch response: a count, then raw status bytes
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    uint32_t count = 0;
+    const uint8_t* statuses = nullptr;
+    if (!ProtocolSchema::FileChunksResponse::decode(reader, count) || !reader.readBytes(count, statuses)) {
+        return {};
+    }
+    
+    return std::vector<uint8_t>(statuses, statuses + count);
+}
+
+std::vector<uint8_t> ProtocolHandler::getSendMessageBatchStatus() const {
+    if (!isSendMessageBatchResponse()) return {};
+    
+    // Status bytes are raw in both encodings
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    uint32_t count = 0;
+    const uint8_t* statuses = nullptr;
+    if (!ProtocolSchema::SendMessageBatchResponse::decode(reader, count) || !reader.readBytes(count, statuses)) {
+        return {};
+    }
+    
+    return std::vector<uint8_t>(statuses, statuses + count);
+}
+
+std::string ProtocolHandler::getSendWithKeyClientId() const {
+    if (!isSendWithKeySuccess()) return "";
+    
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, isCompactEncoding());
+    std::string client_id;
+    ProtocolSchema::SendWithKeyResponse::decode(reader, client_id);
+    return client_id;
+}
+
 std::vector<std::pair<std::string, std::vector<uint8_t>>> ProtocolHandler::getMessages() const {
     // Placeholder implementation
     return {};
 }
 
-std::vector<uint8_t> ProtocolHandler::packString(const std::string& str, size_t fixed_size) {
-    std::vector<uint8_t> result(fixed_size, 0);
-    size_t copy_size = std::min(str.length(), fixed_size);
-    std::memcpy(result.data(), str.c_str(), copy_size);
-    return result;
+uint32_t ProtocolHandler::calculateChecksum(const std::vector<uint8_t>& data) {
+    return calculateChecksum(data.data(), data.size());
 }
 
-std::string ProtocolHandler::unpackString(const std::vector<uint8_t>& data, size_t offset, size_t fixed_size) const {
-    if (offset + fixed_size > data.size()) return "";
-    
-    std::string result;
-    for (size_t i = offset; i < offset + fixed_size; i++) {
-        if (data[i] == 0) break;
-        result += static_cast<char>(data[i]);
+uint32_t ProtocolHandler::calculateChecksum(const uint8_t* data, size_t size) {
+    return Checksum::additive(data, size);
+}
+
+uint8_t ProtocolHandler::preferredVersion() {
+    // CRC32C only pays off with hardware support; otherwise stay on the additive checksum
+    return Checksum::hasHardwareCrc32c() ? ProtocolVersions::V3 : ProtocolVersions::V2;
+}
+
+uint32_t ProtocolHandler::frameChecksum(uint8_t version, const uint8_t* data, size_t size, uint32_t running) {
+    if (version == ProtocolVersions::V3) {
+        return Checksum::crc32c(data, size, running);
     }
-    return result;
+    return Checksum::additive(data, size, running);
 }
 
-uint32_t ProtocolHandler::calculateChecksum(const std::vector<uint8_t>& data) {
+uint32_t ProtocolHandler::joinFrameChecksum(uint8_t version, uint32_t message_checksum, uint32_t frame_checksum) {
+    // v3 frames carry the CRC of the message so far; additive frames carry their own sum
+    if (version == ProtocolVersions::V3) {
+        return frame_checksum;
+    }
+    return message_checksum + frame_checksum;
+}
+
+bool ProtocolHandler::finishFrame(OutgoingFrame& frame, uint16_t code) {
+    // Segment 0 is the header itself; both checksums can be continued segment by segment
+    size_t payload_size = 0;
     uint32_t checksum = 0;
-    for (uint8_t byte : data) {
-        checksum += byte;
+    for (size_t i = 1; i < frame.segment_count_; i++) {
+        payload_size += frame.segments_[i].size;
+        checksum = frameChecksum(protocol_version_, frame.segments_[i].data, frame.segments_[i].size, checksum);
     }
-    return checksum;
-} 
\ No newline at end of file
+    
+    if (protocol_version_ == ProtocolVersions::V1 && payload_size > ProtocolSizes::MAX_PAYLOAD_V1) {
+        std::cerr << "Payload too large for protocol v1: " << payload_size << " bytes" << std::endl;
+        return false;
+    }
+    
+    FrameHeader header;
+    header.version = protocol_version_;
+    header.code = code;
+    header.flags = 0;
+    header.payload_size = static_cast<uint32_t>(payload_size);
+    header.checksum = checksum;
+    header.header_size = headerSizeForVersion(protocol_version_);
+    
+    encodeHeader(header, frame.header_);
+    frame.segments_[0].size = header.header_size;
+    return true;
+}
+
+size_t ProtocolHandler::headerSizeForVersion(uint8_t version) {
+    switch (version) {
+        case ProtocolVersions::V1:
+            return ProtocolSizes::HEADER_SIZE;
+        case ProtocolVersions::V2:
+        case ProtocolVersions::V3:
+            return ProtocolSizes::HEADER_SIZE_V2;
+        default:
+            return 0;
+    }
+}
+
+bool ProtocolHandler::verifyResponse(const uint8_t* data, size_t size, FrameHeader& header) {
+    if (!decodeHeader(data, size, header)) return false;
+    if (size < header.header_size + header.payload_size) return false;
+    
+    // Corrupt frames are rejected before any field is looked at
+    if (frameChecksum(header.version, data + header.header_size, header.payload_size) != header.checksum) {
+        std::cerr << "Response checksum mismatch" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ProtocolHandler::decodeHeader(const uint8_t* data, size_t size, FrameHeader& header) {
+    if (size < ProtocolSizes::MIN_HEADER_SIZE) return false;
+    
+    header.version = data[0];
+    header.header_size = headerSizeForVersion(header.version);
+    if (header.header_size == 0 || size < header.header_size) return false;
+    
+    ProtocolSchema::FieldReader reader(data, header.header_size, false);
+    if (header.version == ProtocolVersions::V1) {
+        uint16_t payload_size = 0;
+        header.flags = 0;
+        ProtocolSchema::HeaderV1::decode(reader, header.version, header.code, payload_size, header.checksum);
+        header.payload_size = payload_size;
+    } else {
+        // v2 and v3 share a layout
+        ProtocolSchema::HeaderV2::decode(reader, header.version, header.code, header.flags, header.payload_size,
+                                         header.checksum);
+    }
+    return true;
+}
+
+void ProtocolHandler::encodeHeader(const FrameHeader& header, uint8_t* out) {
+    ProtocolSchema::BufferWriter writer(out);
+    if (header.version == ProtocolVersions::V1) {
+        ProtocolSchema::HeaderV1::encode(writer, header.version, header.code,
+                                         static_cast<uint16_t>(header.payload_size), header.checksum);
+    } else {
+        ProtocolSchema::HeaderV2::encode(writer, header.version, header.code, header.flags, header.payload_size,
+                                         header.checksum);
+    }
+}
+
+void ProtocolHandler::setProtocolVersion(uint8_t version) {
+    protocol_version_ = headerSizeForVersion(version) ? version : static_cast<uint8_t>(ProtocolVersions::V1);
+}
+
+uint8_t ProtocolHandler::getProtocolVersion() const {
+    return protocol_version_;
+}
+
+bool ProtocolHandler::isNegotiateResponse() const {
+    return response_code_ == ProtocolCodes::NEGOTIATE_RESPONSE;
+}
+
+uint8_t ProtocolHandler::getNegotiatedVersion() const {
+    // Parse: version(1) + features(4)
+    if (!isNegotiateResponse()) return ProtocolVersions::V1;
+    
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, false);
+    uint8_t version = ProtocolVersions::V1;
+    if (!ProtocolSchema::U8::decode(reader, version)) return ProtocolVersions::V1;
+    return std::min(version, static_cast<uint8_t>(ProtocolVersions::MAX_SUPPORTED));
+}
+
+uint32_t ProtocolHandler::getNegotiatedFeatures() const {
+    if (!isNegotiateResponse()) return 0;
+    
+    // Servers that predate feature negotiation only send the version byte
+    ProtocolSchema::FieldReader reader(payload_, payload_size_, false);
+    uint8_t version = 0;
+    uint32_t features = 0;
+    if (!ProtocolSchema::U8::decode(reader, version) || !ProtocolSchema::U32::decode(reader, features)) return 0;
+    return features & ProtocolFeatures::SUPPORTED;
+}
+
+void ProtocolHandler::setFeatures(uint32_t features) {
+    features_ = features & ProtocolFeatures::SUPPORTED;
+}
+
+uint32_t ProtocolHandler::getFeatures() const {
+    return features_;
+}
+
+bool ProtocolHandler::isCompactEncoding() const {
+    return (features_ & ProtocolFeatures::COMPACT_ENCODING) != 0;
+}
+
+bool ProtocolHandler::isBinaryContent() const {
+    return (features_ & ProtocolFeatures::BINARY_CONTENT) != 0;
+}
\ No newline at end of file
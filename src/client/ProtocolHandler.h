@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <functional>
 
 /**
  * ProtocolHandler - Binary protocol implementation for MessageU
@@ -26,8 +27,17 @@ namespace ProtocolCodes {
     const uint16_t SEND_MESSAGE_REQUEST = 3000;
     const uint16_t SEND_MESSAGE_SUCCESS = 3001;
     const uint16_t SEND_MESSAGE_FAILURE = 3002;
+    const uint16_t SEND_MESSAGE_BATCH_REQUEST = 3003;
+    const uint16_t SEND_MESSAGE_BATCH_RESPONSE = 3004;
+    const uint16_t SEND_WITH_KEY_REQUEST = 3005;   // Symmetric key and first message in one request
+    const uint16_t SEND_WITH_KEY_RESPONSE = 3006;
+    const uint16_t SEND_FILE_CHUNK_REQUEST = 3007;  // Answered like SEND_MESSAGE_REQUEST
+    const uint16_t QUERY_FILE_CHUNKS_REQUEST = 3008;  // Which chunk IDs the server already stored
+    const uint16_t FILE_CHUNKS_RESPONSE = 3009;
     const uint16_t REQUEST_MESSAGES = 4000;
     const uint16_t MESSAGES_RESPONSE = 4001;
+    const uint16_t REQUEST_MESSAGES_PAGE = 4002;
+    const uint16_t MESSAGES_PAGE_RESPONSE = 4003;
     const uint16_t REQUEST_USERS = 5000;
     const uint16_t USERS_RESPONSE = 5001;
     const uint16_t REQUEST_PUBLIC_KEY = 5002;
@@ -36,6 +46,31 @@ namespace ProtocolCodes {
     const uint16_t SYMMETRIC_KEY_RESPONSE = 5005;
     const uint16_t LOGOUT_REQUEST = 6000;
     const uint16_t LOGOUT_SUCCESS = 6001;
+    const uint16_t NEGOTIATE_REQUEST = 7000;   // Always sent as a v1 frame
+    const uint16_t NEGOTIATE_RESPONSE = 7001;
+}
+
+// Protocol versions, selected by the first header byte
+namespace ProtocolVersions {
+    const uint8_t V1 = 1;  // 16-bit payload size
+    const uint8_t V2 = 2;  // 32-bit payload size, flags, multi-frame responses
+    const uint8_t V3 = 3;  // v2 layout with a CRC32C checksum, chained across continuation frames
+    const uint8_t MAX_SUPPORTED = V3;
+}
+
+// Header flags (v2 and later)
+namespace ProtocolFlags {
+    const uint8_t CONTINUATION = 0x01;  // More frames of the same message follow
+}
+
+// Optional features, negotiated per session as a bit mask
+namespace ProtocolFeatures {
+    const uint32_t COMPACT_ENCODING = 0x01;  // Varint length-prefixed strings instead of padded fields
+    const uint32_t BATCH_SEND = 0x02;        // SEND_MESSAGE_BATCH_REQUEST is understood
+    const uint32_t SEND_WITH_KEY = 0x04;     // SEND_WITH_KEY_REQUEST is understood
+    const uint32_t BINARY_CONTENT = 0x08;    // Message content arrives as raw bytes instead of base64 text
+    const uint32_t FILE_CHUNKS = 0x10;       // SEND_FILE_CHUNK_REQUEST and QUERY_FILE_CHUNKS_REQUEST are understood
+    const uint32_t SUPPORTED = COMPACT_ENCODING | BATCH_SEND | SEND_WITH_KEY | BINARY_CONTENT | FILE_CHUNKS;
 }
 
 // Protocol constants for field sizes
@@ -44,53 +79,279 @@ namespace ProtocolSizes {
     const uint16_t PUBLIC_KEY_SIZE = 1024;  // PEM public key size
     const uint16_t CLIENT_ID_SIZE = 16;     // Client ID size
     const uint16_t HEADER_SIZE = 9;  // version(1) + code(2) + payload_size(2) + checksum(4)
+    const uint16_t HEADER_SIZE_V2 = 12;  // version(1) + code(2) + flags(1) + payload_size(4) + checksum(4)
+    const uint16_t MAX_HEADER_SIZE = HEADER_SIZE_V2;
+    const uint16_t MIN_HEADER_SIZE = HEADER_SIZE;
+    const uint32_t MAX_PAYLOAD_V1 = 0xFFFF;
+    const uint32_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;  // Sanity cap on a reassembled message
+    const uint32_t MAX_FRAME_PAYLOAD = 1024 * 1024;  // Largest frame the server sends; streamed records buffer one
+    const uint16_t MESSAGES_PAGE_HEADER_SIZE = 5;  // next_cursor(4) + more(1), before the message count
+    const uint32_t MAX_BATCH_ENTRIES = 1024;  // Messages the server accepts in one batch request
+    const uint32_t MAX_CHUNK_QUERY = 4000;    // Chunk IDs the server accepts in one query (fits a v1 frame)
+}
+
+// Per-entry result of a batched send, in request order
+namespace BatchStatus {
+    const uint8_t STORED = 0;
+    const uint8_t RECIPIENT_NOT_FOUND = 1;
+    const uint8_t INVALID_ENTRY = 2;
+    const uint8_t STORE_FAILED = 3;  // Valid, but the batch's transaction was rolled back
+}
+
+// Type of a stored message, as delivered in waiting-message records
+namespace MessageTypes {
+    const uint8_t TEXT = 1;
+    const uint8_t SYMMETRIC_KEY = 2;
+    const uint8_t FILE_CHUNK = 3;  // One encrypted piece of a file attachment (see FileChunk)
+}
+
+namespace ProtocolSchema {
+    class FrameWriter;
 }
 
+class MessagesView;
+struct MessageRecordView;
+
+// Non-owning view of bytes inside a received frame (string_view/span stand-in for C++11)
+struct ByteView {
+    const uint8_t* data;
+    size_t size;
+    
+    ByteView() : data(nullptr), size(0) {}
+    ByteView(const uint8_t* bytes, size_t length) : data(bytes), size(length) {}
+    
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+    const char* chars() const { return reinterpret_cast<const char*>(data); }
+    std::string str() const { return std::string(chars(), size); }
+};
+
+// One message of a batched send
+struct BatchMessage {
+    std::string recipient;
+    std::vector<uint8_t> message;  // Ciphertext
+};
+
+// Decoded frame header, common to all protocol versions
+struct FrameHeader {
+    uint8_t version;
+    uint16_t code;
+    uint8_t flags;
+    uint32_t payload_size;
+    uint32_t checksum;
+    size_t header_size;
+};
+
+/**
+ * OutgoingFrame - A request laid out as segments for one gather write
+ *
+ * The header lives in a small fixed buffer, numeric fields in inline
+ * scratch space and padding points at a shared zero block. Strings and
+ * bodies (e.g. ciphertext) are borrowed by pointer and never copied, so
+ * they must outlive the send. Frames hold pointers into themselves and
+ * therefore cannot be copied.
+ */
+class OutgoingFrame {
+public:
+    static const size_t MAX_SEGMENTS = 10;
+    static const size_t SCRATCH_SIZE = 32;  // Inline storage for numeric fields
+    
+    struct Segment {
+        const uint8_t* data;
+        size_t size;
+    };
+    
+    OutgoingFrame();
+    
+    size_t segmentCount() const { return segment_count_; }
+    const Segment& segment(size_t index) const { return segments_[index]; }
+    size_t size() const;
+    
+    // Single contiguous copy, for callers that need one buffer
+    std::vector<uint8_t> flatten() const;
+    
+private:
+    friend class ProtocolHandler;
+    friend class ProtocolSchema::FrameWriter;
+    
+    OutgoingFrame(const OutgoingFrame&);
+    OutgoingFrame& operator=(const OutgoingFrame&);
+    
+    void reset();
+    void append(const uint8_t* data, size_t size);
+    void appendPadded(const std::string& str, size_t fixed_size);
+    void appendByte(uint8_t value);
+    void appendUint32(uint32_t value);
+    void appendVarint(uint32_t value);
+    
+    uint8_t header_[ProtocolSizes::MAX_HEADER_SIZE];
+    uint8_t scratch_[SCRATCH_SIZE];
+    size_t scratch_used_;
+    Segment segments_[MAX_SEGMENTS];
+    size_t segment_count_;
+};
+
 class ProtocolHandler {
 private:
     std::vector<uint8_t> send_buffer_;
-    std::vector<uint8_t> receive_buffer_;
+    std::vector<uint8_t> receive_buffer_;  // Owned copy, only for parseResponse(vector)
+    
+    // Version and features used for outgoing frames, negotiated per session
+    uint8_t protocol_version_;
+    uint32_t features_;
+    
+    // Non-owning view of the current response, parsed once in parseResponse
+    uint16_t response_code_;
+    const uint8_t* payload_;
+    size_t payload_size_;
+    
+    // Incremental decoder state, see beginStream/feedStream
+    struct StreamState {
+        uint8_t header[ProtocolSizes::MAX_HEADER_SIZE];
+        size_t header_received;      // Header bytes of the current frame buffered so far
+        size_t header_size;          // 0 until the version byte is known
+        bool in_payload;             // Reading a frame payload rather than a header
+        bool first_frame;
+        FrameHeader first;           // Header of the first frame
+        FrameHeader frame;           // Header of the frame being read
+        uint32_t frame_remaining;    // Payload bytes of the current frame still to come
+        uint32_t frame_checksum;     // Running checksum of the frame (of the message for v3)
+        uint32_t message_checksum;   // Joined checksum of the completed frames
+        size_t message_size;         // Payload bytes of the message so far
+        bool records;                // Messages response, decoded record by record
+        int phase;                   // Position inside a messages payload
+        uint32_t records_left;
+        std::vector<uint8_t> pending;  // Received bytes not yet decoded (whole frame if !records)
+        uint8_t page_header[ProtocolSizes::MESSAGES_PAGE_HEADER_SIZE];
+    };
+    StreamState stream_;
     
     // Helper methods
-    std::vector<uint8_t> packString(const std::string& str, size_t fixed_size);
-    std::string unpackString(const std::vector<uint8_t>& data, size_t offset, size_t fixed_size) const;
     uint32_t calculateChecksum(const std::vector<uint8_t>& data);
+    uint32_t calculateChecksum(const uint8_t* data, size_t size);
+    static uint8_t preferredVersion();
+    bool finishFrame(OutgoingFrame& frame, uint16_t code);  // False if the payload does not fit the version
+    bool startStreamFrame();
+    bool finishStreamFrame(bool& complete, const std::function<void(const MessageRecordView&)>& on_record);
+    void drainStreamRecords(const std::function<void(const MessageRecordView&)>& on_record);
+    
+    // Encodes a ProtocolSchema message into frame using the session's encoding
+    template <typename Schema, typename... Values>
+    bool buildFrame(OutgoingFrame& frame, const Values&... values);
+    template <typename Schema, typename... Values>
+    std::vector<uint8_t> createRequest(const Values&... values);
     
 public:
+    // Outcome of feeding bytes to the incremental decoder
+    enum StreamStatus {
+        STREAM_NEED_MORE,  // Response not complete yet
+        STREAM_COMPLETE,   // Response complete and verified; accessors describe it
+        STREAM_FAILED      // Malformed or corrupt response
+    };
+    typedef std::function<void(const MessageRecordView& record)> RecordHandler;
+    
     ProtocolHandler();
     ~ProtocolHandler();
     
-    // Protocol message creation
+    // Frame header helpers shared with the transport
+    static size_t headerSizeForVersion(uint8_t version);  // 0 for unknown versions
+    static bool decodeHeader(const uint8_t* data, size_t size, FrameHeader& header);
+    static void encodeHeader(const FrameHeader& header, uint8_t* out);
+    // Header of a whole (reassembled) response whose payload is present and matches its checksum
+    static bool verifyResponse(const uint8_t* data, size_t size, FrameHeader& header);
+    
+    // Checksum of a payload continuing from running (additive for v1/v2, CRC32C for v3)
+    static uint32_t frameChecksum(uint8_t version, const uint8_t* data, size_t size, uint32_t running = 0);
+    // Checksum of a message after one more continuation frame has been appended
+    static uint32_t joinFrameChecksum(uint8_t version, uint32_t message_checksum, uint32_t frame_checksum);
+    
+    // Version negotiation
+    void setProtocolVersion(uint8_t version);
+    uint8_t getProtocolVersion() const;
+    std::vector<uint8_t> createNegotiateRequest();
+    bool isNegotiateResponse() const;
+    uint8_t getNegotiatedVersion() const;
+    void setFeatures(uint32_t features);
+    uint32_t getFeatures() const;
+    uint32_t getNegotiatedFeatures() const;
+    bool isCompactEncoding() const;
+    bool isBinaryContent() const;
+    
+    // Protocol message creation; empty when the payload is too large for the session's version
     std::vector<uint8_t> createRegistrationRequest(const std::string& username, 
                                                   const std::string& public_key);
     std::vector<uint8_t> createLoginRequest(const std::string& username);
     std::vector<uint8_t> createSendMessageRequest(const std::string& sender_id, const std::string& recipient, 
                                                  const std::vector<uint8_t>& message);
     std::vector<uint8_t> createRequestMessagesRequest(const std::string& client_id);
+    std::vector<uint8_t> createRequestMessagesPageRequest(const std::string& client_id, uint32_t cursor,
+                                                         uint32_t max_count, uint32_t max_bytes);
     std::vector<uint8_t> createRequestUsersRequest();
     std::vector<uint8_t> createRequestPublicKeyRequest(const std::string& client_identifier);
     std::vector<uint8_t> createSendSymmetricKeyRequest(const std::string& sender_id, const std::string& recipient, 
                                                       const std::vector<uint8_t>& encrypted_key);
     std::vector<uint8_t> createLogoutRequest();
+    // Many messages in one frame; at most MAX_BATCH_ENTRIES, see batchEntrySize for the payload budget
+    std::vector<uint8_t> createSendMessageBatchRequest(const std::string& sender_id,
+                                                      const std::vector<BatchMessage>& messages);
+    static size_t batchEntrySize(const BatchMessage& message);  // Payload bytes of one entry, at most
+    std::vector<uint8_t> createSendWithKeyRequest(const std::string& sender_id, const std::string& recipient,
+                                                  const std::vector<uint8_t>& encrypted_key,
+                                                  const std::vector<uint8_t>& message);
+    std::vector<uint8_t> createSendFileChunkRequest(const std::string& sender_id, const std::string& recipient,
+                                                    const std::vector<uint8_t>& chunk_id, const std::vector<uint8_t>& chunk);
+    // chunk_ids holds up to MAX_CHUNK_QUERY IDs back to back
+    std::vector<uint8_t> createQueryFileChunksRequest(const std::string& sender_id, const std::string& recipient,
+                                                      const std::vector<uint8_t>& chunk_ids);
+    
+    // Zero-copy framing: inputs are borrowed by the frame until it is sent; false if the payload is too large
+    bool buildRegistrationFrame(OutgoingFrame& frame, const std::string& username,
+                                const std::string& public_key);
+    bool buildSendMessageFrame(OutgoingFrame& frame, const std::string& sender_id, const std::string& recipient,
+                               const std::vector<uint8_t>& message);
+    bool buildSendSymmetricKeyFrame(OutgoingFrame& frame, const std::string& sender_id, const std::string& recipient,
+                                    const std::vector<uint8_t>& encrypted_key);
+    bool buildSendWithKeyFrame(OutgoingFrame& frame, const std::string& sender_id, const std::string& recipient,
+                               const std::vector<uint8_t>& encrypted_key, const std::vector<uint8_t>& message);
     
     // Protocol message parsing
-    bool parseResponse(const std::vector<uint8_t>& data);
+    bool parseResponse(const std::vector<uint8_t>& data);  // Copies the frame
+    bool parseResponse(const uint8_t* data, size_t size);  // Borrows the frame until the next parse
+    
+    // Incremental parsing: bytes are pushed as they arrive, in chunks of any size. Records of a
+    // messages response go to on_record frame by frame, once the frame's checksum has matched
+    // (views are valid during the call only); any other response is parsed as by parseResponse
+    // once complete. A mismatch fails the stream before any record of that frame is handed out.
+    void beginStream();
+    StreamStatus feedStream(const uint8_t* data, size_t size, const RecordHandler& on_record);
+    size_t streamBytesWanted() const;  // Bytes left in the current header or frame, never past the response
     bool isRegistrationSuccess() const;
     bool isLoginSuccess() const;
     bool isMessageReceived() const;
     bool isUsersListReceived() const;
     bool isPublicKeyReceived() const;
     bool isMessagesReceived() const;
+    bool isMessagesPageReceived() const;
     bool isSendMessageSuccess() const;
     bool isSymmetricKeyReceived() const;
+    bool isSendMessageBatchResponse() const;
+    bool isSendWithKeySuccess() const;
+    bool isFileChunksResponse() const;
     
     // Data extraction
     std::string getErrorMessage() const;
+    std::string getRegistrationClientId() const;
     std::vector<std::string> getUsersList() const;
     std::vector<std::pair<std::string, std::vector<uint8_t>>> getMessages() const;
     std::pair<std::string, std::string> getPublicKeyData() const;  // Returns (client_id, public_key)
     std::vector<std::tuple<std::string, uint32_t, uint8_t, std::string, std::string>> getMessagesData() const;  // Returns (from_client_id, message_id, message_type, content, sender_name)
+    MessagesView getMessagesView() const;  // Zero-copy records, valid until the next parse (see MessageView.h)
+    bool getMessagesPageCursor(uint32_t& next_cursor, bool& more) const;  // Resume point of a messages page
     std::pair<std::string, std::vector<uint8_t>> getSymmetricKeyData() const;  // Returns (sender_id, encrypted_key)
+    std::vector<uint8_t> getSendMessageBatchStatus() const;  // One BatchStatus per entry, in request order
+    std::string getSendWithKeyClientId() const;  // Client ID the recipient name resolved to
+    std::vector<uint8_t> getFileChunksStatus() const;  // One byte per queried chunk ID, 1 = already stored
 };
 
 #endif // PROTOCOL_HANDLER_H 
\ No newline at end of file
@@ -0,0 +1,418 @@
+#ifndef PROTOCOL_SCHEMA_H
+#define PROTOCOL_SCHEMA_H
+
+#include "ProtocolHandler.h"
+#include <string>
+#include <vector>
+#include <cstring>
+
+/**
+ * ProtocolSchema - Declarative payload layouts for the MessageU protocol
+ *
+ * Features:
+ * - Every message layout is declared once as a list of field types
+ * - Encoders and decoders are generated from the list and inlined into straight-line code
+ * - One declaration covers both the padded and the compact encoding
+ * - Padded sizes, frame segments and scratch space are checked at compile time
+ */
+namespace ProtocolSchema {
+    // Appends fields to an OutgoingFrame; strings and bodies are borrowed, not copied
+    class FrameWriter {
+    public:
+        FrameWriter(OutgoingFrame& frame, bool compact) : frame_(frame), compact_(compact) {}
+        
+        bool compact() const { return compact_; }
+        void writeByte(uint8_t value) { frame_.appendByte(value); }
+        void writeUint32(uint32_t value) { frame_.appendUint32(value); }
+        void writeVarint(uint32_t value) { frame_.appendVarint(value); }
+        void writeBytes(const uint8_t* data, size_t size) { frame_.append(data, size); }
+        void writePadded(const std::string& str, size_t fixed_size) { frame_.appendPadded(str, fixed_size); }
+        
+    private:
+        OutgoingFrame& frame_;
+        bool compact_;
+    };
+    
+    // Appends fields to a growable buffer, for payloads with more parts than a frame has segments
+    class VectorWriter {
+    public:
+        VectorWriter(std::vector<uint8_t>& out, bool compact) : out_(out), compact_(compact) {}
+        
+        bool compact() const { return compact_; }
+        void writeByte(uint8_t value) { out_.push_back(value); }
+        
+        void writeUint32(uint32_t value) {
+            uint8_t field[4] = {static_cast<uint8_t>(value & 0xFF), static_cast<uint8_t>((value >> 8) & 0xFF),
+                                static_cast<uint8_t>((value >> 16) & 0xFF), static_cast<uint8_t>((value >> 24) & 0xFF)};
+            out_.insert(out_.end(), field, field + 4);
+        }
+        
+        void writeVarint(uint32_t value) {
+            do {
+                uint8_t byte = value & 0x7F;
+                value >>= 7;
+                out_.push_back(value ? (byte | 0x80) : byte);
+            } while (value);
+        }
+        
+        void writeBytes(const uint8_t* data, size_t size) { out_.insert(out_.end(), data, data + size); }
+        
+        void writePadded(const std::string& str, size_t fixed_size) {
+            size_t copy_size = str.length() < fixed_size ? str.length() : fixed_size;
+            out_.insert(out_.end(), str.begin(), str.begin() + copy_size);
+            out_.resize(out_.size() + (fixed_size - copy_size), 0);
+        }
+        
+    private:
+        std::vector<uint8_t>& out_;
+        bool compact_;
+    };
+    
+    // Writes fixed-width fields into a caller-provided buffer (frame headers)
+    class BufferWriter {
+    public:
+        explicit BufferWriter(uint8_t* out) : out_(out), offset_(0) {}
+        
+        bool compact() const { return false; }
+        size_t offset() const { return offset_; }
+        
+        void writeByte(uint8_t value) {
+            out_[offset_++] = value;
+        }
+        
+        void writeUint16(uint16_t value) {
+            out_[offset_++] = value & 0xFF;
+            out_[offset_++] = (value >> 8) & 0xFF;
+        }
+        
+        void writeUint32(uint32_t value) {
+            out_[offset_++] = value & 0xFF;
+            out_[offset_++] = (value >> 8) & 0xFF;
+            out_[offset_++] = (value >> 16) & 0xFF;
+            out_[offset_++] = (value >> 24) & 0xFF;
+        }
+        
+    private:
+        uint8_t* out_;
+        size_t offset_;
+    };
+    
+    // Bounds-checked cursor over received bytes; a failed read leaves the offset unchanged
+    class FieldReader {
+    public:
+        FieldReader(const uint8_t* data, size_t size, bool compact)
+            : data_(data), size_(data ? size : 0), offset_(0), compact_(compact) {}
+        
+        bool compact() const { return compact_; }
+        size_t offset() const { return offset_; }
+        size_t remaining() const { return size_ - offset_; }
+        
+        bool readByte(uint8_t& value) {
+            if (remaining() < 1) return false;
+            value = data_[offset_++];
+            return true;
+        }
+        
+        bool readUint16(uint16_t& value) {
+            if (remaining() < 2) return false;
+            value = static_cast<uint16_t>(data_[offset_]) | (static_cast<uint16_t>(data_[offset_ + 1]) << 8);
+            offset_ += 2;
+            return true;
+        }
+        
+        bool readUint32(uint32_t& value) {
+            if (remaining() < 4) return false;
+            value = static_cast<uint32_t>(data_[offset_]) |
+                   (static_cast<uint32_t>(data_[offset_ + 1]) << 8) |
+                   (static_cast<uint32_t>(data_[offset_ + 2]) << 16) |
+                   (static_cast<uint32_t>(data_[offset_ + 3]) << 24);
+            offset_ += 4;
+            return true;
+        }
+        
+        bool readVarint(uint32_t& value) {
+            // LEB128, at most 5 bytes for 32 bits
+            uint32_t result = 0;
+            for (size_t i = 0; i < 5 && i < remaining(); i++) {
+                uint8_t byte = data_[offset_ + i];
+                result |= static_cast<uint32_t>(byte & 0x7F) << (7 * i);
+                if (!(byte & 0x80)) {
+                    value = result;
+                    offset_ += i + 1;
+                    return true;
+                }
+            }
+            return false;
+        }
+        
+        // Borrows size bytes from the underlying buffer
+        bool readBytes(size_t size, const uint8_t*& bytes) {
+            if (remaining() < size) return false;
+            bytes = data_ + offset_;
+            offset_ += size;
+            return true;
+        }
+        
+    private:
+        const uint8_t* data_;
+        size_t size_;
+        size_t offset_;
+        bool compact_;
+    };
+    
+    // Each field type describes its padded size and its worst case in an OutgoingFrame:
+    // FIXED_SIZE - bytes in the padded encoding, excluding variable bodies
+    // VARIABLE   - whether the field carries a body of run-time length
+    // SEGMENTS   - OutgoingFrame segments used when encoding
+    // SCRATCH    - OutgoingFrame scratch bytes used when encoding
+    
+    struct U8 {
+        static const size_t FIXED_SIZE = 1;
+        static const bool VARIABLE = false;
+        static const size_t SEGMENTS = 1;
+        static const size_t SCRATCH = 1;
+        
+        template <typename Writer>
+        static void encode(Writer& writer, uint8_t value) { writer.writeByte(value); }
+        static bool decode(FieldReader& reader, uint8_t& value) { return reader.readByte(value); }
+    };
+    
+    // Frame headers only; payloads use U32 or Length
+    struct U16 {
+        static const size_t FIXED_SIZE = 2;
+        static const bool VARIABLE = false;
+        static const size_t SEGMENTS = 1;
+        static const size_t SCRATCH = 2;
+        
+        template <typename Writer>
+        static void encode(Writer& writer, uint16_t value) { writer.writeUint16(value); }
+        static bool decode(FieldReader& reader, uint16_t& value) { return reader.readUint16(value); }
+    };
+    
+    struct U32 {
+        static const size_t FIXED_SIZE = 4;
+        static const bool VARIABLE = false;
+        static const size_t SEGMENTS = 1;
+        static const size_t SCRATCH = 4;
+        
+        template <typename Writer>
+        static void encode(Writer& writer, uint32_t value) { writer.writeUint32(value); }
+        static bool decode(FieldReader& reader, uint32_t& value) { return reader.readUint32(value); }
+    };
+    
+    // Body length: 4 bytes, or a varint when compact
+    struct Length {
+        static const size_t FIXED_SIZE = 4;
+        static const bool VARIABLE = false;
+        static const size_t SEGMENTS = 1;
+        static const size_t SCRATCH = 5;
+        
+        template <typename Writer>
+        static void encode(Writer& writer, uint32_t length) {
+            if (writer.compact()) {
+                writer.writeVarint(length);
+            } else {
+                writer.writeUint32(length);
+            }
+        }
+        
+        static bool decode(FieldReader& reader, uint32_t& length) {
+            return reader.compact() ? reader.readVarint(length) : reader.readUint32(length);
+        }
+    };
+    
+    // String of at most N bytes: NUL-padded to N, or varint length + bytes when compact
+    template <size_t N>
+    struct PaddedString {
+        // One string segment plus one slice of the shared zero block
+        static_assert(N <= ProtocolSizes::PUBLIC_KEY_SIZE, "Padding must fit in one zero-block slice");
+        
+        static const size_t FIXED_SIZE = N;
+        static const bool VARIABLE = false;
+        static const size_t SEGMENTS = 2;
+        static const size_t SCRATCH = 5;
+        
+        template <typename Writer>
+        static void encode(Writer& writer, const std::string& str) {
+            if (!writer.compact()) {
+                writer.writePadded(str, N);
+                return;
+            }
+            
+            // Same length limit as the padded field, without the padding
+            size_t length = str.length() < N ? str.length() : N;
+            writer.writeVarint(static_cast<uint32_t>(length));
+            writer.writeBytes(reinterpret_cast<const uint8_t*>(str.data()), length);
+        }
+        
+        // Borrows the field from the reader's buffer
+        static bool decode(FieldReader& reader, ByteView& out) {
+            const uint8_t* field = nullptr;
+            if (!reader.compact()) {
+                if (!reader.readBytes(N, field)) return false;
+                
+                // Field is NUL-padded; stop at the first NUL
+                const void* nul = std::memchr(field, 0, N);
+                out = ByteView(field, nul ? static_cast<size_t>(static_cast<const uint8_t*>(nul) - field) : N);
+                return true;
+            }
+            
+            FieldReader start = reader;
+            uint32_t length = 0;
+            if (!reader.readVarint(length) || length > N || !reader.readBytes(length, field)) {
+                reader = start;
+                return false;
+            }
+            out = ByteView(field, length);
+            return true;
+        }
+        
+        static bool decode(FieldReader& reader, std::string& out) {
+            ByteView field;
+            if (!decode(reader, field)) return false;
+            out.assign(field.chars(), field.size);
+            return true;
+        }
+    };
+    
+    // Length-prefixed body (ciphertext, encrypted keys); borrowed when encoding
+    struct Blob {
+        static const size_t FIXED_SIZE = Length::FIXED_SIZE;
+        static const bool VARIABLE = true;
+        static const size_t SEGMENTS = Length::SEGMENTS + 1;
+        static const size_t SCRATCH = Length::SCRATCH;
+        
+        template <typename Writer, typename Container>
+        static void encode(Writer& writer, const Container& body) {
+            Length::encode(writer, static_cast<uint32_t>(body.size()));
+            writer.writeBytes(reinterpret_cast<const uint8_t*>(body.data()), body.size());
+        }
+        
+        // Borrows the body from the reader's buffer
+        static bool decode(FieldReader& reader, ByteView& out) {
+            FieldReader start = reader;
+            uint32_t length = 0;
+            const uint8_t* body = nullptr;
+            if (!Length::decode(reader, length) || !reader.readBytes(length, body)) {
+                reader = start;
+                return false;
+            }
+            out = ByteView(body, length);
+            return true;
+        }
+        
+        // Copying variant for std::string and std::vector<uint8_t>
+        template <typename Container>
+        static bool decode(FieldReader& reader, Container& out) {
+            typedef typename Container::value_type Element;
+            ByteView body;
+            if (!decode(reader, body)) return false;
+            const Element* first = reinterpret_cast<const Element*>(body.data);
+            out.assign(first, first + body.size);
+            return true;
+        }
+    };
+    
+    // Ordered field list; encode/decode take one argument per field, in order
+    template <typename... Fields>
+    struct Layout;
+    
+    template <>
+    struct Layout<> {
+        static const size_t FIXED_SIZE = 0;
+        static const bool VARIABLE = false;
+        static const size_t SEGMENTS = 0;
+        static const size_t SCRATCH = 0;
+        
+        template <typename Writer>
+        static void encode(Writer&) {}
+        static bool decode(FieldReader&) { return true; }
+    };
+    
+    template <typename Field, typename... Rest>
+    struct Layout<Field, Rest...> {
+        static const size_t FIXED_SIZE = Field::FIXED_SIZE + Layout<Rest...>::FIXED_SIZE;
+        static const bool VARIABLE = Field::VARIABLE || Layout<Rest...>::VARIABLE;
+        static const size_t SEGMENTS = Field::SEGMENTS + Layout<Rest...>::SEGMENTS;
+        static const size_t SCRATCH = Field::SCRATCH + Layout<Rest...>::SCRATCH;
+        
+        template <typename Writer, typename Value, typename... Values>
+        static void encode(Writer& writer, const Value& value, const Values&... rest) {
+            Field::encode(writer, value);
+            Layout<Rest...>::encode(writer, rest...);
+        }
+        
+        // On failure the reader is left where it was, so a partial record can be retried later;
+        // outputs of the fields before the failing one are already assigned
+        template <typename Value, typename... Values>
+        static bool decode(FieldReader& reader, Value& value, Values&... rest) {
+            FieldReader start = reader;
+            if (Field::decode(reader, value) && Layout<Rest...>::decode(reader, rest...)) return true;
+            reader = start;
+            return false;
+        }
+    };
+    
+    // Payload layout bound to its protocol code
+    template <uint16_t Code, typename... Fields>
+    struct Message : Layout<Fields...> {
+        static const uint16_t CODE = Code;
+        
+        // The header occupies segment 0 of the frame
+        static_assert(Layout<Fields...>::SEGMENTS + 1 <= OutgoingFrame::MAX_SEGMENTS,
+                      "Layout needs more segments than an OutgoingFrame holds");
+        static_assert(Layout<Fields...>::SCRATCH <= OutgoingFrame::SCRATCH_SIZE,
+                      "Layout needs more scratch space than an OutgoingFrame holds");
+        static_assert(Layout<Fields...>::FIXED_SIZE <= ProtocolSizes::MAX_PAYLOAD_V1,
+                      "Padded layout does not fit a v1 frame");
+    };
+    
+    typedef PaddedString<ProtocolSizes::CLIENT_ID_SIZE> ClientId;
+    typedef PaddedString<ProtocolSizes::USERNAME_SIZE> Username;
+    typedef PaddedString<ProtocolSizes::PUBLIC_KEY_SIZE> PublicKey;
+    
+    // Frame headers, after which the payload starts
+    typedef Layout<U8, U16, U16, U32> HeaderV1;         // version, code, payload_size, checksum
+    typedef Layout<U8, U16, U8, U32, U32> HeaderV2;     // version, code, flags, payload_size, checksum
+    static_assert(HeaderV1::FIXED_SIZE == ProtocolSizes::HEADER_SIZE, "v1 header size");
+    static_assert(HeaderV2::FIXED_SIZE == ProtocolSizes::HEADER_SIZE_V2, "v2 header size");
+    
+    // Requests
+    typedef Message<ProtocolCodes::REGISTRATION_REQUEST, Username, PublicKey> RegistrationRequest;
+    typedef Message<ProtocolCodes::LOGIN_REQUEST, Username> LoginRequest;
+    typedef Message<ProtocolCodes::SEND_MESSAGE_REQUEST, ClientId, Username, Blob> SendMessageRequest;
+    typedef Message<ProtocolCodes::REQUEST_MESSAGES, ClientId> RequestMessagesRequest;
+    typedef Message<ProtocolCodes::REQUEST_MESSAGES_PAGE, ClientId, U32, U32, U32> RequestMessagesPageRequest;
+    typedef Message<ProtocolCodes::REQUEST_USERS> RequestUsersRequest;
+    typedef Message<ProtocolCodes::REQUEST_PUBLIC_KEY, Username> RequestPublicKeyRequest;
+    typedef Message<ProtocolCodes::SEND_SYMMETRIC_KEY, ClientId, Username, Blob> SendSymmetricKeyRequest;
+    typedef Message<ProtocolCodes::LOGOUT_REQUEST> LogoutRequest;
+    typedef Message<ProtocolCodes::NEGOTIATE_REQUEST, U8, U32> NegotiateRequest;  // max_version, features
+    typedef Message<ProtocolCodes::SEND_MESSAGE_BATCH_REQUEST, ClientId, U32> SendMessageBatchRequest;  // sender_id, count
+    typedef Layout<Username, Blob> BatchEntry;  // recipient, ciphertext; count entries follow the batch header
+    typedef Message<ProtocolCodes::SEND_WITH_KEY_REQUEST, ClientId, Username, Blob, Blob> SendWithKeyRequest;  // sender_id, recipient, encrypted_key, ciphertext
+    typedef Message<ProtocolCodes::SEND_FILE_CHUNK_REQUEST, ClientId, Username, Blob, Blob> SendFileChunkRequest;  // sender_id, recipient, chunk_id, encrypted chunk
+    typedef Message<ProtocolCodes::QUERY_FILE_CHUNKS_REQUEST, ClientId, Username, Blob> QueryFileChunksRequest;  // sender_id, recipient, chunk IDs
+    
+    // Padded sizes the server's struct formats expect
+    static_assert(RegistrationRequest::FIXED_SIZE == 1279, "username(255) + public_key(1024)");
+    static_assert(SendMessageRequest::FIXED_SIZE == 275, "sender_id(16) + recipient(255) + length(4)");
+    static_assert(RequestMessagesPageRequest::FIXED_SIZE == 28, "client_id(16) + cursor(4) + max_count(4) + max_bytes(4)");
+    static_assert(NegotiateRequest::FIXED_SIZE == 5, "max_version(1) + features(4)");
+    static_assert(SendMessageBatchRequest::FIXED_SIZE == 20, "sender_id(16) + count(4)");
+    static_assert(SendWithKeyRequest::FIXED_SIZE == 279, "sender_id(16) + recipient(255) + key_length(4) + message_length(4)");
+    
+    // Responses; counted lists are a U32 count followed by records
+    typedef Message<ProtocolCodes::REGISTRATION_SUCCESS, ClientId> RegistrationSuccess;  // Trailing text is ignored
+    typedef Message<ProtocolCodes::PUBLIC_KEY_RESPONSE, ClientId, PublicKey> PublicKeyResponse;
+    typedef Message<ProtocolCodes::SYMMETRIC_KEY_RESPONSE, ClientId, Blob> SymmetricKeyResponse;
+    typedef Message<ProtocolCodes::MESSAGES_PAGE_RESPONSE, U32, U8> MessagesPageHeader;  // next_cursor, more
+    typedef Layout<ClientId, Username> UserRecord;
+    typedef Layout<ClientId, U32, U8, Blob, Username> MessageRecord;  // from, id, type, content, sender_name
+    typedef Message<ProtocolCodes::SEND_MESSAGE_BATCH_RESPONSE, U32> SendMessageBatchResponse;  // count, then one status byte each
+    typedef Message<ProtocolCodes::FILE_CHUNKS_RESPONSE, U32> FileChunksResponse;  // count, then one stored byte each
+    typedef Message<ProtocolCodes::SEND_WITH_KEY_RESPONSE, ClientId> SendWithKeyResponse;  // Trailing text is ignored
+    static_assert(MessagesPageHeader::FIXED_SIZE == ProtocolSizes::MESSAGES_PAGE_HEADER_SIZE, "page header size");
+}
+
+#endif // PROTOCOL_SCHEMA_H
@@ -0,0 +1,218 @@
+#include "PublicKeyCache.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <cryptopp/base64.h>
+#include <cryptopp/filters.h>
+
+namespace {
+    const char* PEM_BEGIN = "-----BEGIN ";
+    const char* PEM_END = "-----END ";
+    
+    // The cache file is line based, so newlines, tabs and backslashes inside fields are escaped
+    std::string escapeField(const std::string& value) {
+        std::string escaped;
+        escaped.reserve(value.size() + 32);
+        for (size_t i = 0; i < value.size(); i++) {
+            switch (value[i]) {
+                case '\\': escaped += "\\\\"; break;
+                case '\n': escaped += "\\n"; break;
+                case '\r': escaped += "\\r"; break;
+                case '\t': escaped += "\\t"; break;
+                default: escaped += value[i]; break;
+            }
+        }
+        return escaped;
+    }
+    
+    std::string unescapeField(const std::string& value) {
+        std::string plain;
+        plain.reserve(value.size());
+        for (size_t i = 0; i < value.size(); i++) {
+            if (value[i] != '\\' || i + 1 == value.size()) {
+                plain += value[i];
+                continue;
+            }
+            switch (value[++i]) {
+                case 'n': plain += '\n'; break;
+                case 'r': plain += '\r'; break;
+                case 't': plain += '\t'; break;
+                default: plain += value[i]; break;
+            }
+        }
+        return plain;
+    }
+    
+    bool isBase64Char(char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+               c == '+' || c == '/' || c == '=';
+    }
+    
+    bool isSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
+    
+    // Base64 body between the armor lines, whitespace removed
+    std::string pemBody(const std::string& pem) {
+        size_t begin = pem.find(PEM_BEGIN);
+        size_t end = pem.find(PEM_END);
+        if (begin == std::string::npos || end == std::string::npos || end < begin) return std::string();
+        
+        size_t body_start = pem.find('\n', begin);
+        if (body_start == std::string::npos || body_start > end) return std::string();
+        
+        std::string body;
+        for (size_t i = body_start; i < end; i++) {
+            if (!isSpace(pem[i])) body += pem[i];
+        }
+        return body;
+    }
+}
+
+PublicKeyCache::PublicKeyCache(long ttl_seconds) : ttl_seconds_(ttl_seconds) {
+}
+
+bool PublicKeyCache::isWellFormedPem(const std::string& pem) {
+    // Armor lines present; the body is non-empty, whole base64 quads
+    std::string body = pemBody(pem);
+    if (body.empty() || body.size() % 4 != 0) return false;
+    for (size_t i = 0; i < body.size(); i++) {
+        if (!isBase64Char(body[i])) return false;
+    }
+    return true;
+}
+
+const std::string& PublicKeyCache::resolve(const std::string& identifier) const {
+    std::map<std::string, std::string>::const_iterator alias = aliases_.find(identifier);
+    return alias != aliases_.end() ? alias->second : identifier;
+}
+
+bool PublicKeyCache::put(const std::string& identifier, const std::string& client_id, const std::string& pem) {
+    if (client_id.empty() || !isWellFormedPem(pem)) {
+        std::cerr << "Not caching public key for " << identifier << ": malformed PEM" << std::endl;
+        return false;
+    }
+    
+    Entry& entry = entries_[client_id];
+    if (entry.pem != pem) {
+        // New or changed key: any decoded object belongs to the old one
+        entry.client_id = client_id;
+        entry.pem = pem;
+        entry.decoded = false;
+        entry.rsa.reset();
+    }
+    entry.fetched = std::time(nullptr);
+    
+    if (identifier != client_id) {
+        aliases_[identifier] = client_id;
+    }
+    if (!path_.empty()) save();
+    return true;
+}
+
+const PublicKeyCache::Entry* PublicKeyCache::find(const std::string& identifier) {
+    std::map<std::string, Entry>::iterator it = entries_.find(resolve(identifier));
+    if (it == entries_.end()) return nullptr;
+    
+    // A TTL of zero or less keeps entries until they are replaced
+    if (ttl_seconds_ > 0 && std::difftime(std::time(nullptr), it->second.fetched) > ttl_seconds_) {
+        entries_.erase(it);  // Aliases stay; they point at the client ID, which is fetched again
+        if (!path_.empty()) save();
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const CryptoPP::RSA::PublicKey* PublicKeyCache::rsaKey(const Entry& entry) const {
+    if (!entry.decoded) {
+        entry.decoded = true;
+        try {
+            std::shared_ptr<CryptoPP::RSA::PublicKey> key(new CryptoPP::RSA::PublicKey());
+            CryptoPP::StringSource source(pemBody(entry.pem), true, new CryptoPP::Base64Decoder);
+            key->Load(source);
+            entry.rsa = key;
+        } catch (const CryptoPP::Exception& e) {
+            std::cerr << "Public key of " << entry.client_id << " does not decode: " << e.what() << std::endl;
+        }
+    }
+    return entry.rsa.get();
+}
+
+void PublicKeyCache::remove(const std::string& identifier) {
+    std::string client_id = resolve(identifier);
+    entries_.erase(client_id);
+    for (std::map<std::string, std::string>::iterator it = aliases_.begin(); it != aliases_.end();) {
+        if (it->second == client_id) {
+            aliases_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    if (!path_.empty()) save();
+}
+
+bool PublicKeyCache::enablePersistence(const std::string& path) {
+    path_ = path;
+    return load();
+}
+
+bool PublicKeyCache::load() {
+    std::ifstream file(path_);
+    if (!file.is_open()) return true;  // Nothing saved yet
+    
+    // Lines: "key <client_id> <fetched> <pem>" and "alias <nickname> <client_id>", tab separated
+    std::string line;
+    size_t loaded = 0;
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t')) {
+            fields.push_back(unescapeField(field));
+        }
+        
+        if (fields.size() == 4 && fields[0] == "key" && isWellFormedPem(fields[3])) {
+            Entry& entry = entries_[fields[1]];
+            entry.client_id = fields[1];
+            entry.pem = fields[3];
+            entry.fetched = static_cast<std::time_t>(std::strtoll(fields[2].c_str(), nullptr, 10));
+            entry.decoded = false;
+            entry.rsa.reset();
+            loaded++;
+        } else if (fields.size() == 3 && fields[0] == "alias") {
+            aliases_[fields[1]] = fields[2];
+        }
+    }
+    std::cout << "Public key cache loaded: " << loaded << " keys from " << path_ << std::endl;
+    return true;
+}
+
+bool PublicKeyCache::save() const {
+    std::string temp_path = path_ + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Cannot write public key cache " << temp_path << std::endl;
+            return false;
+        }
+        for (std::map<std::string, Entry>::const_iterator it = entries_.begin(); it != entries_.end(); ++it) {
+            file << "key\t" << escapeField(it->first) << '\t' << static_cast<long long>(it->second.fetched)
+                 << '\t' << escapeField(it->second.pem) << '\n';
+        }
+        for (std::map<std::string, std::string>::const_iterator it = aliases_.begin(); it != aliases_.end(); ++it) {
+            file << "alias\t" << escapeField(it->first) << '\t' << escapeField(it->second) << '\n';
+        }
+        if (!file.flush()) {
+            std::cerr << "Cannot write public key cache " << temp_path << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(temp_path.c_str(), path_.c_str()) != 0) {
+        std::cerr << "Cannot replace public key cache " << path_ << std::endl;
+        return false;
+    }
+    return true;
+}
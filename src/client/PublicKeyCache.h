@@ -0,0 +1,65 @@
+#ifndef PUBLIC_KEY_CACHE_H
+#define PUBLIC_KEY_CACHE_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <ctime>
+#include <cryptopp/rsa.h>
+
+/**
+ * PublicKeyCache - Recipients' public keys, kept so key exchanges skip the server round trip
+ *
+ * Features:
+ * - Entries keyed by client ID; nicknames resolve through an alias table
+ * - Entries older than the TTL are dropped on lookup and fetched again
+ * - PEM is checked on insert (armor lines, base64 body); malformed keys are not cached
+ * - The RSA key object is decoded from the PEM at most once per entry, on first use
+ * - Optional text file persistence, rewritten through a temporary file on every change
+ */
+class PublicKeyCache {
+public:
+    static const long DEFAULT_TTL_SECONDS = 3600;
+    
+    struct Entry {
+        std::string client_id;
+        std::string pem;
+        std::time_t fetched;
+        mutable bool decoded;                                  // Decode attempted (result in rsa)
+        mutable std::shared_ptr<CryptoPP::RSA::PublicKey> rsa;  // Null if the PEM did not decode
+    };
+    
+    explicit PublicKeyCache(long ttl_seconds = DEFAULT_TTL_SECONDS);
+    
+    void setTtl(long ttl_seconds) { ttl_seconds_ = ttl_seconds; }
+    long ttl() const { return ttl_seconds_; }
+    
+    // Saves to path after every change; entries already in the file are loaded first
+    bool enablePersistence(const std::string& path);
+    
+    // Records the key returned for identifier (client ID or nickname); false if the PEM is malformed
+    bool put(const std::string& identifier, const std::string& client_id, const std::string& pem);
+    
+    // Fresh entry for a client ID or nickname, or nullptr; valid until the next change to the cache
+    const Entry* find(const std::string& identifier);
+    
+    // Parsed key, decoded on first call; nullptr if the PEM is not a valid X.509 RSA key
+    const CryptoPP::RSA::PublicKey* rsaKey(const Entry& entry) const;
+    
+    void remove(const std::string& identifier);
+    size_t size() const { return entries_.size(); }
+    
+    static bool isWellFormedPem(const std::string& pem);
+    
+private:
+    bool load();
+    bool save() const;
+    const std::string& resolve(const std::string& identifier) const;
+    
+    long ttl_seconds_;
+    std::map<std::string, Entry> entries_;        // client_id -> entry
+    std::map<std::string, std::string> aliases_;  // nickname -> client_id
+    std::string path_;                            // Empty = memory only
+};
+
+#endif // PUBLIC_KEY_CACHE_H
@@ -0,0 +1,254 @@
+#include "SecureArena.h"
+#include <atomic>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+    // Slot sizes of the shared arenas, smallest first; about 1.3 MiB locked in all
+    const size_t ARENA_COUNT = 3;
+    const size_t ARENA_SLOT_SIZES[ARENA_COUNT] = { 32, 4 * 1024, 64 * 1024 };
+    const size_t ARENA_SLOT_COUNTS[ARENA_COUNT] = { 256, 64, 16 };
+    
+    // Never destroyed: buffers held by static objects may still be released during exit
+    SecureArena* const* sharedArenas() {
+        static SecureArena* const arenas[ARENA_COUNT] = {
+            new SecureArena(ARENA_SLOT_SIZES[0], ARENA_SLOT_COUNTS[0]),
+            new SecureArena(ARENA_SLOT_SIZES[1], ARENA_SLOT_COUNTS[1]),
+            new SecureArena(ARENA_SLOT_SIZES[2], ARENA_SLOT_COUNTS[2])
+        };
+        return arenas;
+    }
+    
+    std::atomic<size_t> heap_blocks(0);  // SecureBuffer blocks that did not fit an arena
+    std::atomic<size_t> table_pages(0);    // LockedAllocator pages in use, locked or not
+    std::atomic<size_t> refused_pages(0);  // LockedAllocator pages mlock refused, since startup
+    
+    size_t pageSize() {
+        long page = ::sysconf(_SC_PAGESIZE);
+        return page > 0 ? static_cast<size_t>(page) : 4096;
+    }
+    
+    size_t roundToPages(size_t size) {
+        size_t page = pageSize();
+        return (std::max<size_t>(size, 1) + page - 1) / page * page;
+    }
+    
+    // Bytes past size are zero already, so only size bytes need wiping
+    void releaseBlock(uint8_t* data, size_t size, SecureArena* arena) {
+        if (arena) {
+            arena->release(data, size);
+        } else if (data) {
+            SecureArena::wipe(data, size);
+            delete[] data;
+        }
+    }
+}
+
+SecureArena::SecureArena(size_t slot_size, size_t slot_count)
+    : base_(nullptr), mapped_size_(0), slot_size_(slot_size), slot_count_(0), locked_(false) {
+    size_t bytes = slot_size * slot_count;
+    size_t mapped_size = bytes > 0 ? roundToPages(bytes) : 0;
+    
+    void* region = mapped_size > 0
+        ? ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)
+        : MAP_FAILED;
+    if (region != MAP_FAILED) {
+        // Anonymous pages start zeroed, so every slot is clean before its first use
+        base_ = static_cast<uint8_t*>(region);
+        mapped_size_ = mapped_size;
+        slot_count_ = slot_count;
+        locked_ = ::mlock(base_, mapped_size_) == 0;
+#ifdef MADV_DONTDUMP
+        ::madvise(base_, mapped_size_, MADV_DONTDUMP);
+#endif
+    }
+    
+    // Lowest slots on top, so a quiet client touches few pages
+    free_slots_.reserve(slot_count_);
+    for (size_t i = slot_count_; i > 0; i--) {
+        free_slots_.push_back(static_cast<uint32_t>(i - 1));
+    }
+    
+    stats_.slot_size = slot_size_;
+    stats_.slot_count = slot_count_;
+    stats_.in_use = 0;
+    stats_.peak = 0;
+    stats_.exhausted = 0;
+    stats_.locked = locked_;
+}
+
+SecureArena::~SecureArena() {
+    if (!base_) return;
+    wipe(base_, mapped_size_);
+    if (locked_) ::munlock(base_, mapped_size_);
+    ::munmap(base_, mapped_size_);
+}
+
+uint8_t* SecureArena::allocate() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_slots_.empty()) {
+        stats_.exhausted++;
+        return nullptr;
+    }
+    uint32_t index = free_slots_.back();
+    free_slots_.pop_back();
+    if (++stats_.in_use > stats_.peak) stats_.peak = stats_.in_use;
+    return base_ + static_cast<size_t>(index) * slot_size_;
+}
+
+void SecureArena::release(uint8_t* slot, size_t used) {
+    // The slot is still ours alone, so it is wiped before taking the lock
+    wipe(slot, std::min(used, slot_size_));
+    
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_.push_back(static_cast<uint32_t>((slot - base_) / slot_size_));
+    stats_.in_use--;
+}
+
+bool SecureArena::owns(const uint8_t* data) const {
+    return base_ && data >= base_ && data < base_ + slot_count_ * slot_size_;
+}
+
+SecureArena::Stats SecureArena::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void SecureArena::wipe(void* data, size_t size) {
+    // Called through a volatile pointer, so the store cannot be proven dead and dropped
+    static void* (*const volatile zero)(void*, int, size_t) = std::memset;
+    zero(data, 0, size);
+}
+
+void* SecureArena::allocatePages(size_t size) {
+    size_t mapped_size = roundToPages(size);
+    void* region = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) return nullptr;
+    
+    // Like the arenas, a block the lock limit does not cover is still handed out, and counted
+    size_t pages = mapped_size / pageSize();
+    table_pages += pages;
+    if (::mlock(region, mapped_size) != 0) refused_pages += pages;
+#ifdef MADV_DONTDUMP
+    ::madvise(region, mapped_size, MADV_DONTDUMP);
+#endif
+    return region;
+}
+
+void SecureArena::releasePages(void* data, size_t size) {
+    if (!data) return;
+    size_t mapped_size = roundToPages(size);
+    wipe(data, mapped_size);
+    table_pages -= mapped_size / pageSize();
+    ::munlock(data, mapped_size);  // Harmless for pages that were never locked
+    ::munmap(data, mapped_size);
+}
+
+SecureBuffer::SecureBuffer() : data_(nullptr), size_(0), capacity_(0), arena_(nullptr) {
+}
+
+SecureBuffer::SecureBuffer(size_t size) : data_(nullptr), size_(0), capacity_(0), arena_(nullptr) {
+    resize(size);
+}
+
+SecureBuffer::SecureBuffer(const uint8_t* data, size_t size) : data_(nullptr), size_(0), capacity_(0), arena_(nullptr) {
+    assign(data, size);
+}
+
+SecureBuffer::~SecureBuffer() {
+    clear();
+}
+
+SecureBuffer::SecureBuffer(SecureBuffer&& other)
+    : data_(other.data_), size_(other.size_), capacity_(other.capacity_), arena_(other.arena_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+    other.arena_ = nullptr;
+}
+
+SecureBuffer& SecureBuffer::operator=(SecureBuffer&& other) {
+    if (this != &other) {
+        clear();
+        data_ = other.data_;
+        size_ = other.size_;
+        capacity_ = other.capacity_;
+        arena_ = other.arena_;
+        other.data_ = nullptr;
+        other.size_ = 0;
+        other.capacity_ = 0;
+        other.arena_ = nullptr;
+    }
+    return *this;
+}
+
+void SecureBuffer::resize(size_t size) {
+    if (size > capacity_) {
+        reserve(size);
+    } else if (size < size_) {
+        SecureArena::wipe(data_ + size, size_ - size);
+    }
+    size_ = size;
+}
+
+void SecureBuffer::assign(const uint8_t* data, size_t size) {
+    resize(0);
+    resize(size);
+    if (size > 0) std::memcpy(data_, data, size);
+}
+
+void SecureBuffer::clear() {
+    releaseBlock(data_, size_, arena_);
+    data_ = nullptr;
+    size_ = 0;
+    capacity_ = 0;
+    arena_ = nullptr;
+}
+
+void SecureBuffer::reserve(size_t capacity) {
+    // Smallest arena with a free slot that fits, else a zeroed heap block
+    SecureArena* const* arenas = sharedArenas();
+    SecureArena* arena = nullptr;
+    uint8_t* block = nullptr;
+    for (size_t i = 0; i < ARENA_COUNT && !block; i++) {
+        if (arenas[i]->slotSize() < capacity) continue;
+        block = arenas[i]->allocate();
+        if (block) {
+            arena = arenas[i];
+            capacity = arena->slotSize();
+        }
+    }
+    if (!block) {
+        block = new uint8_t[capacity]();
+        heap_blocks++;
+    }
+    
+    if (size_ > 0) std::memcpy(block, data_, size_);
+    releaseBlock(data_, size_, arena_);
+    data_ = block;
+    capacity_ = capacity;
+    arena_ = arena;
+}
+
+std::string SecureBuffer::report() {
+    SecureArena* const* arenas = sharedArenas();
+    std::ostringstream report;
+    for (size_t i = 0; i < ARENA_COUNT; i++) {
+        SecureArena::Stats stats = arenas[i]->stats();
+        if (i > 0) report << ", ";
+        if (stats.slot_size >= 1024) {
+            report << stats.slot_size / 1024 << " KiB";
+        } else {
+            report << stats.slot_size << " B";
+        }
+        report << " x " << stats.slot_count << " (" << (stats.locked ? "locked" : "not locked")
+               << ", peak " << stats.peak << " in use)";
+    }
+    report << "; key tables " << table_pages << " pages";
+    if (refused_pages > 0) report << " (lock refused for " << refused_pages << ")";
+    report << "; " << heap_blocks << " heap blocks";
+    return report.str();
+}
@@ -0,0 +1,153 @@
+#ifndef SECURE_ARENA_H
+#define SECURE_ARENA_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <new>
+
+/**
+ * SecureArena - Fixed-size slots in one locked region, for keys and plaintext
+ *
+ * Features:
+ * - One anonymous mapping per arena, locked into RAM (mlock) and left out of core dumps
+ * - Allocation and release are O(1): a stack of free slot indices, filled at construction
+ * - Slots are wiped on release, so a free slot never holds old secrets
+ * - Thread-safe (decrypt workers and the main thread share the arenas)
+ * - allocatePages() maps single locked blocks for LockedAllocator
+ *
+ * If the lock limit (RLIMIT_MEMLOCK) is too low the arena still works, unlocked;
+ * isLocked() says which. The arena must outlive every slot handed out.
+ */
+class SecureArena {
+public:
+    struct Stats {
+        size_t slot_size;
+        size_t slot_count;
+        size_t in_use;
+        size_t peak;       // Most slots in use at once
+        size_t exhausted;  // allocate() calls that found no free slot
+        bool locked;
+    };
+    
+    SecureArena(size_t slot_size, size_t slot_count);
+    ~SecureArena();
+    
+    // slotSize() zeroed bytes, or nullptr when every slot is taken
+    uint8_t* allocate();
+    // Wipes the slot and makes it free again; slot must come from this arena.
+    // Only the first used bytes are wiped when the caller knows the rest is still zero.
+    void release(uint8_t* slot, size_t used = SIZE_MAX);
+    
+    bool owns(const uint8_t* data) const;
+    size_t slotSize() const { return slot_size_; }
+    bool isLocked() const { return locked_; }
+    Stats stats() const;
+    
+    // Zeroes memory in a way the compiler may not drop as a dead store
+    static void wipe(void* data, size_t size);
+    
+    // A mapping of its own for size bytes, locked and left out of core dumps when the limit allows;
+    // nullptr if it cannot be mapped. releasePages wipes it before unmapping.
+    static void* allocatePages(size_t size);
+    static void releasePages(void* data, size_t size);
+    
+private:
+    SecureArena(const SecureArena&);
+    SecureArena& operator=(const SecureArena&);
+    
+    uint8_t* base_;
+    size_t mapped_size_;
+    size_t slot_size_;
+    size_t slot_count_;
+    bool locked_;
+    mutable std::mutex mutex_;
+    std::vector<uint32_t> free_slots_;  // Stack of free slot indices
+    Stats stats_;
+};
+
+/**
+ * SecureBuffer - Move-only byte buffer for key material and plaintext
+ *
+ * Features:
+ * - Backed by the smallest shared SecureArena whose slots fit: 32 bytes (keys),
+ *   4 KiB (text messages) or 64 KiB (file chunks)
+ * - Larger buffers, or any buffer when the arena is full, come from the heap and are still wiped
+ * - Bytes past size() are always zero, so growing within the block needs no fill
+ * - Everything is wiped when the buffer shrinks, moves to a larger block or goes away
+ */
+class SecureBuffer {
+public:
+    SecureBuffer();
+    explicit SecureBuffer(size_t size);  // Zeroed
+    SecureBuffer(const uint8_t* data, size_t size);
+    ~SecureBuffer();
+    SecureBuffer(SecureBuffer&& other);
+    SecureBuffer& operator=(SecureBuffer&& other);
+    
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+    uint8_t& operator[](size_t index) { return data_[index]; }
+    uint8_t operator[](size_t index) const { return data_[index]; }
+    uint8_t back() const { return data_[size_ - 1]; }
+    
+    // New bytes are zero; growing past capacity() copies into a larger block and wipes the old one
+    void resize(size_t size);
+    void assign(const uint8_t* data, size_t size);
+    void clear();  // Wipes and gives the block back
+    
+    // Slot use and lock state of the shared arenas and of LockedAllocator pages, plus heap
+    // fallbacks, for diagnostics
+    static std::string report();
+    
+private:
+    SecureBuffer(const SecureBuffer&);
+    SecureBuffer& operator=(const SecureBuffer&);
+    
+    void reserve(size_t capacity);
+    
+    uint8_t* data_;
+    size_t size_;
+    size_t capacity_;
+    SecureArena* arena_;  // nullptr for heap blocks
+};
+
+/**
+ * LockedAllocator - Standard allocator for long-lived tables of key material
+ *
+ * Features:
+ * - Every block is a mapping of its own (SecureArena::allocatePages): locked, not dumped
+ * - Blocks are wiped before they are unmapped, so a table that grows leaves nothing behind
+ *
+ * Each block costs at least a page and a system call, so it suits a few tables that grow
+ * rarely (the key store, the decrypt workers' contexts); per-message buffers use SecureBuffer.
+ */
+template <typename T>
+class LockedAllocator {
+public:
+    typedef T value_type;
+    
+    LockedAllocator() {}
+    template <typename U> LockedAllocator(const LockedAllocator<U>&) {}
+    
+    T* allocate(size_t count) {
+        void* block = SecureArena::allocatePages(count * sizeof(T));
+        if (!block) throw std::bad_alloc();
+        return static_cast<T*>(block);
+    }
+    void deallocate(T* data, size_t count) { SecureArena::releasePages(data, count * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const LockedAllocator<T>&, const LockedAllocator<U>&) { return true; }
+template <typename T, typename U>
+bool operator!=(const LockedAllocator<T>&, const LockedAllocator<U>&) { return false; }
+
+#endif // SECURE_ARENA_H
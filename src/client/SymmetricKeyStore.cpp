@@ -0,0 +1,122 @@
+#include "SymmetricKeyStore.h"
+#include <cstring>
+
+SymmetricKeyStore::SymmetricKeyStore()
+    : slots_(MIN_CAPACITY), mask_(MIN_CAPACITY - 1), count_(0), context_count_(0) {
+    std::memset(slots_.data(), 0, slots_.size() * sizeof(Entry));
+}
+
+SymmetricKeyStore::~SymmetricKeyStore() {
+    LockedAllocator<ContextBlock> allocator;
+    for (size_t i = 0; i < context_blocks_.size(); i++) {
+        context_blocks_[i]->~ContextBlock();
+        allocator.deallocate(context_blocks_[i], 1);
+    }
+}
+
+uint32_t SymmetricKeyStore::takeContext() {
+    if (!free_contexts_.empty()) {
+        uint32_t index = free_contexts_.back();
+        free_contexts_.pop_back();
+        return index;
+    }
+    
+    if (context_count_ == context_blocks_.size() * CONTEXTS_PER_BLOCK) {
+        LockedAllocator<ContextBlock> allocator;
+        ContextBlock* block = allocator.allocate(1);
+        context_blocks_.push_back(new (block) ContextBlock());
+    }
+    return static_cast<uint32_t>(context_count_++);
+}
+
+size_t SymmetricKeyStore::hashId(const uint8_t* id) {
+    // Client IDs are already well mixed (hex of a digest); fold the two halves and spread them
+    uint64_t low, high;
+    std::memcpy(&low, id, sizeof(low));
+    std::memcpy(&high, id + sizeof(low), sizeof(high));
+    uint64_t hash = (low ^ (high << 29 | high >> 35)) * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(hash ^ (hash >> 32));
+}
+
+size_t SymmetricKeyStore::findSlot(const uint8_t* id) const {
+    size_t i = hashId(id) & mask_;
+    while (slots_[i].used && std::memcmp(slots_[i].id, id, ID_SIZE) != 0) {
+        i = (i + 1) & mask_;
+    }
+    return i;
+}
+
+SymmetricKeyStore::Entry* SymmetricKeyStore::find(const uint8_t* id) {
+    Entry& entry = slots_[findSlot(id)];
+    return entry.used ? &entry : nullptr;
+}
+
+const SymmetricKeyStore::Entry* SymmetricKeyStore::find(const uint8_t* id) const {
+    const Entry& entry = slots_[findSlot(id)];
+    return entry.used ? &entry : nullptr;
+}
+
+SymmetricKeyStore::Entry* SymmetricKeyStore::insert(const uint8_t* id, const uint8_t* key) {
+    // Keep the load factor at or below 3/4 so probe runs stay short
+    if ((count_ + 1) * 4 > slots_.size() * 3) {
+        grow();
+    }
+    
+    Entry& entry = slots_[findSlot(id)];
+    if (!entry.used) {
+        std::memcpy(entry.id, id, ID_SIZE);
+        entry.used = 1;
+        entry.context = takeContext();
+        count_++;
+    }
+    
+    // Expand the key schedules once, here, rather than per message
+    if (!context(entry).setKey(key, KEY_SIZE)) {
+        remove(id);
+        return nullptr;
+    }
+    std::memcpy(entry.key, key, KEY_SIZE);
+    entry.flags = 0;
+    return &entry;
+}
+
+bool SymmetricKeyStore::remove(const uint8_t* id) {
+    size_t hole = findSlot(id);
+    if (!slots_[hole].used) return false;
+    
+    free_contexts_.push_back(slots_[hole].context);
+    count_--;
+    
+    // Backward-shift deletion: pull later entries of the probe run into the hole
+    // unless their home slot lies cyclically after the hole
+    size_t next = hole;
+    while (true) {
+        next = (next + 1) & mask_;
+        if (!slots_[next].used) break;
+        
+        size_t home = hashId(slots_[next].id) & mask_;
+        bool stays = (hole <= next) ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!stays) {
+            slots_[hole] = slots_[next];
+            hole = next;
+        }
+    }
+    
+    // Leave no key material behind in the freed slot
+    std::memset(&slots_[hole], 0, sizeof(Entry));
+    return true;
+}
+
+void SymmetricKeyStore::grow() {
+    SlotArray old(slots_.size() * 2);
+    std::memset(old.data(), 0, old.size() * sizeof(Entry));
+    old.swap(slots_);
+    mask_ = slots_.size() - 1;
+    
+    for (size_t i = 0; i < old.size(); i++) {
+        if (old[i].used) {
+            slots_[findSlot(old[i].id)] = old[i];
+        }
+    }
+    // The old table is wiped as its pages are given back
+}
@@ -0,0 +1,89 @@
+#ifndef SYMMETRIC_KEY_STORE_H
+#define SYMMETRIC_KEY_STORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "AesContext.h"
+#include "SecureArena.h"
+
+/**
+ * SymmetricKeyStore - Flat hash table of per-peer AES keys, keyed by 16-byte client ID
+ *
+ * Features:
+ * - Open addressing with linear probing over one contiguous slot array
+ * - Client ID, key and mode flags are stored inline in the slot; no allocation per peer
+ * - Lookups hash the ID as two 64-bit words and return pointers into the table, never copies
+ * - Removal shifts the rest of the probe run back, so there are no tombstones to clean up
+ * - Expanded AesContexts live in a side pool of fixed blocks and keep their address while the table grows
+ * - Slots and context blocks are in locked, undumpable pages (LockedAllocator), wiped when freed
+ *
+ * Entry pointers are valid until the next insert or remove; context references until
+ * that peer's entry is removed.
+ */
+class SymmetricKeyStore {
+public:
+    static const size_t ID_SIZE = 16;
+    static const size_t KEY_SIZE = AesContext::KEY_SIZE;
+    
+    // Per-peer message mode flags
+    static const uint8_t GCM_PEER = 0x01;    // Key exchange announced AES-GCM support
+    static const uint8_t GCM_SENDER = 0x02;  // Seen sending AES-GCM; CBC from them is refused
+    
+    struct Entry {
+        uint8_t id[ID_SIZE];
+        uint8_t key[KEY_SIZE];
+        uint8_t used;
+        uint8_t flags;
+        uint32_t context;  // Index into the context pool
+    };
+    
+    SymmetricKeyStore();
+    ~SymmetricKeyStore();
+    
+    // nullptr when the peer has no key
+    Entry* find(const uint8_t* id);
+    const Entry* find(const uint8_t* id) const;
+    
+    // Adds or replaces the peer's key and expands it; flags are cleared. nullptr if the key is rejected.
+    Entry* insert(const uint8_t* id, const uint8_t* key);
+    bool remove(const uint8_t* id);
+    
+    AesContext& context(const Entry& entry) {
+        return context_blocks_[entry.context / CONTEXTS_PER_BLOCK]->contexts[entry.context % CONTEXTS_PER_BLOCK];
+    }
+    
+    size_t size() const { return count_; }
+    size_t capacity() const { return slots_.size(); }
+    
+    // For walking every entry: slots 0..capacity()-1, nullptr where empty
+    const Entry* slotAt(size_t index) const { return slots_[index].used ? &slots_[index] : nullptr; }
+    
+private:
+    static const size_t MIN_CAPACITY = 64;  // Power of two
+    static const size_t CONTEXTS_PER_BLOCK = 16;
+    
+    // Contexts are allocated a block at a time, so a peer costs a fraction of a locked page
+    struct ContextBlock {
+        AesContext contexts[CONTEXTS_PER_BLOCK];
+    };
+    
+    SymmetricKeyStore(const SymmetricKeyStore&);
+    SymmetricKeyStore& operator=(const SymmetricKeyStore&);
+    
+    uint32_t takeContext();
+    static size_t hashId(const uint8_t* id);
+    size_t findSlot(const uint8_t* id) const;  // Slot holding id, or the empty slot ending its probe run
+    void grow();
+    
+    typedef std::vector<Entry, LockedAllocator<Entry> > SlotArray;
+    
+    SlotArray slots_;
+    size_t mask_;
+    size_t count_;
+    std::vector<ContextBlock*> context_blocks_;  // Stable addresses; AesContext is not copyable
+    size_t context_count_;                      // Contexts handed out, in use or free
+    std::vector<uint32_t> free_contexts_;       // Pool slots left behind by removed peers
+};
+
+#endif // SYMMETRIC_KEY_STORE_H
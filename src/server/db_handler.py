@@ -7,18 +7,50 @@ Features:
 - Client registration and management
 - Message storage and retrieval
 - Automatic table creation
+- Schema migrations tracked in PRAGMA user_version
+- Idempotent file chunk storage, keyed by the sender's chunk IDs while the chunk is undelivered
 - Retry logic for database locks
 """
 
 import sqlite3
 import os
+import base64
+import binascii
 import threading
-from typing import Optional, List, Dict, Any
+import time
+from typing import Optional, List, Dict, Any, Tuple
+
+# Schema version stored in PRAGMA user_version
+# 0: message content stored as base64 TEXT
+# 1: message content stored as raw BLOB
+# 2: file_chunks rows point at the message carrying the chunk
+SCHEMA_VERSION = 2
+
+# Chunk IDs are remembered this long after the chunk was stored, so interrupted transfers can resume
+FILE_CHUNK_RETENTION_DAYS = 7
+
+# Expired and delivered chunk IDs are pruned on insert, at most this often
+FILE_CHUNK_PRUNE_INTERVAL = 3600
+
+# SQLite's default limit on bound parameters is 999; lookups are split below it
+MAX_QUERY_PARAMETERS = 900
+
+
+def _decode_legacy_content(content):
+    """Raw bytes for a message stored by a schema 0 server (base64 text)."""
+    if isinstance(content, bytes):
+        return content
+    try:
+        return base64.b64decode(content, validate=True)
+    except (binascii.Error, ValueError, TypeError):
+        # Not base64 after all; keep the stored text bytes rather than lose the row
+        return str(content).encode('utf-8')
 
 class DatabaseHandler:
     def __init__(self, db_path: str = "defensive.db"):
         self.db_path = db_path
         self._local = threading.local()  # Thread-local storage
+        self._next_prune = 0.0  # time.monotonic() after which an insert prunes file_chunks
         self.initialize_database()
     
     def _get_connection(self):
@@ -32,6 +64,7 @@ class DatabaseHandler:
         try:
             conn = sqlite3.connect(self.db_path)
             self.create_tables(conn)
+            self.prune_file_chunks(conn)
             conn.close()
             print(f"Database initialized: {self.db_path}")
         except sqlite3.Error as e:
@@ -63,16 +96,77 @@ class DatabaseHandler:
                 from_client_id TEXT NOT NULL,
                 to_client_id TEXT NOT NULL,
                 message_type INTEGER NOT NULL,
-                content TEXT NOT NULL,
+                content BLOB NOT NULL,
                 created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
                 FOREIGN KEY (from_client_id) REFERENCES clients (client_id),
                 FOREIGN KEY (to_client_id) REFERENCES clients (client_id)
             )
         ''')
         
+        # Create file chunks table: which chunks each sender has stored for a recipient, so a resumed
+        # transfer does not send them twice. A chunk counts as stored only while its message waits:
+        # once delivered, the recipient may have lost it (a restart drops incomplete files)
+        cursor.execute('''
+            CREATE TABLE IF NOT EXISTS file_chunks (
+                from_client_id TEXT NOT NULL,
+                to_client_id TEXT NOT NULL,
+                chunk_id BLOB NOT NULL,
+                message_id INTEGER,
+                stored_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                PRIMARY KEY (from_client_id, to_client_id, chunk_id)
+            )
+        ''')
+        
         conn.commit()
+        self.migrate(conn)
         print("Database tables created/verified")
     
+    def migrate(self, conn):
+        """Bring an existing database up to SCHEMA_VERSION."""
+        version = conn.execute('PRAGMA user_version').fetchone()[0]
+        if version >= SCHEMA_VERSION:
+            return
+        
+        columns = {row[1]: row[2].upper() for row in conn.execute('PRAGMA table_info(messages)')}
+        if version < 1 and columns.get('content') != 'BLOB':
+            # SQLite cannot change a column type in place: copy into a table with a BLOB
+            # column, decoding the base64 text on the way, and swap the tables
+            conn.create_function('legacy_content', 1, _decode_legacy_content)
+            with conn:
+                conn.execute('BEGIN')  # Table swap included, so a crash leaves the old table intact
+                conn.execute('DROP TABLE IF EXISTS messages_migrating')
+                conn.execute('''
+                    CREATE TABLE messages_migrating (
+                        id INTEGER PRIMARY KEY AUTOINCREMENT,
+                        from_client_id TEXT NOT NULL,
+                        to_client_id TEXT NOT NULL,
+                        message_type INTEGER NOT NULL,
+                        content BLOB NOT NULL,
+                        created_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+                        FOREIGN KEY (from_client_id) REFERENCES clients (client_id),
+                        FOREIGN KEY (to_client_id) REFERENCES clients (client_id)
+                    )
+                ''')
+                migrated = conn.execute('''
+                    INSERT INTO messages_migrating (id, from_client_id, to_client_id, message_type, content, created_at)
+                    SELECT id, from_client_id, to_client_id, message_type, legacy_content(content), created_at
+                    FROM messages
+                ''').rowcount
+                conn.execute('DROP TABLE messages')
+                conn.execute('ALTER TABLE messages_migrating RENAME TO messages')
+            print(f"Migrated {migrated} waiting messages to binary content")
+        
+        chunk_columns = {row[1] for row in conn.execute('PRAGMA table_info(file_chunks)')}
+        if version < 2 and 'message_id' not in chunk_columns:
+            # Older rows do not say which message holds the chunk; they count as not stored and are pruned
+            with conn:
+                conn.execute('ALTER TABLE file_chunks ADD COLUMN message_id INTEGER')
+        
+        # New databases are created with the current schema and only need the version recorded.
+        # PRAGMA does not take parameters; the version is our own constant
+        conn.execute(f'PRAGMA user_version = {SCHEMA_VERSION}')
+        conn.commit()
+    
     def register_client(self, client_id: str, name: str, public_key: str) -> bool:
         """Register a new client in the database."""
         try:
@@ -170,7 +264,7 @@ class DatabaseHandler:
                 FROM messages m
                 LEFT JOIN clients c ON m.from_client_id = c.client_id
                 WHERE m.to_client_id = ?
-                ORDER BY m.created_at ASC
+                ORDER BY m.id ASC
             ''', (to_client_id,))
             rows = cursor.fetchall()
             return [
@@ -189,6 +283,37 @@ class DatabaseHandler:
             print(f"Database error getting waiting messages: {e}")
             return []
     
+    def get_waiting_messages_page(self, to_client_id: str, after_id: int, limit: int) -> List[Dict[str, Any]]:
+        """Get up to limit waiting messages with an ID greater than after_id, oldest first."""
+        try:
+            conn = self._get_connection()
+            cursor = conn.cursor()
+            cursor.execute('''
+                SELECT m.id, m.from_client_id, m.to_client_id, m.message_type, m.content, m.created_at,
+                       c.name as sender_name
+                FROM messages m
+                LEFT JOIN clients c ON m.from_client_id = c.client_id
+                WHERE m.to_client_id = ? AND m.id > ?
+                ORDER BY m.id ASC
+                LIMIT ?
+            ''', (to_client_id, after_id, limit))
+            rows = cursor.fetchall()
+            return [
+                {
+                    'id': row[0],
+                    'from_client_id': row[1],
+                    'to_client_id': row[2],
+                    'message_type': row[3],
+                    'content': row[4],
+                    'created_at': row[5],
+                    'sender_name': row[6] if row[6] else 'Unknown'
+                }
+                for row in rows
+            ]
+        except sqlite3.Error as e:
+            print(f"Database error getting waiting messages page: {e}")
+            return []
+    
     def delete_messages(self, message_ids: List[int]) -> bool:
         """Delete messages by their IDs (mark as delivered)."""
         if not message_ids:
@@ -221,15 +346,15 @@ class DatabaseHandler:
         
         return False
     
-    def store_message(self, from_client_id: str, to_client_id: str, message_type: int, content: str) -> bool:
-        """Store a new message in the database."""
+    def store_message(self, from_client_id: str, to_client_id: str, message_type: int, content: bytes) -> bool:
+        """Store a new message in the database (content is the raw ciphertext or wrapped key)."""
         try:
             conn = self._get_connection()
             cursor = conn.cursor()
             cursor.execute('''
                 INSERT INTO messages (from_client_id, to_client_id, message_type, content)
                 VALUES (?, ?, ?, ?)
-            ''', (from_client_id, to_client_id, message_type, content))
+            ''', (from_client_id, to_client_id, message_type, sqlite3.Binary(content)))
             conn.commit()
             print(f"Message stored: from {from_client_id} to {to_client_id}")
             return True
@@ -237,6 +362,100 @@ class DatabaseHandler:
             print(f"Database error storing message: {e}")
             return False
     
+    def store_messages(self, messages: List[Tuple[str, str, int, bytes]]) -> bool:
+        """Store many messages in one transaction; either all of them are stored or none.
+        Each entry is (from_client_id, to_client_id, message_type, content).
+        """
+        if not messages:
+            return True
+        
+        conn = self._get_connection()
+        try:
+            with conn:  # One commit for the whole batch, rolled back on error
+                conn.executemany('''
+                    INSERT INTO messages (from_client_id, to_client_id, message_type, content)
+                    VALUES (?, ?, ?, ?)
+                ''', [(from_id, to_id, message_type, sqlite3.Binary(content))
+                      for from_id, to_id, message_type, content in messages])
+            print(f"Stored {len(messages)} messages in one transaction")
+            return True
+        except sqlite3.Error as e:
+            print(f"Database error storing messages: {e}")
+            return False
+    
+    def store_file_chunk(self, from_client_id: str, to_client_id: str, message_type: int,
+                         chunk_id: bytes, content: bytes) -> bool:
+        """Store one file chunk unless the same chunk ID is still waiting for the recipient.
+        Returns True when the chunk is stored, whether now or by an earlier attempt.
+        """
+        self._prune_file_chunks_if_due()
+        conn = self._get_connection()
+        try:
+            with conn:  # The chunk ID and the message are recorded together or not at all
+                waiting = conn.execute('''
+                    SELECT 1 FROM file_chunks f JOIN messages m ON m.id = f.message_id
+                    WHERE f.from_client_id = ? AND f.to_client_id = ? AND f.chunk_id = ?
+                ''', (from_client_id, to_client_id, sqlite3.Binary(chunk_id))).fetchone()
+                if not waiting:
+                    # New, or delivered already: stored again, since the recipient may have lost it
+                    message_id = conn.execute('''
+                        INSERT INTO messages (from_client_id, to_client_id, message_type, content)
+                        VALUES (?, ?, ?, ?)
+                    ''', (from_client_id, to_client_id, message_type, sqlite3.Binary(content))).lastrowid
+                    conn.execute('''
+                        INSERT OR REPLACE INTO file_chunks (from_client_id, to_client_id, chunk_id, message_id)
+                        VALUES (?, ?, ?, ?)
+                    ''', (from_client_id, to_client_id, sqlite3.Binary(chunk_id), message_id))
+            if waiting:
+                print(f"File chunk already stored: from {from_client_id} to {to_client_id}")
+            return True
+        except sqlite3.Error as e:
+            print(f"Database error storing file chunk: {e}")
+            return False
+    
+    def get_stored_chunk_ids(self, from_client_id: str, to_client_id: str, chunk_ids: List[bytes]) -> Optional[set]:
+        """Subset of chunk_ids stored for this sender and recipient and not yet delivered, None on error."""
+        try:
+            conn = self._get_connection()
+            stored = set()
+            step = MAX_QUERY_PARAMETERS - 2
+            for start in range(0, len(chunk_ids), step):
+                group = chunk_ids[start:start + step]
+                placeholders = ','.join(['?' for _ in group])
+                rows = conn.execute(f'''
+                    SELECT f.chunk_id FROM file_chunks f JOIN messages m ON m.id = f.message_id
+                    WHERE f.from_client_id = ? AND f.to_client_id = ? AND f.chunk_id IN ({placeholders})
+                ''', [from_client_id, to_client_id] + [sqlite3.Binary(chunk_id) for chunk_id in group]).fetchall()
+                stored.update(bytes(row[0]) for row in rows)
+            return stored
+        except sqlite3.Error as e:
+            print(f"Database error looking up file chunks: {e}")
+            return None
+    
+    def _prune_file_chunks_if_due(self):
+        """Prune from the insert path, at most once per FILE_CHUNK_PRUNE_INTERVAL."""
+        now = time.monotonic()
+        if now < self._next_prune:
+            return
+        self._next_prune = now + FILE_CHUNK_PRUNE_INTERVAL  # Racing threads at worst prune twice
+        self.prune_file_chunks()
+    
+    def prune_file_chunks(self, conn=None):
+        """Forget chunk IDs older than FILE_CHUNK_RETENTION_DAYS or whose message was delivered."""
+        if conn is None:
+            conn = self._get_connection()
+        try:
+            with conn:
+                pruned = conn.execute('''
+                    DELETE FROM file_chunks
+                    WHERE stored_at < datetime('now', ?)
+                       OR NOT EXISTS (SELECT 1 FROM messages m WHERE m.id = file_chunks.message_id)
+                ''', (f'-{FILE_CHUNK_RETENTION_DAYS} days',)).rowcount
+            if pruned:
+                print(f"Pruned {pruned} expired or delivered file chunk records")
+        except sqlite3.Error as e:
+            print(f"Database error pruning file chunks: {e}")
+    
     def update_last_seen(self, client_id: str):
         """Update the last_seen timestamp for a client."""
         try:
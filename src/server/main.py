@@ -17,12 +17,23 @@ import threading
 import sys
 import os
 from db_handler import DatabaseHandler
-from protocol_handler import ProtocolHandler, ProtocolCodes
+from protocol_handler import (ProtocolHandler, ProtocolCodes, ProtocolVersions, MAX_SUPPORTED_VERSION,
+                              MIN_HEADER_SIZE, FLAG_CONTINUATION, MAX_MESSAGE_SIZE, MAX_PAYLOAD_V1,
+                              MESSAGES_PAGE_HEADER_SIZE, SUPPORTED_FEATURES, CLIENT_ID_SIZE, USERNAME_SIZE,
+                              PUBLIC_KEY_SIZE, MAX_BATCH_ENTRIES, BatchStatus, MessageTypes, CHUNK_ID_SIZE,
+                              MAX_CHUNK_QUERY, frame_checksum)
 import struct
 
 # Add the server directory to the path for imports
 sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
 
+# Clients keep one session open across requests; idle sessions are closed after this many seconds
+CLIENT_IDLE_TIMEOUT = 300
+
+# Upper bounds on one page of waiting messages, whatever budget the client asks for
+MAX_PAGE_MESSAGES = 256
+MAX_PAGE_BYTES = 4 * 1024 * 1024
+
 class MessageUServer:
     def __init__(self):
         self.host = '0.0.0.0'
@@ -122,34 +133,26 @@ class MessageUServer:
     def handle_client(self, client_socket, client_address):
         """Handle communication with a client."""
         print(f"Handling client: {client_address}")
+        client_socket.settimeout(CLIENT_IDLE_TIMEOUT)
+        
+        # Each session starts with the padded field encoding until features are negotiated
+        self.protocol_handler.set_session_features(0)
         
         try:
             while self.running:
-                # Read header first (9 bytes)
-                header = b''
-                while len(header) < 9:
-                    chunk = client_socket.recv(9 - len(header))
-                    if not chunk:
-                        print(f"Client {client_address} disconnected")
-                        return
-                    header += chunk
-
-                version, code, payload_size, checksum = struct.unpack('<BHHI', header)
-
-                # Now read the payload
-                payload = b''
-                while len(payload) < payload_size:
-                    chunk = client_socket.recv(payload_size - len(payload))
-                    if not chunk:
-                        print(f"Client {client_address} disconnected")
-                        return
-                    payload += chunk
-
-                # Now process the request
-                full_data = header + payload
-                code, payload = self.protocol_handler.parse_request(full_data)
-                if not code:
-                    print(f"Invalid request from {client_address}")
+                request = self.receive_request(client_socket, client_address)
+                if request is None:
+                    return
+                
+                version, code, payload, checksum_ok = request
+                
+                # Answer with the same header version the client used
+                self.protocol_handler.set_response_version(version)
+                
+                # Corrupt requests are rejected before any field is parsed; framing is still intact
+                if not checksum_ok:
+                    print(f"Checksum mismatch in request {code} from {client_address}")
+                    client_socket.sendall(self.protocol_handler.create_error_response("Checksum mismatch"))
                     continue
                 
                 # Handle the request based on protocol code
@@ -157,13 +160,77 @@ class MessageUServer:
                 
                 # Send response back to client
                 if response:
-                    client_socket.send(response)
+                    client_socket.sendall(response)
                     
+        except socket.timeout:
+            print(f"Client {client_address} idle for {CLIENT_IDLE_TIMEOUT}s, closing session")
         except socket.error as e:
             print(f"Socket error with client {client_address}: {e}")
         except Exception as e:
             print(f"Error handling client {client_address}: {e}")
     
+    def receive_exact(self, client_socket, size):
+        """Read exactly size bytes, None if the client disconnected."""
+        data = bytearray()
+        while len(data) < size:
+            chunk = client_socket.recv(size - len(data))
+            if not chunk:
+                return None
+            data += chunk
+        return bytes(data)
+    
+    def receive_request(self, client_socket, client_address):
+        """Read one request, joining continuation frames and verifying each frame's checksum.
+        Returns: (version, code, payload, checksum_ok) or None if the session must be closed
+        """
+        payload = bytearray()
+        first = None
+        flags = FLAG_CONTINUATION
+        checksum_ok = True
+        running = 0
+        
+        while flags & FLAG_CONTINUATION:
+            # The minimum header (9 bytes) tells the version; v2 headers are 3 bytes longer
+            header = self.receive_exact(client_socket, MIN_HEADER_SIZE)
+            if header is None:
+                print(f"Client {client_address} disconnected")
+                return None
+            
+            header_size = self.protocol_handler.header_size(header[0])
+            if header_size is None:
+                print(f"Unsupported protocol version {header[0]} from {client_address}")
+                return None
+            if header_size > MIN_HEADER_SIZE:
+                rest = self.receive_exact(client_socket, header_size - MIN_HEADER_SIZE)
+                if rest is None:
+                    print(f"Client {client_address} disconnected")
+                    return None
+                header += rest
+            
+            version, code, flags, payload_size, checksum = self.protocol_handler.parse_header(header)
+            if first is None:
+                first = (version, code)
+            elif (version, code) != first:
+                print(f"Malformed continuation frame from {client_address}")
+                return None
+            
+            if len(payload) + payload_size > MAX_MESSAGE_SIZE:
+                print(f"Request from {client_address} exceeds maximum message size")
+                return None
+            
+            # Now read the payload
+            frame_payload = self.receive_exact(client_socket, payload_size)
+            if frame_payload is None:
+                print(f"Client {client_address} disconnected")
+                return None
+            payload += frame_payload
+            
+            running = frame_checksum(version, frame_payload, running if version == ProtocolVersions.V3 else 0)
+            if running != checksum:
+                checksum_ok = False
+        
+        return first[0], first[1], bytes(payload), checksum_ok
+    
     def handle_protocol_request(self, header, payload, client_address):
         """Handle different protocol requests."""
         try:
@@ -173,8 +240,18 @@ class MessageUServer:
                 return self.handle_login_request(payload)
             elif header == 3000:  # Send message request
                 return self.handle_send_message_request(payload)
+            elif header == 3003:  # Batched send message request
+                return self.handle_send_message_batch_request(payload)
+            elif header == 3005:  # Send symmetric key and first message request
+                return self.handle_send_with_key_request(payload)
+            elif header == 3007:  # Send one chunk of a file
+                return self.handle_send_file_chunk_request(payload)
+            elif header == 3008:  # Which file chunks are already stored
+                return self.handle_query_file_chunks_request(payload)
             elif header == 4000:  # Request messages
                 return self.handle_request_messages(payload)
+            elif header == 4002:  # Request a page of messages
+                return self.handle_request_messages_page(payload)
             elif header == 5000:  # Request users
                 return self.handle_request_users(payload)
             elif header == 5002:  # Request public key
@@ -183,6 +260,8 @@ class MessageUServer:
                 return self.handle_send_symmetric_key_request(payload)
             elif header == 6000:  # Logout request
                 return self.handle_logout_request(payload)
+            elif header == 7000:  # Protocol version negotiation
+                return self.handle_negotiate_request(payload)
             else:
                 print(f"Unknown protocol code: {header}")
                 return self.protocol_handler.create_error_response("Unknown protocol code")
@@ -194,17 +273,18 @@ class MessageUServer:
     def handle_registration_request(self, payload):
         """Handle client registration request."""
         try:
-            # Parse registration data from payload
-            if len(payload) < 1279:  # username(255) + public_key(1024)
+            # Parse registration data from payload: username(255) + public_key(1024)
+            reader = self.protocol_handler.reader(payload)
+            try:
+                username_bytes = reader.read_field(USERNAME_SIZE)
+                public_key_bytes = reader.read_field(PUBLIC_KEY_SIZE)
+            except ValueError:
                 return self.protocol_handler.create_error_response("Invalid registration payload")
             
-            username_bytes = payload[:255]
-            public_key_bytes = payload[255:1279]
-            
             # Username is utf-8, public key is binary (store as latin1)
-            username = username_bytes.rstrip(b'\0').decode('utf-8', errors='replace')
+            username = username_bytes.decode('utf-8', errors='replace')
             # Handle public key as PEM text (utf-8)
-            public_key = public_key_bytes.rstrip(b'\0').decode('utf-8', errors='replace')
+            public_key = public_key_bytes.decode('utf-8', errors='replace')
             
             # Generate a simple client ID (in real implementation, this would be a proper UUID)
             import hashlib
@@ -232,34 +312,27 @@ class MessageUServer:
         try:
             # Parse send message data from payload
             # Format: sender_id(16) + recipient(255) + message_length(4) + message_content
-            if len(payload) < 275:  # sender_id(16) + recipient(255) + message_length(4)
+            reader = self.protocol_handler.reader(payload)
+            try:
+                # Parse sender ID and recipient
+                sender_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                recipient = reader.read_field(USERNAME_SIZE).decode('utf-8')
+                
+                # Parse message length
+                message_length = reader.read_length()
+            except ValueError:
                 return self.protocol_handler.create_error_response("Invalid send message payload")
             
-            # Parse sender ID (16 bytes)
-            sender_id_bytes = payload[:16]
-            sender_id = sender_id_bytes.rstrip(b'\0').decode('utf-8')
-            
-            # Parse recipient (255 bytes)
-            recipient_bytes = payload[16:271]
-            recipient = recipient_bytes.rstrip(b'\0').decode('utf-8')
-            
             if not recipient:
                 return self.protocol_handler.create_error_response("Empty recipient")
             
-            # Parse message length (4 bytes, little-endian)
-            message_length = int.from_bytes(payload[271:275], byteorder='little')
-            
-            if len(payload) < 275 + message_length:
-                return self.protocol_handler.create_error_response("Invalid message content length")
-            
             # Parse message content (binary data, not UTF-8 text)
-            message_content_bytes = payload[275:275 + message_length]
-            # Convert binary data to base64 string for storage to preserve binary data
-            import base64
-            message_content = base64.b64encode(message_content_bytes).decode('ascii')
-            
+            try:
+                message_content_bytes = reader.read_bytes(message_length)
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid message content length")
             print(f"Send message request: from {sender_id} to {recipient}")
-            print(f"Message content: {message_content}")
+            print(f"Message content: {len(message_content_bytes)} bytes")
             
             # Validate that recipient exists
             recipient_client = self.database.get_client_by_identifier(recipient)
@@ -273,7 +346,7 @@ class MessageUServer:
             print(f"Recipient found: {recipient_client['name']} (ID: {recipient_client['client_id']})")
             
             # Store the message in the database with actual sender ID
-            if self.database.store_message(sender_id, recipient_client['client_id'], 1, message_content):
+            if self.database.store_message(sender_id, recipient_client['client_id'], MessageTypes.TEXT, message_content_bytes):
                 print(f"Message stored successfully for {recipient_client['name']}")
                 return self.protocol_handler.create_send_message_response(
                     True, 
@@ -290,18 +363,166 @@ class MessageUServer:
             print(f"Error in send message request: {e}")
             return self.protocol_handler.create_error_response("Failed to send message")
     
+    def handle_send_file_chunk_request(self, payload):
+        """Handle one chunk of a file; a chunk ID stored before is acknowledged without storing it again."""
+        try:
+            # Format: sender_id(16) + recipient(255) + chunk_id_length(4) + chunk_id + chunk_length(4) + chunk
+            reader = self.protocol_handler.reader(payload)
+            try:
+                sender_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                recipient = reader.read_field(USERNAME_SIZE).decode('utf-8')
+                chunk_id = reader.read_bytes(reader.read_length())
+                chunk = reader.read_bytes(reader.read_length())
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid file chunk payload")
+            
+            if not recipient or len(chunk_id) != CHUNK_ID_SIZE:
+                return self.protocol_handler.create_error_response("Invalid file chunk payload")
+            
+            recipient_client = self.database.get_client_by_identifier(recipient)
+            if not recipient_client:
+                return self.protocol_handler.create_send_message_response(False, f"Recipient '{recipient}' not found")
+            
+            if not self.database.store_file_chunk(sender_id, recipient_client['client_id'], MessageTypes.FILE_CHUNK,
+                                                  chunk_id, chunk):
+                return self.protocol_handler.create_send_message_response(False, "Failed to store file chunk")
+            return self.protocol_handler.create_send_message_response(True, "File chunk stored")
+        
+        except Exception as e:
+            print(f"Error in file chunk request: {e}")
+            return self.protocol_handler.create_error_response("Failed to store file chunk")
+    
+    def handle_query_file_chunks_request(self, payload):
+        """Handle a query for which chunks of a transfer the server already has."""
+        try:
+            # Format: sender_id(16) + recipient(255) + ids_length(4) + chunk_id(16) per chunk
+            reader = self.protocol_handler.reader(payload)
+            try:
+                sender_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                recipient = reader.read_field(USERNAME_SIZE).decode('utf-8')
+                ids = reader.read_bytes(reader.read_length())
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid file chunk query")
+            
+            if len(ids) % CHUNK_ID_SIZE or len(ids) // CHUNK_ID_SIZE > MAX_CHUNK_QUERY:
+                return self.protocol_handler.create_error_response("Invalid file chunk query")
+            
+            recipient_client = self.database.get_client_by_identifier(recipient)
+            if not recipient_client:
+                return self.protocol_handler.create_error_response(f"Recipient '{recipient}' not found")
+            
+            chunk_ids = [ids[i:i + CHUNK_ID_SIZE] for i in range(0, len(ids), CHUNK_ID_SIZE)]
+            stored = self.database.get_stored_chunk_ids(sender_id, recipient_client['client_id'], chunk_ids)
+            if stored is None:
+                return self.protocol_handler.create_error_response("Failed to look up file chunks")
+            
+            print(f"File chunk query from {sender_id}: {len(stored)} of {len(chunk_ids)} stored")
+            return self.protocol_handler.create_file_chunks_response([1 if chunk_id in stored else 0 for chunk_id in chunk_ids])
+        
+        except Exception as e:
+            print(f"Error in file chunk query: {e}")
+            return self.protocol_handler.create_error_response("Failed to look up file chunks")
+    
+    def handle_send_message_batch_request(self, payload):
+        """Handle a batch of messages from one sender, stored in a single transaction."""
+        try:
+            # Format: sender_id(16) + number_of_entries(4) + for each entry: recipient(255) + message_length(4) + message_content
+            reader = self.protocol_handler.reader(payload)
+            try:
+                sender_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                count = reader.read_uint32()
+                if count > MAX_BATCH_ENTRIES:
+                    return self.protocol_handler.create_error_response("Too many messages in batch")
+                
+                entries = []
+                for _ in range(count):
+                    recipient = reader.read_field(USERNAME_SIZE).decode('utf-8')
+                    entries.append((recipient, reader.read_bytes(reader.read_length())))
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid send message batch payload")
+            
+            print(f"Send message batch: {count} messages from {sender_id}")
+            
+            # Recipients are looked up once per batch, however many messages they get
+            recipients = {}
+            statuses = []
+            rows = []
+            for recipient, content in entries:
+                if not recipient:
+                    statuses.append(BatchStatus.INVALID_ENTRY)
+                    continue
+                if recipient not in recipients:
+                    recipients[recipient] = self.database.get_client_by_identifier(recipient)
+                recipient_client = recipients[recipient]
+                if not recipient_client:
+                    statuses.append(BatchStatus.RECIPIENT_NOT_FOUND)
+                    continue
+                
+                rows.append((sender_id, recipient_client['client_id'], MessageTypes.TEXT, content))
+                statuses.append(BatchStatus.STORED)
+            
+            if not self.database.store_messages(rows):
+                statuses = [BatchStatus.STORE_FAILED if status == BatchStatus.STORED else status for status in statuses]
+            
+            return self.protocol_handler.create_send_message_batch_response(statuses)
+        
+        except Exception as e:
+            print(f"Error in send message batch request: {e}")
+            return self.protocol_handler.create_error_response("Failed to send message batch")
+    
+    def handle_send_with_key_request(self, payload):
+        """Handle a symmetric key and the first message to a recipient, stored in a single transaction."""
+        try:
+            # Format: sender_id(16) + recipient(255) + key_length(4) + encrypted_key + message_length(4) + message_content
+            reader = self.protocol_handler.reader(payload)
+            try:
+                sender_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                recipient = reader.read_field(USERNAME_SIZE).decode('utf-8')
+                encrypted_key = reader.read_bytes(reader.read_length())
+                message_content = reader.read_bytes(reader.read_length())
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid send with key payload")
+            
+            if not recipient:
+                return self.protocol_handler.create_error_response("Empty recipient")
+            
+            print(f"Send with key request: from {sender_id} to {recipient}")
+            
+            recipient_client = self.database.get_client_by_identifier(recipient)
+            if not recipient_client:
+                print(f"Recipient not found: {recipient}")
+                return self.protocol_handler.create_send_with_key_response(False, message=f"Recipient '{recipient}' not found")
+            
+            # The key goes first so the recipient can decrypt the message that follows it
+            rows = [
+                (sender_id, recipient_client['client_id'], MessageTypes.SYMMETRIC_KEY, encrypted_key),
+                (sender_id, recipient_client['client_id'], MessageTypes.TEXT, message_content),
+            ]
+            if not self.database.store_messages(rows):
+                print("Failed to store symmetric key and message in database")
+                return self.protocol_handler.create_send_with_key_response(False, message="Failed to store message")
+            
+            print(f"Symmetric key and message stored for {recipient_client['name']}")
+            return self.protocol_handler.create_send_with_key_response(
+                True,
+                recipient_client['client_id'],
+                f"Message sent successfully to {recipient_client['name']}"
+            )
+        
+        except Exception as e:
+            print(f"Error in send with key request: {e}")
+            return self.protocol_handler.create_error_response("Failed to send message")
+    
     def handle_request_messages(self, payload):
         """Handle request for waiting messages."""
         try:
             # Parse waiting messages request
             # Format: client_id(16) - the requesting client's ID
-            if len(payload) < 16:
+            try:
+                client_id = self.protocol_handler.reader(payload).read_field(CLIENT_ID_SIZE).decode('utf-8')
+            except ValueError:
                 return self.protocol_handler.create_error_response("Invalid waiting messages request")
             
-            # Parse client ID (16 bytes)
-            client_id_bytes = payload[:16]
-            client_id = client_id_bytes.rstrip(b'\0').decode('utf-8')
-            
             print(f"Waiting messages request received from client: {client_id}")
             
             # Get waiting messages for this specific client
@@ -309,10 +530,14 @@ class MessageUServer:
             
             if messages:
                 print(f"Found {len(messages)} waiting messages for {client_id}")
-                # Mark messages as delivered by deleting them
-                message_ids = [msg['id'] for msg in messages]
-                self.database.delete_messages(message_ids)
-                return self.protocol_handler.create_messages_response(messages)
+                # Build the response first so messages are not lost if it cannot be created
+                response = self.protocol_handler.create_messages_response(messages)
+                # Mark messages as delivered by deleting them, unless the inbox was too
+                # large for the client's protocol version and an error went out instead
+                if self.protocol_handler.parse_header(response)[1] == ProtocolCodes.MESSAGES_RESPONSE:
+                    message_ids = [msg['id'] for msg in messages]
+                    self.database.delete_messages(message_ids)
+                return response
             else:
                 print(f"No waiting messages found for {client_id}")
                 return self.protocol_handler.create_messages_response([])
@@ -321,6 +546,50 @@ class MessageUServer:
             print(f"Error in waiting messages request: {e}")
             return self.protocol_handler.create_error_response("Failed to get waiting messages")
     
+    def handle_request_messages_page(self, payload):
+        """Handle request for one bounded page of waiting messages."""
+        try:
+            # Format: client_id(16) + cursor(4) + max_count(4) + max_bytes(4)
+            reader = self.protocol_handler.reader(payload)
+            try:
+                client_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                after_id, max_count, max_bytes = struct.unpack('<III', reader.read_bytes(12))
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid messages page request")
+            
+            # Clamp the client's budget; a v1 page must also fit the 16-bit size field
+            max_count = max(1, min(max_count, MAX_PAGE_MESSAGES))
+            max_bytes = min(max_bytes, MAX_PAGE_BYTES)
+            if self.protocol_handler.get_response_version() == ProtocolVersions.V1:
+                max_bytes = min(max_bytes, MAX_PAYLOAD_V1)
+            
+            # One extra row tells whether more messages follow this page
+            rows = self.database.get_waiting_messages_page(client_id, after_id, max_count + 1)
+            
+            page = []
+            page_bytes = MESSAGES_PAGE_HEADER_SIZE + 4
+            for message in rows[:max_count]:
+                record_size = self.protocol_handler.message_record_size(message)
+                # Always serve at least one message so the cursor keeps moving
+                if page and page_bytes + record_size > max_bytes:
+                    break
+                page.append(message)
+                page_bytes += record_size
+            
+            more = len(page) < len(rows)
+            next_cursor = page[-1]['id'] if page else after_id
+            print(f"Serving {len(page)} waiting messages to {client_id} (more: {more})")
+            
+            # Build the page first, then mark its messages as delivered
+            response = self.protocol_handler.create_messages_page_response(page, next_cursor, more)
+            if page and self.protocol_handler.parse_header(response)[1] == ProtocolCodes.MESSAGES_PAGE_RESPONSE:
+                self.database.delete_messages([msg['id'] for msg in page])
+            return response
+            
+        except Exception as e:
+            print(f"Error in messages page request: {e}")
+            return self.protocol_handler.create_error_response("Failed to get waiting messages")
+    
     def handle_request_users(self, payload):
         """Handle request for user list."""
         try:
@@ -341,13 +610,12 @@ class MessageUServer:
     def handle_get_public_key_request(self, payload):
         """Handle request for public key."""
         try:
-            # Parse the requested client identifier from payload
-            if len(payload) < 255:  # client_identifier(255)
+            # Parse the requested client identifier from payload: client_identifier(255)
+            try:
+                identifier = self.protocol_handler.reader(payload).read_field(USERNAME_SIZE).decode('utf-8')
+            except ValueError:
                 return self.protocol_handler.create_error_response("Invalid public key request payload")
             
-            identifier_bytes = payload[:255]
-            identifier = identifier_bytes.rstrip(b'\0').decode('utf-8')
-            
             if not identifier:
                 return self.protocol_handler.create_error_response("Empty client identifier")
             
@@ -382,28 +650,25 @@ class MessageUServer:
         try:
             # Parse symmetric key data from payload
             # Format: sender_id(16) + recipient(255) + key_length(4) + encrypted_key
-            if len(payload) < 275:  # sender_id(16) + recipient(255) + key_length(4)
+            reader = self.protocol_handler.reader(payload)
+            try:
+                # Parse sender ID and recipient
+                sender_id = reader.read_field(CLIENT_ID_SIZE).decode('utf-8')
+                recipient = reader.read_field(USERNAME_SIZE).decode('utf-8')
+                
+                # Parse key length
+                key_length = reader.read_length()
+            except ValueError:
                 return self.protocol_handler.create_error_response("Invalid symmetric key request payload")
             
-            # Parse sender ID (16 bytes)
-            sender_id_bytes = payload[:16]
-            sender_id = sender_id_bytes.rstrip(b'\0').decode('utf-8')
-            
-            # Parse recipient (255 bytes)
-            recipient_bytes = payload[16:271]
-            recipient = recipient_bytes.rstrip(b'\0').decode('utf-8')
-            
             if not recipient:
                 return self.protocol_handler.create_error_response("Empty recipient")
             
-            # Parse key length (4 bytes, little-endian)
-            key_length = int.from_bytes(payload[271:275], byteorder='little')
-            
-            if len(payload) < 275 + key_length:
-                return self.protocol_handler.create_error_response("Invalid encrypted key length")
-            
             # Extract encrypted key
-            encrypted_key = payload[275:275 + key_length]
+            try:
+                encrypted_key = reader.read_bytes(key_length)
+            except ValueError:
+                return self.protocol_handler.create_error_response("Invalid encrypted key length")
             
             print(f"Symmetric key request: from {sender_id} to {recipient}")
             print(f"Encrypted key length: {key_length} bytes")
@@ -416,11 +681,7 @@ class MessageUServer:
             
             print(f"Recipient found: {recipient_client['name']} (ID: {recipient_client['client_id']})")
             
-            # Convert encrypted key to base64 string for storage
-            import base64
-            encrypted_key_str = base64.b64encode(encrypted_key).decode('ascii')
-            
-            if self.database.store_message(sender_id, recipient_client['client_id'], 2, encrypted_key_str):
+            if self.database.store_message(sender_id, recipient_client['client_id'], MessageTypes.SYMMETRIC_KEY, encrypted_key):
                 print(f"Symmetric key stored successfully for {recipient_client['name']}")
                 return self.protocol_handler.create_response(ProtocolCodes.SYMMETRIC_KEY_RESPONSE, b"Symmetric key received")
             else:
@@ -431,6 +692,21 @@ class MessageUServer:
             print(f"Error in symmetric key request: {e}")
             return self.protocol_handler.create_error_response("Failed to process symmetric key")
     
+    def handle_negotiate_request(self, payload):
+        """Handle protocol version negotiation request."""
+        # Format: max_version(1) + features(4) - highest version and features the client supports
+        if len(payload) < 1:
+            return self.protocol_handler.create_error_response("Invalid negotiation payload")
+        
+        version = min(payload[0], MAX_SUPPORTED_VERSION)
+        features = struct.unpack('<I', payload[1:5])[0] & SUPPORTED_FEATURES if len(payload) >= 5 else 0
+        print(f"Negotiated protocol version {version}, features 0x{features:x}")
+        
+        # The response itself still uses the encoding the request came in
+        response = self.protocol_handler.create_negotiate_response(version, features)
+        self.protocol_handler.set_session_features(features)
+        return response
+    
     def handle_logout_request(self, payload):
         """Handle logout request."""
         # Placeholder for logout
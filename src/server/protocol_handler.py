@@ -3,6 +3,8 @@ Simple protocol handler for MessageU server.
 """
 
 import struct
+import base64
+import threading
 from typing import Optional, Tuple, Dict, Any, List
 from enum import IntEnum
 
@@ -18,8 +20,17 @@ class ProtocolCodes(IntEnum):
     SEND_MESSAGE_REQUEST = 3000
     SEND_MESSAGE_SUCCESS = 3001
     SEND_MESSAGE_FAILURE = 3002
+    SEND_MESSAGE_BATCH_REQUEST = 3003
+    SEND_MESSAGE_BATCH_RESPONSE = 3004
+    SEND_WITH_KEY_REQUEST = 3005
+    SEND_WITH_KEY_RESPONSE = 3006
+    SEND_FILE_CHUNK_REQUEST = 3007
+    QUERY_FILE_CHUNKS_REQUEST = 3008
+    FILE_CHUNKS_RESPONSE = 3009
     REQUEST_MESSAGES = 4000
     MESSAGES_RESPONSE = 4001
+    REQUEST_MESSAGES_PAGE = 4002
+    MESSAGES_PAGE_RESPONSE = 4003
     REQUEST_USERS = 5000
     USERS_RESPONSE = 5001
     REQUEST_PUBLIC_KEY = 5002
@@ -28,6 +39,160 @@ class ProtocolCodes(IntEnum):
     SYMMETRIC_KEY_RESPONSE = 5005
     LOGOUT_REQUEST = 6000
     LOGOUT_SUCCESS = 6001
+    NEGOTIATE_REQUEST = 7000
+    NEGOTIATE_RESPONSE = 7001
+
+
+class ProtocolVersions(IntEnum):
+    """Protocol versions, selected by the first header byte."""
+    V1 = 1  # version(1) + code(2) + payload_size(2) + checksum(4) = 9 bytes
+    V2 = 2  # version(1) + code(2) + flags(1) + payload_size(4) + checksum(4) = 12 bytes
+    V3 = 3  # v2 layout with a CRC32C checksum, chained across continuation frames
+
+
+MIN_HEADER_SIZE = 9
+HEADER_FORMATS = {
+    ProtocolVersions.V1: '<BHHI',
+    ProtocolVersions.V2: '<BHBII',
+    ProtocolVersions.V3: '<BHBII',
+}
+
+# Header flags (v2)
+FLAG_CONTINUATION = 0x01  # More frames of the same message follow
+
+MAX_PAYLOAD_V1 = 0xFFFF
+MAX_FRAME_PAYLOAD = 1024 * 1024  # Largest payload carried by a single v2 frame
+MAX_MESSAGE_SIZE = 64 * 1024 * 1024  # Sanity cap on a reassembled message
+
+# Optional features, negotiated per session as a bit mask
+FEATURE_COMPACT_ENCODING = 0x01  # Varint length-prefixed strings instead of padded fields
+FEATURE_BATCH_SEND = 0x02  # SEND_MESSAGE_BATCH_REQUEST is understood
+FEATURE_SEND_WITH_KEY = 0x04  # SEND_WITH_KEY_REQUEST is understood
+FEATURE_BINARY_CONTENT = 0x08  # Message content is sent as raw bytes instead of base64 text
+FEATURE_FILE_CHUNKS = 0x10  # SEND_FILE_CHUNK_REQUEST and QUERY_FILE_CHUNKS_REQUEST are understood
+SUPPORTED_FEATURES = (FEATURE_COMPACT_ENCODING | FEATURE_BATCH_SEND | FEATURE_SEND_WITH_KEY | FEATURE_BINARY_CONTENT |
+                      FEATURE_FILE_CHUNKS)
+
+# Fixed field sizes of the padded encoding (also the length limits of the compact one)
+CLIENT_ID_SIZE = 16
+USERNAME_SIZE = 255
+PUBLIC_KEY_SIZE = 1024
+
+MESSAGES_PAGE_HEADER_SIZE = 4 + 1  # next_cursor(4) + more(1), before the message count
+
+MAX_BATCH_ENTRIES = 1024  # Messages accepted in one SEND_MESSAGE_BATCH_REQUEST
+
+CHUNK_ID_SIZE = 16  # File chunk IDs are chosen by the sender; the server only compares them
+MAX_CHUNK_QUERY = 4000  # Chunk IDs accepted in one QUERY_FILE_CHUNKS_REQUEST (fits a v1 frame)
+
+
+class MessageTypes(IntEnum):
+    """Type of a stored message, as delivered to the recipient."""
+    TEXT = 1
+    SYMMETRIC_KEY = 2
+    FILE_CHUNK = 3  # One encrypted piece of a file attachment
+
+
+class BatchStatus(IntEnum):
+    """Per-entry result of a batched send."""
+    STORED = 0
+    RECIPIENT_NOT_FOUND = 1
+    INVALID_ENTRY = 2
+    STORE_FAILED = 3
+
+
+def _load_crc32c():
+    """Native CRC32C as fn(data, crc) -> crc, or None when no accelerated module is installed."""
+    try:
+        import crc32c as module  # pip install crc32c
+        return lambda data, crc: module.crc32c(data, crc)
+    except ImportError:
+        pass
+    try:
+        import google_crc32c as module  # pip install google-crc32c
+        if module.implementation == 'c':  # Its pure-Python fallback is as slow as a byte loop
+            return lambda data, crc: module.extend(crc, data)
+    except ImportError:
+        pass
+    return None
+
+
+_CRC32C = _load_crc32c()
+
+# v3 is offered only with a native CRC32C; a per-byte Python loop costs about a second on a multi-MB page
+if _CRC32C is None:
+    MAX_SUPPORTED_VERSION = ProtocolVersions.V2
+    del HEADER_FORMATS[ProtocolVersions.V3]
+else:
+    MAX_SUPPORTED_VERSION = ProtocolVersions.V3
+
+
+def crc32c(data: bytes, crc: int = 0) -> int:
+    """CRC32C of data; crc32c(b, crc32c(a)) == crc32c(a + b). Only called when v3 is supported."""
+    return _CRC32C(data, crc)
+
+
+def frame_checksum(version: int, data: bytes, running: int = 0) -> int:
+    """Checksum of a frame payload continuing from running: CRC32C for v3, byte sum otherwise.
+    v3 frames carry the CRC of the whole message so far, additive frames only their own sum.
+    """
+    if version == ProtocolVersions.V3:
+        return crc32c(data, running)
+    return (running + sum(data)) & 0xFFFFFFFF
+
+
+def encode_varint(value: int) -> bytes:
+    """Encode an unsigned integer as LEB128 (7 bits per byte, high bit = more bytes)."""
+    result = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            result.append(byte | 0x80)
+        else:
+            result.append(byte)
+            return bytes(result)
+
+
+class PayloadReader:
+    """Sequential reader for request payloads in the padded or compact encoding."""
+    
+    def __init__(self, payload: bytes, compact: bool):
+        self.payload = payload
+        self.compact = compact
+        self.offset = 0
+    
+    def read_bytes(self, size: int) -> bytes:
+        if self.offset + size > len(self.payload):
+            raise ValueError("Truncated payload")
+        data = self.payload[self.offset:self.offset + size]
+        self.offset += size
+        return data
+    
+    def read_uint32(self) -> int:
+        return int.from_bytes(self.read_bytes(4), byteorder='little')
+    
+    def read_varint(self) -> int:
+        value = 0
+        for shift in range(0, 35, 7):
+            byte = self.read_bytes(1)[0]
+            value |= (byte & 0x7F) << shift
+            if not byte & 0x80:
+                return value
+        raise ValueError("Invalid varint")
+    
+    def read_length(self) -> int:
+        """Read a length prefix: uint32 when padded, varint when compact."""
+        return self.read_varint() if self.compact else self.read_uint32()
+    
+    def read_field(self, fixed_size: int) -> bytes:
+        """Read a string field, without its padding."""
+        if not self.compact:
+            return self.read_bytes(fixed_size).rstrip(b'\0')
+        length = self.read_varint()
+        if length > fixed_size:
+            raise ValueError("Field too long")
+        return self.read_bytes(length)
 
 
 class ProtocolHandler:
@@ -35,42 +200,121 @@ class ProtocolHandler:
     
     def __init__(self):
         self.version = 1
+        # Responses use the version of the request being answered (per client thread)
+        self._local = threading.local()
+    
+    @staticmethod
+    def header_size(version: int) -> Optional[int]:
+        """Header size for a protocol version, None if the version is unknown."""
+        header_format = HEADER_FORMATS.get(version)
+        return struct.calcsize(header_format) if header_format else None
+    
+    def parse_header(self, data: bytes) -> Optional[Tuple[int, int, int, int, int]]:
+        """Parse a v1 or v2 frame header.
+        Returns: (version, code, flags, payload_size, checksum) or None if invalid
+        """
+        if len(data) < MIN_HEADER_SIZE:
+            return None
+        
+        header_size = self.header_size(data[0])
+        if header_size is None or len(data) < header_size:
+            return None
         
+        if data[0] == ProtocolVersions.V1:
+            version, code, payload_size, checksum = struct.unpack(HEADER_FORMATS[ProtocolVersions.V1], data[:header_size])
+            flags = 0
+        else:
+            version, code, flags, payload_size, checksum = struct.unpack(HEADER_FORMATS[data[0]], data[:header_size])
+        return version, code, flags, payload_size, checksum
+    
     def parse_request(self, data: bytes) -> Tuple[Optional[int], Optional[bytes]]:
-        """Parse incoming request data.
+        """Parse a single-frame request.
         Returns: (protocol_code, payload) or (None, None) if invalid
         """
-        if len(data) < 9:  # Minimum header size
+        header = self.parse_header(data)
+        if header is None:
             return None, None
-            
-        try:
-            # Parse header: version(1) + code(2) + payload_size(2) + checksum(4) = 9 bytes
-            version, code, payload_size, checksum = struct.unpack('<BHHI', data[:9])
-            
-            if version != 1:
-                return None, None
-                
-            if len(data) < 9 + payload_size:
-                return None, None
-                
-            payload = data[9:9 + payload_size]
-            return code, payload
-            
-        except struct.error:
+        
+        version, code, flags, payload_size, checksum = header
+        header_size = self.header_size(version)
+        if len(data) < header_size + payload_size:
             return None, None
+            
+        payload = data[header_size:header_size + payload_size]
+        return code, payload
+    
+    def set_response_version(self, version: int):
+        """Select the header version for responses sent from the current thread."""
+        self._local.version = version if version in HEADER_FORMATS else ProtocolVersions.V1
+    
+    def get_response_version(self) -> int:
+        return getattr(self._local, 'version', self.version)
+    
+    def set_session_features(self, features: int):
+        """Select the negotiated features for the current thread's session."""
+        self._local.features = features & SUPPORTED_FEATURES
+    
+    def is_compact(self) -> bool:
+        return bool(getattr(self._local, 'features', 0) & FEATURE_COMPACT_ENCODING)
+    
+    def is_binary_content(self) -> bool:
+        return bool(getattr(self._local, 'features', 0) & FEATURE_BINARY_CONTENT)
+    
+    def reader(self, payload: bytes) -> PayloadReader:
+        """Reader for a request payload in the session's field encoding."""
+        return PayloadReader(payload, self.is_compact())
+    
+    def pack_string(self, value: str, fixed_size: int) -> bytes:
+        """Encode a string field: NUL-padded to fixed_size, or varint length + bytes when compact."""
+        data = value.encode('utf-8')[:fixed_size]
+        if self.is_compact():
+            return encode_varint(len(data)) + data
+        return data.ljust(fixed_size, b'\0')
+    
+    def pack_length(self, length: int) -> bytes:
+        """Encode a length prefix: uint32 when padded, varint when compact."""
+        return encode_varint(length) if self.is_compact() else length.to_bytes(4, byteorder='little')
         
     def create_response(self, code: int, payload: bytes = b"") -> bytes:
         """Create a protocol response."""
-        # Header: version(1) + code(2) + payload_size(2) + checksum(4) = 9 bytes
-        checksum = sum(payload) & 0xFFFFFFFF  # Simple checksum
-        header = struct.pack('<BHHI', self.version, code, len(payload), checksum)
-        return header + payload
+        version = self.get_response_version()
+        
+        if version == ProtocolVersions.V1:
+            if len(payload) > MAX_PAYLOAD_V1:
+                # Would not fit the 16-bit size field; v2 clients get the whole payload
+                return self.create_error_response("Response too large for protocol v1")
+            # Header: version(1) + code(2) + payload_size(2) + checksum(4) = 9 bytes
+            checksum = frame_checksum(version, payload)
+            header = struct.pack(HEADER_FORMATS[ProtocolVersions.V1], version, code, len(payload), checksum)
+            return header + payload
+        
+        # v2/v3: large payloads are split into frames, all but the last flagged as continued
+        frames = []
+        offset = 0
+        crc = 0
+        while True:
+            chunk = payload[offset:offset + MAX_FRAME_PAYLOAD]
+            offset += len(chunk)
+            flags = FLAG_CONTINUATION if offset < len(payload) else 0
+            checksum = frame_checksum(version, chunk, crc if version == ProtocolVersions.V3 else 0)
+            crc = checksum
+            frames.append(struct.pack(HEADER_FORMATS[version], version, code, flags, len(chunk), checksum))
+            frames.append(bytes(chunk))
+            if not flags:
+                break
+        return b"".join(frames)
+    
+    def create_negotiate_response(self, version: int, features: int) -> bytes:
+        """Create version negotiation response."""
+        # Format: version(1) + features(4)
+        payload = bytes([version]) + struct.pack('<I', features)
+        return self.create_response(ProtocolCodes.NEGOTIATE_RESPONSE, payload)
         
     def create_registration_response(self, success: bool, client_id: str = "", message: str = "") -> bytes:
         """Create registration response."""
         if success:
             # Success: client_id(16) + message
-            client_id_bytes = client_id.encode('utf-8')[:16].ljust(16, b'\0')
+            client_id_bytes = self.pack_string(client_id, CLIENT_ID_SIZE)
             message_bytes = message.encode('utf-8')
             payload = client_id_bytes + message_bytes
             return self.create_response(ProtocolCodes.REGISTRATION_SUCCESS, payload)
@@ -91,12 +335,10 @@ class ProtocolHandler:
         
         for user in users:
             # Client ID (16 bytes, padded with nulls)
-            client_id = user.get('client_id', '')[:16].ljust(16, '\0')
-            result += client_id.encode('utf-8')
+            result += self.pack_string(user.get('client_id', ''), CLIENT_ID_SIZE)
             
             # Name (255 bytes, padded with nulls)
-            name = user.get('name', '')[:255].ljust(255, '\0')
-            result += name.encode('utf-8')
+            result += self.pack_string(user.get('name', ''), USERNAME_SIZE)
         
         return self.create_response(ProtocolCodes.USERS_RESPONSE, result)
     
@@ -104,9 +346,9 @@ class ProtocolHandler:
         """Create public key response."""
         if success:
             # Success: client_id(16) + public_key(1024) + message
-            client_id_bytes = client_id.encode('utf-8')[:16].ljust(16, b'\0')
+            client_id_bytes = self.pack_string(client_id, CLIENT_ID_SIZE)
             # Handle public key as PEM text (utf-8)
-            public_key_bytes = public_key.encode('utf-8')[:1024].ljust(1024, b'\0')
+            public_key_bytes = self.pack_string(public_key, PUBLIC_KEY_SIZE)
             message_bytes = message.encode('utf-8')
             payload = client_id_bytes + public_key_bytes + message_bytes
             return self.create_response(ProtocolCodes.PUBLIC_KEY_RESPONSE, payload)
@@ -115,6 +357,42 @@ class ProtocolHandler:
             payload = message.encode('utf-8')
             return self.create_response(ProtocolCodes.REGISTRATION_FAILURE, payload)
     
+    def pack_message_record(self, payload: bytearray, message: Dict[str, Any]):
+        """Append one message record to a messages payload."""
+        # From client ID (16 bytes)
+        from_client_id = message.get('from_client_id', '')
+        payload.extend(self.pack_string(from_client_id, CLIENT_ID_SIZE))
+        
+        # Message ID (4 bytes, little-endian)
+        message_id = message.get('id', 0)
+        payload.extend(message_id.to_bytes(4, byteorder='little'))
+        
+        # Message type (1 byte)
+        message_type = message.get('message_type', 0)
+        payload.append(message_type)
+        
+        # Content: stored as raw bytes; clients that did not negotiate binary content get base64 text
+        content_bytes = bytes(message.get('content', b''))
+        if not self.is_binary_content():
+            content_bytes = base64.b64encode(content_bytes)
+        content_size = len(content_bytes)
+        
+        # Content size (4 bytes, little-endian)
+        payload.extend(self.pack_length(content_size))
+        
+        # Content
+        payload.extend(content_bytes)
+        
+        # Sender name (255 bytes)
+        sender_name = message.get('sender_name', 'Unknown')
+        payload.extend(self.pack_string(sender_name, USERNAME_SIZE))
+    
+    def message_record_size(self, message: Dict[str, Any]) -> int:
+        """Size of one message record in the session's field encoding."""
+        record = bytearray()
+        self.pack_message_record(record, message)
+        return len(record)
+    
     def create_messages_response(self, messages: List[Dict[str, Any]]) -> bytes:
         """Create messages response."""
         # Format: number_of_messages(4) + [from_client_id(16) + message_id(4) + message_type(1) + content_size(4) + content + sender_name(255)]
@@ -125,37 +403,23 @@ class ProtocolHandler:
         payload.extend(num_messages.to_bytes(4, byteorder='little'))
         
         for message in messages:
-            # From client ID (16 bytes)
-            from_client_id = message.get('from_client_id', '')
-            from_client_id_bytes = from_client_id.encode('utf-8')[:16].ljust(16, b'\0')
-            payload.extend(from_client_id_bytes)
-            
-            # Message ID (4 bytes, little-endian)
-            message_id = message.get('id', 0)
-            payload.extend(message_id.to_bytes(4, byteorder='little'))
-            
-            # Message type (1 byte)
-            message_type = message.get('message_type', 0)
-            payload.append(message_type)
-            
-            # Content
-            content = message.get('content', '')
-            content_bytes = content.encode('utf-8')
-            content_size = len(content_bytes)
-            
-            # Content size (4 bytes, little-endian)
-            payload.extend(content_size.to_bytes(4, byteorder='little'))
-            
-            # Content
-            payload.extend(content_bytes)
-            
-            # Sender name (255 bytes)
-            sender_name = message.get('sender_name', 'Unknown')
-            sender_name_bytes = sender_name.encode('utf-8')[:255].ljust(255, b'\0')
-            payload.extend(sender_name_bytes)
+            self.pack_message_record(payload, message)
         
         return self.create_response(ProtocolCodes.MESSAGES_RESPONSE, payload)
     
+    def create_messages_page_response(self, messages: List[Dict[str, Any]], next_cursor: int, more: bool) -> bytes:
+        """Create one page of waiting messages."""
+        # Format: next_cursor(4) + more(1) + number_of_messages(4) + records (as in MESSAGES_RESPONSE)
+        payload = bytearray()
+        payload.extend(next_cursor.to_bytes(4, byteorder='little'))
+        payload.append(1 if more else 0)
+        payload.extend(len(messages).to_bytes(4, byteorder='little'))
+        
+        for message in messages:
+            self.pack_message_record(payload, message)
+        
+        return self.create_response(ProtocolCodes.MESSAGES_PAGE_RESPONSE, payload)
+    
     def create_send_message_response(self, success: bool, message: str = "") -> bytes:
         """Create send message response."""
         if success:
@@ -165,4 +429,29 @@ class ProtocolHandler:
         else:
             # Failure: error message
             payload = message.encode('utf-8')
-            return self.create_response(ProtocolCodes.SEND_MESSAGE_FAILURE, payload) 
\ No newline at end of file
+            return self.create_response(ProtocolCodes.SEND_MESSAGE_FAILURE, payload) 
+    
+    def create_send_message_batch_response(self, statuses: List[int]) -> bytes:
+        """Create the response to a batched send."""
+        # Format: number_of_entries(4) + status(1) per entry, in request order
+        payload = bytearray(struct.pack('<I', len(statuses)))
+        payload.extend(bytes(statuses))
+        return self.create_response(ProtocolCodes.SEND_MESSAGE_BATCH_RESPONSE, payload)
+    
+    def create_file_chunks_response(self, statuses: List[int]) -> bytes:
+        """Create the answer to a file chunk query."""
+        # Format: number_of_chunks(4) + stored(1) per chunk ID, in request order
+        payload = bytearray(struct.pack('<I', len(statuses)))
+        payload.extend(bytes(statuses))
+        return self.create_response(ProtocolCodes.FILE_CHUNKS_RESPONSE, payload)
+    
+    def create_send_with_key_response(self, success: bool, client_id: str = "", message: str = "") -> bytes:
+        """Create the response to a compound key and message send."""
+        if success:
+            # Success: recipient client_id(16) + message
+            payload = self.pack_string(client_id, CLIENT_ID_SIZE) + message.encode('utf-8')
+            return self.create_response(ProtocolCodes.SEND_WITH_KEY_RESPONSE, payload)
+        else:
+            # Failure: error message
+            payload = message.encode('utf-8')
+            return self.create_response(ProtocolCodes.SEND_MESSAGE_FAILURE, payload)